@@ -0,0 +1,269 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+/*
+ * Compares the BitVector input encoding (bitvector.cpp) with the
+ * InputCodec (input_codec.cpp) on a few kinds of input, and with what
+ * UdpProtocol actually sends now that it codes every packet both ways and
+ * keeps the smaller one.
+ *
+ * Each packet carries the frames the remote end hasn't acked yet, coded
+ * against the last acked frame, so the same input stream is run with a few
+ * window sizes.  Sizes are in bytes; a BitVector is rounded up to a whole
+ * byte, as in a CompactInput.  Every packet is decoded again to make sure
+ * both encodings round-trip.
+ *
+ *    codec_bench [frames]
+ */
+
+#include "types.h"
+#include "bitvector.h"
+#include "game_input.h"
+#include "input_codec.h"
+#include <time.h>
+
+#define DEFAULT_FRAMES     200000
+#define MAX_WINDOW         8
+
+void Log(const char *fmt, ...) { }
+void Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...) { }
+void Logv(EGGPOLogVerbosity Verbosity, const char *fmt, va_list list) { }
+
+struct Profile {
+   const char  *name;
+   int         size;
+   void        (*next)(uint32 *seed, int frame, uint8 *bits, int size);
+};
+
+static uint32
+Random(uint32 *seed)
+{
+   *seed = *seed * 1103515245 + 12345;
+   return *seed >> 8;
+}
+
+/*
+ * A digital pad: a button goes down or up every 8 frames or so, with the
+ * occasional two at once.
+ */
+static void
+NextDigitalPad(uint32 *seed, int frame, uint8 *bits, int size)
+{
+   if (Random(seed) % 8 == 0) {
+      int button = Random(seed) % (size * 8);
+      bits[button / 8] ^= (1 << (button % 8));
+      if (Random(seed) % 4 == 0) {
+         button = Random(seed) % (size * 8);
+         bits[button / 8] ^= (1 << (button % 8));
+      }
+   }
+}
+
+/*
+ * A stick that rolls through directions, plus buttons mashed every few
+ * frames.
+ */
+static void
+NextFightStick(uint32 *seed, int frame, uint8 *bits, int size)
+{
+   static const uint8 directions[] = { 0x0, 0x2, 0x6, 0x4, 0x5, 0x1, 0x9, 0x8, 0xa };
+   bits[0] = (bits[0] & 0xf0) | directions[(frame / 3) % ARRAY_SIZE(directions)];
+   if (Random(seed) % 3 == 0) {
+      bits[0] ^= (uint8)(0x10 << (Random(seed) % 4));
+   }
+}
+
+/*
+ * Two buttons bytes and six bytes of analog axes that drift a little most
+ * frames.
+ */
+static void
+NextAnalog(uint32 *seed, int frame, uint8 *bits, int size)
+{
+   NextDigitalPad(seed, frame, bits, 2);
+   for (int i = 2; i < size; i++) {
+      if (Random(seed) % 3 == 0) {
+         bits[i] += (uint8)(Random(seed) % 5) - 2;
+      }
+   }
+}
+
+/*
+ * What a spectator gets: both players' digital pads in one input.
+ */
+static void
+NextTwoPads(uint32 *seed, int frame, uint8 *bits, int size)
+{
+   NextDigitalPad(seed, frame, bits, size / 2);
+   NextDigitalPad(seed, frame, bits + size / 2, size / 2);
+}
+
+static const Profile profiles[] = {
+   { "digital pad",     2,    NextDigitalPad },
+   { "fight stick",     1,    NextFightStick },
+   { "analog",          8,    NextAnalog },
+   { "two pads",        4,    NextTwoPads },
+};
+
+/*
+ * The same (changed, value, index) triples UdpProtocol::EncodeBitVector
+ * writes, padded with 1 bits to a whole byte.
+ */
+static int
+EncodeBitVector(uint8 *out, const GameInput &acked, const GameInput *frames, int count)
+{
+   const GameInput *last = &acked;
+   int offset = 0;
+
+   for (int j = 0; j < count; j++) {
+      const GameInput &current = frames[j];
+      for (int i = 0; i < current.size * 8; i++) {
+         if (current.value(i) != last->value(i)) {
+            BitVector_SetBit(out, &offset);
+            (current.value(i) ? BitVector_SetBit : BitVector_ClearBit)(out, &offset);
+            BitVector_WriteNibblet(out, i, &offset);
+         }
+      }
+      BitVector_ClearBit(out, &offset);
+      last = &current;
+   }
+   while (offset % 8) {
+      BitVector_SetBit(out, &offset);
+   }
+   return offset / 8;
+}
+
+static bool
+DecodeBitVector(uint8 *in, int len, GameInput *input, const GameInput *expected, int count)
+{
+   int offset = 0, numBits = len * 8;
+
+   for (int j = 0; j < count; j++) {
+      while (BitVector_ReadBit(in, &offset)) {
+         if (offset + 1 + BITVECTOR_NIBBLE_SIZE > numBits) {
+            return false;
+         }
+         int on = BitVector_ReadBit(in, &offset);
+         int button = BitVector_ReadNibblet(in, &offset);
+         on ? input->set(button) : input->clear(button);
+      }
+      if (memcmp(input->bits, expected[j].bits, input->size)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+static int
+EncodeInputCodec(uint8 *out, int capacity, const GameInput &acked, const GameInput *frames, int count)
+{
+   InputEncoder enc;
+   const GameInput *last = &acked;
+
+   InputCodec_BeginEncode(&enc, out, capacity);
+   for (int j = 0; j < count; j++) {
+      if (!InputCodec_EncodeFrame(&enc, *last, frames[j])) {
+         return -1;
+      }
+      last = frames + j;
+   }
+   return InputCodec_EndEncode(&enc);
+}
+
+static bool
+DecodeInputCodec(uint8 *in, int len, GameInput *input, const GameInput *expected, int count)
+{
+   InputDecoder dec;
+
+   InputCodec_BeginDecode(&dec, in, len);
+   for (int j = 0; j < count; j++) {
+      if (!InputCodec_DecodeFrame(&dec, input, true) ||
+          memcmp(input->bits, expected[j].bits, input->size)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+static double
+Seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+   int num_frames = argc > 1 ? atoi(argv[1]) : DEFAULT_FRAMES;
+   GameInput *frames = new GameInput[num_frames];
+   uint8 buf[512];
+   static const int windows[] = { 1, 4, MAX_WINDOW };
+
+   printf("%d frames per profile.  bytes are per packet, ns per packet.\n\n", num_frames);
+   printf("%-12s %6s | %10s %8s | %10s %8s | %10s %7s\n",
+          "profile", "window", "bitvector", "ns", "xor codec", "ns", "smaller", "bv won");
+
+   for (int p = 0; p < (int)ARRAY_SIZE(profiles); p++) {
+      const Profile &profile = profiles[p];
+      uint32 seed = 1;
+      char bits[GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS] = { 0 };
+
+      for (int f = 0; f < num_frames; f++) {
+         profile.next(&seed, f, (uint8 *)bits, profile.size);
+         frames[f].init(f, bits, profile.size);
+      }
+
+      for (int w = 0; w < (int)ARRAY_SIZE(windows); w++) {
+         int window = windows[w];
+         int packets = num_frames - window;
+         long bv_bytes = 0, xor_bytes = 0, best_bytes = 0, bv_won = 0;
+         double bv_time = 0, xor_time = 0, start;
+
+         for (int f = 1; f < packets; f++) {
+            GameInput input;
+            int bv_len, xor_len;
+
+            start = Seconds();
+            for (int rep = 0; rep < 4; rep++) {
+               memset(buf, 0, sizeof buf);
+               bv_len = EncodeBitVector(buf, frames[f - 1], frames + f, window);
+            }
+            bv_time += Seconds() - start;
+            input = frames[f - 1];
+            if (!DecodeBitVector(buf, bv_len, &input, frames + f, window)) {
+               printf("bitvector round trip failed at frame %d\n", f);
+               return 1;
+            }
+
+            start = Seconds();
+            for (int rep = 0; rep < 4; rep++) {
+               xor_len = EncodeInputCodec(buf, sizeof buf, frames[f - 1], frames + f, window);
+            }
+            xor_time += Seconds() - start;
+            input = frames[f - 1];
+            if (xor_len < 0 || !DecodeInputCodec(buf, xor_len, &input, frames + f, window)) {
+               printf("xor codec round trip failed at frame %d\n", f);
+               return 1;
+            }
+
+            bv_bytes += bv_len;
+            xor_bytes += xor_len;
+            best_bytes += MIN(bv_len, xor_len);
+            bv_won += bv_len < xor_len;
+         }
+         printf("%-12s %6d | %10.2f %8.1f | %10.2f %8.1f | %10.2f %6.1f%%\n",
+                w ? "" : profile.name, window,
+                (double)bv_bytes / packets, bv_time * 1e9 / (packets * 4.0),
+                (double)xor_bytes / packets, xor_time * 1e9 / (packets * 4.0),
+                (double)best_bytes / packets, 100.0 * bv_won / packets);
+      }
+   }
+   delete [] frames;
+   return 0;
+}
@@ -0,0 +1,154 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+/*
+ * Compares Udp's two Linux engines, recvmmsg/sendmmsg on the socket and
+ * io_uring (ggpo.network.io_uring), with 1, 8 and 64 sessions in one
+ * process.
+ *
+ * Every session is a pair of Udps on 127.0.0.1, each with its own Poll the
+ * way a backend has one.  Each frame the first sends a few input-sized
+ * packets to the second and flushes, the second pumps and echoes them
+ * back, and the first pumps the echoes.  Reports frames per second across
+ * all sessions, CPU time per session-frame, and how many echoes made it
+ * back.
+ *
+ *    udp_bench [seconds per run] [base port]
+ */
+
+#include "types.h"
+#include "network/udp.h"
+#include "network/udp_msg.h"
+#include <time.h>
+
+#define DEFAULT_SECONDS       2
+#define DEFAULT_BASE_PORT     21000
+#define PACKETS_PER_FRAME     4
+#define PACKET_SIZE           48
+
+void Log(const char *fmt, ...) { }
+void Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...) { }
+void Logv(EGGPOLogVerbosity Verbosity, const char *fmt, va_list list) { }
+
+class BenchUdp : public Udp
+{
+public:
+   bool UsingUring() { return _uring != NULL; }
+};
+
+struct Endpoint : public Transport::Callbacks {
+   Poll        poll;
+   BenchUdp    udp;
+   bool        echo;
+   long        received;
+
+   virtual void OnMsg(sockaddr_in &from, UdpMsg *msg, int len) {
+      received++;
+      if (echo) {
+         udp.SendTo((char *)msg, len, 0, (struct sockaddr *)&from, sizeof from);
+      }
+   }
+};
+
+struct Session {
+   Endpoint    sender;
+   Endpoint    echoer;
+   sockaddr_in echoer_addr;
+};
+
+static double
+Seconds(clockid_t clock)
+{
+   struct timespec ts;
+   clock_gettime(clock, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool
+Run(const char *name, bool uring, int num_sessions, int seconds, int base_port)
+{
+   Session *sessions = new Session[num_sessions];
+   char packet[PACKET_SIZE] = { 0 };
+
+   if (uring) {
+      setenv("ggpo.network.io_uring", "1", 1);
+   } else {
+      unsetenv("ggpo.network.io_uring");
+   }
+   for (int i = 0; i < num_sessions; i++) {
+      Session &s = sessions[i];
+      s.sender.echo = false;
+      s.sender.received = 0;
+      s.echoer.echo = true;
+      s.echoer.received = 0;
+      s.sender.udp.Init((uint16)(base_port + 2 * i), &s.sender.poll, &s.sender);
+      s.echoer.udp.Init((uint16)(base_port + 2 * i + 1), &s.echoer.poll, &s.echoer);
+
+      memset(&s.echoer_addr, 0, sizeof s.echoer_addr);
+      s.echoer_addr.sin_family = AF_INET;
+      s.echoer_addr.sin_port = htons((uint16)(base_port + 2 * i + 1));
+      s.echoer_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   }
+   if (uring && !sessions[0].sender.udp.UsingUring()) {
+      printf("%-16s %8d | io_uring is not available here\n", name, num_sessions);
+      delete [] sessions;
+      return false;
+   }
+
+   long frames = 0;
+   double start = Seconds(CLOCK_MONOTONIC);
+   double cpu_start = Seconds(CLOCK_PROCESS_CPUTIME_ID);
+   while (Seconds(CLOCK_MONOTONIC) - start < seconds) {
+      for (int i = 0; i < num_sessions; i++) {
+         Session &s = sessions[i];
+         for (int k = 0; k < PACKETS_PER_FRAME; k++) {
+            s.sender.udp.SendTo(packet, sizeof packet, 0, (struct sockaddr *)&s.echoer_addr, sizeof s.echoer_addr);
+         }
+         s.sender.udp.Flush();
+      }
+      for (int i = 0; i < num_sessions; i++) {
+         sessions[i].echoer.poll.Pump(0);
+         sessions[i].echoer.udp.Flush();
+      }
+      for (int i = 0; i < num_sessions; i++) {
+         sessions[i].sender.poll.Pump(0);
+      }
+      frames++;
+   }
+   double elapsed = Seconds(CLOCK_MONOTONIC) - start;
+   double cpu = Seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+   long echoed = 0;
+   for (int i = 0; i < num_sessions; i++) {
+      echoed += sessions[i].sender.received;
+   }
+   long session_frames = frames * num_sessions;
+   printf("%-16s %8d | %14.0f %12.2f %9.1f%%\n", name, num_sessions,
+          session_frames / elapsed, cpu * 1e6 / session_frames,
+          100.0 * echoed / (session_frames * PACKETS_PER_FRAME));
+
+   delete [] sessions;
+   return true;
+}
+
+int
+main(int argc, char **argv)
+{
+   int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+   int base_port = argc > 2 ? atoi(argv[2]) : DEFAULT_BASE_PORT;
+   static const int session_counts[] = { 1, 8, 64 };
+
+   printf("%d packets of %d bytes each way per session-frame, %d s per run.\n\n",
+          PACKETS_PER_FRAME, PACKET_SIZE, seconds);
+   printf("%-16s %8s | %14s %12s %10s\n", "engine", "sessions", "frames/s", "cpu us/frame", "echoed");
+
+   for (int i = 0; i < (int)ARRAY_SIZE(session_counts); i++) {
+      Run("recvmmsg", false, session_counts[i], seconds, base_port);
+      Run("io_uring", true, session_counts[i], seconds, base_port);
+   }
+   return 0;
+}
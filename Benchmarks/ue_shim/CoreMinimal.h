@@ -0,0 +1,54 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+/*
+ * Stands in for the parts of the engine headers that the plugin sources
+ * use, so the benchmarks can build them without Unreal.  The reflection
+ * macros expand to nothing and the UObject types are empty shells; nothing
+ * the benchmarks call touches them.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+
+#define UENUM(...)
+#define UMETA(...)
+#define USTRUCT(...)
+#define UCLASS(...)
+#define UPROPERTY(...)
+#define UFUNCTION(...)
+#define GENERATED_USTRUCT_BODY()
+#define GENERATED_BODY()
+#define GGPOUE_API
+#define __cdecl
+
+typedef int32_t int32;
+typedef uint16_t uint16;
+typedef uint8_t uint8;
+
+struct FName { FName(...) { } };
+struct FString { FString(...) { } };
+template<class T> struct TArray { int Num() const { return 0; } T operator[](int) const { return T(); } };
+template<class T> using TObjectPtr = T*;
+class UObject { };
+
+/*
+ * The engine supplies the bounds-checked string functions on every
+ * platform.
+ */
+#define sprintf_s(buf, size, ...)      snprintf(buf, size, __VA_ARGS__)
+template<size_t N> inline int strcpy_s(char (&dst)[N], const char *src) { snprintf(dst, N, "%s", src); return 0; }
+inline int strcpy_s(char *dst, size_t size, const char *src) { snprintf(dst, size, "%s", src); return 0; }
+inline int strncat_s(char *dst, size_t size, const char *src, size_t count)
+{
+   size_t len = strlen(dst);
+   snprintf(dst + len, size - len, "%.*s", (int)count, src);
+   return 0;
+}
@@ -0,0 +1,5 @@
+/*
+ * Generated by UnrealHeaderTool in a real build.  The benchmarks don't use
+ * reflection, so it is empty here.
+ */
+#pragma once
@@ -27,6 +27,14 @@ struct GGPOSession {
    virtual GGPOErrorCode SetDisconnectTimeout(int timeout) { return GGPO_ERRORCODE_UNSUPPORTED; }
    virtual GGPOErrorCode SetDisconnectNotifyStart(int timeout) { return GGPO_ERRORCODE_UNSUPPORTED; }
    virtual GGPOErrorCode TrySynchronizeLocal() { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode SetStateCompression(bool enable) { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode RegisterStateRegion(void *base, int size) { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode SetSpeculation(int num_branches, int num_threads) { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode SetRollbackCoalescing(bool enable) { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode SetInputPredictor(GGPOPlayerHandle player, EGGPOInputPredictor predictor) { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode SetInputRelevanceMask(void *mask, int size) { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode SetNetworkThread(bool enable) { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode SetNetworkConditions(GGPOPlayerHandle player, const GGPONetworkConditions *conditions) { return GGPO_ERRORCODE_UNSUPPORTED; }
 };
 
 typedef struct GGPOSession Quark, IQuarkBackend; /* XXX: nuke this */
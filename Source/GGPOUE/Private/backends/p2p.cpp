@@ -10,22 +10,26 @@
 static const int RECOMMENDATION_INTERVAL           = 240;
 static const int DEFAULT_DISCONNECT_TIMEOUT        = 5000;
 static const int DEFAULT_DISCONNECT_NOTIFY_START   = 750;
+static const int NETWORK_THREAD_MAX_WAIT           = 1;
 
 Peer2PeerBackend::Peer2PeerBackend(GGPOSessionCallbacks *cb,
                                    const char *gamename,
                                    uint16 localport,
                                    int num_players,
-                                   int input_size) :
+                                   int input_size,
+                                   int max_prediction_frames) :
     _num_players(num_players),
     _input_size(input_size),
     _sync(_local_connect_status),
     _disconnect_timeout(DEFAULT_DISCONNECT_TIMEOUT),
     _disconnect_notify_start(DEFAULT_DISCONNECT_NOTIFY_START),
     _num_spectators(0),
-    _next_spectator_frame(0)
+    _next_spectator_frame(0),
+    _network_thread_quit(false)
 {
    _callbacks = *cb;
    _synchronizing = true;
+   _coalesce_rollbacks = false;
    _next_recommended_sleep = 0;
 
    /*
@@ -35,13 +39,15 @@ Peer2PeerBackend::Peer2PeerBackend(GGPOSessionCallbacks *cb,
    config.num_players = num_players;
    config.input_size = input_size;
    config.callbacks = _callbacks;
-   config.num_prediction_frames = MAX_PREDICTION_FRAMES;
+   config.num_prediction_frames = max_prediction_frames;
+   config.elide_confirmed_saves = true;
    _sync.Init(config);
 
    /*
     * Initialize the UDP port
     */
-   _udp.Init(localport, &_poll, this);
+   _transport = Transport::Create();
+   _transport->Init(localport, &_poll, this);
 
    _endpoints = new UdpProtocol[_num_players];
    memset(_local_connect_status, 0, sizeof(_local_connect_status));
@@ -57,7 +63,9 @@ Peer2PeerBackend::Peer2PeerBackend(GGPOSessionCallbacks *cb,
   
 Peer2PeerBackend::~Peer2PeerBackend()
 {
+   StopNetworkThread();
    delete [] _endpoints;
+   delete _transport;
 }
 
 void
@@ -65,14 +73,17 @@ Peer2PeerBackend::AddRemotePlayer(char *ip,
                                   uint16 port,
                                   int queue)
 {
+   std::lock_guard<std::recursive_mutex> lock(_network_lock);
+
    /*
     * Start the state machine (xxx: no)
     */
    _synchronizing = true;
    
-   _endpoints[queue].Init(&_udp, _poll, queue, ip, port, _local_connect_status);
+   _endpoints[queue].Init(_transport, _poll, queue, ip, port, _input_size, _local_connect_status);
    _endpoints[queue].SetDisconnectTimeout(_disconnect_timeout);
    _endpoints[queue].SetDisconnectNotifyStart(_disconnect_notify_start);
+   _endpoints[queue].SetExactConnectStatus(_num_players > 2);
    _endpoints[queue].Synchronize();
 }
 
@@ -88,9 +99,10 @@ GGPOErrorCode Peer2PeerBackend::AddSpectator(char *ip,
    if (!_synchronizing) {
       return GGPO_ERRORCODE_INVALID_REQUEST;
    }
+   std::lock_guard<std::recursive_mutex> lock(_network_lock);
    int queue = _num_spectators++;
 
-   _spectators[queue].Init(&_udp, _poll, queue + 1000, ip, port, _local_connect_status);
+   _spectators[queue].Init(_transport, _poll, queue + 1000, ip, port, _input_size * _num_players, _local_connect_status);
    _spectators[queue].SetDisconnectTimeout(_disconnect_timeout);
    _spectators[queue].SetDisconnectNotifyStart(_disconnect_notify_start);
    _spectators[queue].Synchronize();
@@ -102,18 +114,30 @@ GGPOErrorCode
 Peer2PeerBackend::DoPoll(int timeout)
 {
    if (!_sync.InRollback()) {
-      _poll.Pump(0);
+      if (!_network_thread.joinable()) {
+         _poll.Pump(0);
+      }
 
       PollUdpProtocolEvents();
 
+      /*
+       * Only the protocol calls below take _network_lock.  Simulation and
+       * game callbacks run without it, so a long rollback never keeps the
+       * network thread from answering packets.
+       */
       if (!_synchronizing) {
-         _sync.CheckSimulation(timeout);
+         if (!_coalesce_rollbacks) {
+            _sync.CheckSimulation(timeout);
+         }
 
          // notify all of our endpoints of their local frame number for their
          // next connection quality report
          int current_frame = _sync.GetFrameCount();
-         for (int i = 0; i < _num_players; i++) {
-            _endpoints[i].SetLocalFrameNumber(current_frame);
+         {
+            std::lock_guard<std::recursive_mutex> lock(_network_lock);
+            for (int i = 0; i < _num_players; i++) {
+               _endpoints[i].SetLocalFrameNumber(current_frame);
+            }
          }
 
          int total_min_confirmed;
@@ -138,13 +162,19 @@ Peer2PeerBackend::DoPoll(int timeout)
                      // If the spectator's queue of pending outputs is full,
                      // the need to be disconnected because they can't
                      // be caught up
-                     if (_spectators[i].IsPendingFull())
+                     bool pending_full;
+                     {
+                        std::lock_guard<std::recursive_mutex> lock(_network_lock);
+                        pending_full = _spectators[i].IsPendingFull();
+                        if (!pending_full) {
+                           _spectators[i].SendInput(input);
+                        }
+                     }
+                     if (pending_full)
                      {
                         Log(EGGPOLogVerbosity::Info, "disconnecting spectator %d because their pending output buffer is full.\n", i);
                         DisconnectSpectatorQueue(i);
                      }
-                     else
-                        _spectators[i].SendInput(input);
                   }
                   _next_spectator_frame++;
                }
@@ -156,8 +186,11 @@ Peer2PeerBackend::DoPoll(int timeout)
          // send timesync notifications if now is the proper time
          if (current_frame > _next_recommended_sleep) {
             int interval = 0;
-            for (int i = 0; i < _num_players; i++) {
-               interval = MAX(interval, _endpoints[i].RecommendFrameDelay());
+            {
+               std::lock_guard<std::recursive_mutex> lock(_network_lock);
+               for (int i = 0; i < _num_players; i++) {
+                  interval = MAX(interval, _endpoints[i].RecommendFrameDelay());
+               }
             }
 
             if (interval > 0) {
@@ -168,11 +201,22 @@ Peer2PeerBackend::DoPoll(int timeout)
                _next_recommended_sleep = current_frame + RECOMMENDATION_INTERVAL;
             }
          }
-         // XXX: this is obviously a farce...
-         if (timeout) {
+         if (timeout && !_network_thread.joinable()) {
+#if defined(POLL_EPOLL)
+            /*
+             * Sleep until a packet arrives or the timeout runs out, once
+             * everything we've queued up is on its way.
+             */
+            _transport->Flush();
+            _poll.Pump(timeout);
+#else
+            // XXX: this is obviously a farce...
             Sleep(1);
+#endif
          }
       }
+      std::lock_guard<std::recursive_mutex> lock(_network_lock);
+      _transport->Flush();
    }
    return GGPO_OK;
 }
@@ -185,9 +229,12 @@ int Peer2PeerBackend::Poll2Players(int current_frame)
    int total_min_confirmed = MAX_INT;
    for (i = 0; i < _num_players; i++) {
       bool queue_connected = true;
-      if (_endpoints[i].IsRunning()) {
-         int ignore;
-         queue_connected = _endpoints[i].GetPeerConnectStatus(i, &ignore);
+      {
+         std::lock_guard<std::recursive_mutex> lock(_network_lock);
+         if (_endpoints[i].IsRunning()) {
+            int ignore;
+            queue_connected = _endpoints[i].GetPeerConnectStatus(i, &ignore);
+         }
       }
       if (!_local_connect_status[i].disconnected) {
          total_min_confirmed = MIN(_local_connect_status[i].last_frame, total_min_confirmed);
@@ -212,18 +259,21 @@ int Peer2PeerBackend::PollNPlayers(int current_frame)
       bool queue_connected = true;
       int queue_min_confirmed = MAX_INT;
       Log("considering queue %d.\n", queue);
-      for (i = 0; i < _num_players; i++) {
-         // we're going to do a lot of logic here in consideration of endpoint i.
-         // keep accumulating the minimum confirmed point for all n*n packets and
-         // throw away the rest.
-         if (_endpoints[i].IsRunning()) {
-            bool connected = _endpoints[i].GetPeerConnectStatus(queue, &last_received);
-
-            queue_connected = queue_connected && connected;
-            queue_min_confirmed = MIN(last_received, queue_min_confirmed);
-            Log("  endpoint %d: connected = %d, last_received = %d, queue_min_confirmed = %d.\n", i, connected, last_received, queue_min_confirmed);
-         } else {
-            Log("  endpoint %d: ignoring... not running.\n", i);
+      {
+         std::lock_guard<std::recursive_mutex> lock(_network_lock);
+         for (i = 0; i < _num_players; i++) {
+            // we're going to do a lot of logic here in consideration of endpoint i.
+            // keep accumulating the minimum confirmed point for all n*n packets and
+            // throw away the rest.
+            if (_endpoints[i].IsRunning()) {
+               bool connected = _endpoints[i].GetPeerConnectStatus(queue, &last_received);
+
+               queue_connected = queue_connected && connected;
+               queue_min_confirmed = MIN(last_received, queue_min_confirmed);
+               Log("  endpoint %d: connected = %d, last_received = %d, queue_min_confirmed = %d.\n", i, connected, last_received, queue_min_confirmed);
+            } else {
+               Log("  endpoint %d: ignoring... not running.\n", i);
+            }
          }
       }
       // merge in our local status only if we're still connected!
@@ -290,6 +340,7 @@ Peer2PeerBackend::AddLocalInput(GGPOPlayerHandle player,
       return result;
    }
 
+   CorrectPredictions();
    input.init(-1, (char *)values, size);
 
    // Feed the input for the current frame into the synchronzation layer.
@@ -298,6 +349,8 @@ Peer2PeerBackend::AddLocalInput(GGPOPlayerHandle player,
    }
 
    if (input.frame != GameInput::NullFrame) { // xxx: <- comment why this is the case
+      std::lock_guard<std::recursive_mutex> lock(_network_lock);
+
       // Update the local connect status state to indicate that we've got a
       // confirmed local frame for this player.  this must come first so it
       // gets incorporated into the next packet we send.
@@ -311,6 +364,7 @@ Peer2PeerBackend::AddLocalInput(GGPOPlayerHandle player,
             _endpoints[i].SendInput(input);
          }
       }
+      _transport->Flush();
    }
 
    return GGPO_OK;
@@ -328,6 +382,7 @@ Peer2PeerBackend::SyncInput(void *values,
    if (_synchronizing) {
       return GGPO_ERRORCODE_NOT_SYNCHRONIZED;
    }
+   CorrectPredictions();
    flags = _sync.SynchronizeInputs(values, size);
    if (disconnect_flags) {
       *disconnect_flags = flags;
@@ -335,6 +390,19 @@ Peer2PeerBackend::SyncInput(void *values,
    return GGPO_OK;
 }
 
+/*
+ * With rollback coalescing on, mispredictions pile up in the input queues
+ * while we poll and are all fixed here with a single rollback, before the
+ * game reads its inputs for the next frame.
+ */
+void
+Peer2PeerBackend::CorrectPredictions(void)
+{
+   if (_coalesce_rollbacks && !_sync.InRollback()) {
+      _sync.CheckSimulation(0);
+   }
+}
+
 GGPOErrorCode
 Peer2PeerBackend::IncrementFrame(void)
 {  
@@ -387,6 +455,7 @@ Peer2PeerBackend::OnUdpProtocolPeerEvent(UdpProtocol::Event &evt, int queue)
             _sync.AddRemoteInput(queue, evt.u.input.input);
             // Notify the other endpoints which frame we received from a peer
             Log("setting remote connect status for queue %d to %d\n", queue, evt.u.input.input.frame);
+            std::lock_guard<std::recursive_mutex> lock(_network_lock);
             _local_connect_status[queue].last_frame = evt.u.input.input.frame;
          }
          break;
@@ -496,13 +565,16 @@ Peer2PeerBackend::DisconnectPlayerQueue(int queue, int syncto)
    GGPOEvent info;
    int framecount = _sync.GetFrameCount();
 
-   _endpoints[queue].Disconnect();
+   {
+      std::lock_guard<std::recursive_mutex> lock(_network_lock);
+      _endpoints[queue].Disconnect();
 
-   Log(EGGPOLogVerbosity::Info, "Changing queue %d local connect status for last frame from %d to %d on disconnect request (current: %d).\n",
-       queue, _local_connect_status[queue].last_frame, syncto, framecount);
+      Log(EGGPOLogVerbosity::Info, "Changing queue %d local connect status for last frame from %d to %d on disconnect request (current: %d).\n",
+          queue, _local_connect_status[queue].last_frame, syncto, framecount);
 
-   _local_connect_status[queue].disconnected = 1;
-   _local_connect_status[queue].last_frame = syncto;
+      _local_connect_status[queue].disconnected = 1;
+      _local_connect_status[queue].last_frame = syncto;
+   }
 
    if (syncto < framecount) {
       Log(EGGPOLogVerbosity::Verbose, "adjusting simulation to account for the fact that %d disconnected @ %d.\n", queue, syncto);
@@ -523,7 +595,10 @@ Peer2PeerBackend::DisconnectSpectatorQueue(int queue)
     GGPOEvent info;
     GGPOPlayerHandle handle = QueueToSpectatorHandle(queue);
 
-    _spectators[queue].Disconnect();
+    {
+        std::lock_guard<std::recursive_mutex> lock(_network_lock);
+        _spectators[queue].Disconnect();
+    }
 
     info.code = GGPO_EVENTCODE_DISCONNECTED_FROM_PEER;
     info.u.disconnected.player = handle;
@@ -537,6 +612,8 @@ Peer2PeerBackend::GetNetworkStats(FGGPONetworkStats *stats, GGPOPlayerHandle pla
    int queue;
    GGPOErrorCode result;
 
+   std::lock_guard<std::recursive_mutex> lock(_network_lock);
+
    result = PlayerHandleToQueue(player, &queue);
    if (!GGPO_SUCCEEDED(result)) {
       return result;
@@ -544,6 +621,12 @@ Peer2PeerBackend::GetNetworkStats(FGGPONetworkStats *stats, GGPOPlayerHandle pla
 
    memset(stats, 0, sizeof *stats);
    _endpoints[queue].GetNetworkStats(stats);
+   _sync.GetRollbackStats(&stats->rollback);
+
+   /*
+    * Frames we've run on predicted input from this player.
+    */
+   stats->network.recv_queue_len = MAX(0, _sync.GetFrameCount() - 1 - _local_connect_status[queue].last_frame);
 
    return GGPO_OK;
 }
@@ -565,6 +648,8 @@ Peer2PeerBackend::SetFrameDelay(GGPOPlayerHandle player, int delay)
 GGPOErrorCode
 Peer2PeerBackend::SetDisconnectTimeout(int timeout)
 {
+   std::lock_guard<std::recursive_mutex> lock(_network_lock);
+
    _disconnect_timeout = timeout;
    for (int i = 0; i < _num_players; i++) {
       if (_endpoints[i].IsInitialized()) {
@@ -577,6 +662,8 @@ Peer2PeerBackend::SetDisconnectTimeout(int timeout)
 GGPOErrorCode
 Peer2PeerBackend::SetDisconnectNotifyStart(int timeout)
 {
+   std::lock_guard<std::recursive_mutex> lock(_network_lock);
+
    _disconnect_notify_start = timeout;
    for (int i = 0; i < _num_players; i++) {
       if (_endpoints[i].IsInitialized()) {
@@ -604,6 +691,143 @@ Peer2PeerBackend::TrySynchronizeLocal()
     return GGPO_OK;
 }
 
+GGPOErrorCode
+Peer2PeerBackend::SetStateCompression(bool enable)
+{
+   if (!_sync.SetDeltaCompression(enable)) {
+      return GGPO_ERRORCODE_INVALID_REQUEST;
+   }
+   return GGPO_OK;
+}
+
+GGPOErrorCode
+Peer2PeerBackend::RegisterStateRegion(void *base, int size)
+{
+   if (!_sync.RegisterStateRegion(base, size)) {
+      return GGPO_ERRORCODE_INVALID_REQUEST;
+   }
+   return GGPO_OK;
+}
+
+GGPOErrorCode
+Peer2PeerBackend::SetSpeculation(int num_branches, int num_threads)
+{
+   if (!_sync.SetSpeculation(num_branches, num_threads)) {
+      return GGPO_ERRORCODE_INVALID_REQUEST;
+   }
+   return GGPO_OK;
+}
+
+GGPOErrorCode
+Peer2PeerBackend::SetRollbackCoalescing(bool enable)
+{
+   _coalesce_rollbacks = enable;
+   return GGPO_OK;
+}
+
+GGPOErrorCode
+Peer2PeerBackend::SetInputPredictor(GGPOPlayerHandle player, EGGPOInputPredictor predictor)
+{
+   int queue;
+   GGPOErrorCode result;
+
+   if (player == GGPO_INVALID_HANDLE) {
+      for (queue = 0; queue < _num_players; queue++) {
+         if (!_sync.SetInputPredictor(queue, predictor)) {
+            return GGPO_ERRORCODE_INVALID_REQUEST;
+         }
+      }
+      return GGPO_OK;
+   }
+
+   result = PlayerHandleToQueue(player, &queue);
+   if (!GGPO_SUCCEEDED(result)) {
+      return result;
+   }
+   if (!_sync.SetInputPredictor(queue, predictor)) {
+      return GGPO_ERRORCODE_INVALID_REQUEST;
+   }
+   return GGPO_OK;
+}
+
+GGPOErrorCode
+Peer2PeerBackend::SetInputRelevanceMask(void *mask, int size)
+{
+   if (!_sync.SetRelevanceMask(mask, size)) {
+      return GGPO_ERRORCODE_INVALID_REQUEST;
+   }
+   return GGPO_OK;
+}
+
+GGPOErrorCode
+Peer2PeerBackend::SetNetworkThread(bool enable)
+{
+   if (enable == _network_thread.joinable()) {
+      return GGPO_OK;
+   }
+   if (enable) {
+      _network_thread_quit = false;
+      _network_thread = std::thread(&Peer2PeerBackend::NetworkThreadMain, this);
+   } else {
+      StopNetworkThread();
+   }
+   return GGPO_OK;
+}
+
+GGPOErrorCode
+Peer2PeerBackend::SetNetworkConditions(GGPOPlayerHandle player, const GGPONetworkConditions *conditions)
+{
+   std::lock_guard<std::recursive_mutex> lock(_network_lock);
+
+   if (player == GGPO_INVALID_HANDLE) {
+      _transport->SetNetworkConditions(NULL, conditions);
+      return GGPO_OK;
+   }
+
+   UdpProtocol *endpoint;
+   int queue;
+   if (GGPO_SUCCEEDED(PlayerHandleToQueue(player, &queue))) {
+      endpoint = &_endpoints[queue];
+   } else {
+      queue = (int)player - 1000;
+      if (queue < 0 || queue >= _num_spectators) {
+         return GGPO_ERRORCODE_INVALID_PLAYER_HANDLE;
+      }
+      endpoint = &_spectators[queue];
+   }
+   if (!endpoint->IsInitialized()) {
+      return GGPO_ERRORCODE_INVALID_PLAYER_HANDLE;
+   }
+   _transport->SetNetworkConditions(endpoint->GetPeerAddr(), conditions);
+   return GGPO_OK;
+}
+
+/*
+ * Reads and answers packets as soon as they arrive, rather than waiting for
+ * the game to get around to calling ggpo_idle.  The lock is only held while
+ * pumping, never while waiting.
+ */
+void
+Peer2PeerBackend::NetworkThreadMain(void)
+{
+   while (!_network_thread_quit) {
+      _poll.Wait(NETWORK_THREAD_MAX_WAIT);
+
+      std::lock_guard<std::recursive_mutex> lock(_network_lock);
+      _poll.Pump(0);
+      _transport->Flush();
+   }
+}
+
+void
+Peer2PeerBackend::StopNetworkThread(void)
+{
+   if (_network_thread.joinable()) {
+      _network_thread_quit = true;
+      _network_thread.join();
+   }
+}
+
 GGPOErrorCode
 Peer2PeerBackend::PlayerHandleToQueue(GGPOPlayerHandle player, int *queue)
 {
@@ -641,15 +865,18 @@ Peer2PeerBackend::CheckInitialSync()
    if (_synchronizing) {
       // Check to see if everyone is now synchronized.  If so,
       // go ahead and tell the client that we're ok to accept input.
-      for (i = 0; i < _num_players; i++) {
-         // xxx: IsInitialized() must go... we're actually using it as a proxy for "represents the local player"
-         if (_endpoints[i].IsInitialized() && !_endpoints[i].IsSynchronized() && !_local_connect_status[i].disconnected) {
-            return;
+      {
+         std::lock_guard<std::recursive_mutex> lock(_network_lock);
+         for (i = 0; i < _num_players; i++) {
+            // xxx: IsInitialized() must go... we're actually using it as a proxy for "represents the local player"
+            if (_endpoints[i].IsInitialized() && !_endpoints[i].IsSynchronized() && !_local_connect_status[i].disconnected) {
+               return;
+            }
          }
-      }
-      for (i = 0; i < _num_spectators; i++) {
-         if (_spectators[i].IsInitialized() && !_spectators[i].IsSynchronized()) {
-            return;
+         for (i = 0; i < _num_spectators; i++) {
+            if (_spectators[i].IsInitialized() && !_spectators[i].IsSynchronized()) {
+               return;
+            }
          }
       }
 
@@ -13,10 +13,13 @@
 #include "../sync.h"
 #include "backend.h"
 #include "../network/udp_proto.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
 
-class Peer2PeerBackend : public IQuarkBackend, IPollSink, Udp::Callbacks {
+class Peer2PeerBackend : public IQuarkBackend, IPollSink, Transport::Callbacks {
 public:
-   Peer2PeerBackend(GGPOSessionCallbacks *cb, const char *gamename, uint16 localport, int num_players, int input_size);
+   Peer2PeerBackend(GGPOSessionCallbacks *cb, const char *gamename, uint16 localport, int num_players, int input_size, int max_prediction_frames);
    virtual ~Peer2PeerBackend();
 
 
@@ -32,6 +35,14 @@ public:
    virtual GGPOErrorCode SetDisconnectTimeout(int timeout);
    virtual GGPOErrorCode SetDisconnectNotifyStart(int timeout);
    virtual GGPOErrorCode TrySynchronizeLocal();
+   virtual GGPOErrorCode SetStateCompression(bool enable);
+   virtual GGPOErrorCode RegisterStateRegion(void *base, int size);
+   virtual GGPOErrorCode SetSpeculation(int num_branches, int num_threads);
+   virtual GGPOErrorCode SetRollbackCoalescing(bool enable);
+   virtual GGPOErrorCode SetInputPredictor(GGPOPlayerHandle player, EGGPOInputPredictor predictor);
+   virtual GGPOErrorCode SetInputRelevanceMask(void *mask, int size);
+   virtual GGPOErrorCode SetNetworkThread(bool enable);
+   virtual GGPOErrorCode SetNetworkConditions(GGPOPlayerHandle player, const GGPONetworkConditions *conditions);
 
 public:
    virtual void OnMsg(sockaddr_in &from, UdpMsg *msg, int len);
@@ -44,6 +55,7 @@ protected:
    void DisconnectSpectatorQueue(int queue);
    void PollSyncEvents(void);
    void PollUdpProtocolEvents(void);
+   void CorrectPredictions(void);
    void CheckInitialSync(void);
    int Poll2Players(int current_frame);
    int PollNPlayers(int current_frame);
@@ -53,18 +65,21 @@ protected:
    virtual void OnUdpProtocolEvent(UdpProtocol::Event &e, GGPOPlayerHandle handle);
    virtual void OnUdpProtocolPeerEvent(UdpProtocol::Event &e, int queue);
    virtual void OnUdpProtocolSpectatorEvent(UdpProtocol::Event &e, int queue);
+   void NetworkThreadMain(void);
+   void StopNetworkThread(void);
 
 protected:
    GGPOSessionCallbacks  _callbacks;
    Poll                  _poll;
    Sync                  _sync;
-   Udp                   _udp;
+   Transport             *_transport;
    UdpProtocol           *_endpoints;
    UdpProtocol           _spectators[GGPO_MAX_SPECTATORS];
    int                   _num_spectators;
    int                   _input_size;
 
    bool                  _synchronizing;
+   bool                  _coalesce_rollbacks;
    int                   _num_players;
    int                   _next_recommended_sleep;
 
@@ -73,6 +88,19 @@ protected:
    int                   _disconnect_notify_start;
 
    UdpMsg::connect_status _local_connect_status[UDP_MSG_MAX_PLAYERS];
+
+   /*
+    * When the network thread is running it pumps _poll, and with it _transport
+    * and every protocol, while holding _network_lock.  The game thread must
+    * hold the lock too before touching any of them or writing
+    * _local_connect_status, which the protocols read when they send.  It
+    * never holds it across simulation or game callbacks, which can take a
+    * whole frame.  Protocol events don't need it; they come back through
+    * lock-free rings.
+    */
+   std::thread           _network_thread;
+   std::atomic<bool>     _network_thread_quit;
+   std::recursive_mutex  _network_lock;
 };
 
 #endif
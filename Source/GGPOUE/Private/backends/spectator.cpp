@@ -28,12 +28,13 @@ SpectatorBackend::SpectatorBackend(GGPOSessionCallbacks *cb,
    /*
     * Initialize the UDP port
     */
-   _udp.Init(localport, &_poll, this);
+   _transport = Transport::Create();
+   _transport->Init(localport, &_poll, this);
 
    /*
     * Init the host endpoint
     */
-   _host.Init(&_udp, _poll, 0, hostip, hostport, NULL);
+   _host.Init(_transport, _poll, 0, hostip, hostport, 0, NULL);
    _host.Synchronize();
 
    /*
@@ -44,6 +45,7 @@ SpectatorBackend::SpectatorBackend(GGPOSessionCallbacks *cb,
   
 SpectatorBackend::~SpectatorBackend()
 {
+   delete _transport;
 }
 
 GGPOErrorCode
@@ -52,6 +54,7 @@ SpectatorBackend::DoPoll(int timeout)
    _poll.Pump(0);
 
    PollUdpProtocolEvents();
+   _transport->Flush();
    return GGPO_OK;
 }
 
@@ -96,6 +99,16 @@ SpectatorBackend::IncrementFrame(void)
    return GGPO_OK;
 }
 
+/*
+ * The host is the only one we send to, whichever player is asked for.
+ */
+GGPOErrorCode
+SpectatorBackend::SetNetworkConditions(GGPOPlayerHandle player, const GGPONetworkConditions *conditions)
+{
+    _transport->SetNetworkConditions(NULL, conditions);
+    return GGPO_OK;
+}
+
 GGPOErrorCode
 SpectatorBackend::GetNetworkStats(FGGPONetworkStats* stats, GGPOPlayerHandle player)
 {
@@ -106,6 +119,15 @@ SpectatorBackend::GetNetworkStats(FGGPONetworkStats* stats, GGPOPlayerHandle pla
     memset(stats, 0, sizeof * stats);
     _host.GetNetworkStats(stats);
 
+    /*
+     * Frames the host has sent that we haven't played yet.
+     */
+    for (int i = 0; i < SPECTATOR_FRAME_BUFFER_SIZE; i++) {
+        if (_inputs[i].frame >= _next_input_to_send) {
+            stats->network.recv_queue_len++;
+        }
+    }
+
     return GGPO_OK;
 }
 
@@ -17,7 +17,7 @@
 // This value is important for how far behind the spectator can be
 #define SPECTATOR_FRAME_BUFFER_SIZE    BUFFER_SIZE
 
-class SpectatorBackend : public IQuarkBackend, IPollSink, Udp::Callbacks {
+class SpectatorBackend : public IQuarkBackend, IPollSink, Transport::Callbacks {
 public:
    SpectatorBackend(GGPOSessionCallbacks *cb, const char *gamename, uint16 localport, int num_players, int input_size, char *hostip, u_short hostport);
    virtual ~SpectatorBackend();
@@ -35,6 +35,7 @@ public:
    virtual GGPOErrorCode SetDisconnectTimeout(int timeout) { return GGPO_ERRORCODE_UNSUPPORTED; }
    virtual GGPOErrorCode SetDisconnectNotifyStart(int timeout) { return GGPO_ERRORCODE_UNSUPPORTED; }
    virtual GGPOErrorCode TrySynchronizeLocal() { return GGPO_ERRORCODE_UNSUPPORTED; }
+   virtual GGPOErrorCode SetNetworkConditions(GGPOPlayerHandle player, const GGPONetworkConditions *conditions);
 
 public:
    virtual void OnMsg(sockaddr_in &from, UdpMsg *msg, int len);
@@ -48,7 +49,7 @@ protected:
 protected:
    GGPOSessionCallbacks  _callbacks;
    Poll                  _poll;
-   Udp                   _udp;
+   Transport             *_transport;
    UdpProtocol           _host;
    bool                  _synchronizing;
    int                   _input_size;
@@ -86,3 +86,18 @@ GameInput::equal(GameInput &other, bool bitsonly)
           memcmp(bits, other.bits, size) == 0;
 }
 
+/*
+ * Compares only the bits set in mask, ignoring the frame number.
+ */
+bool
+GameInput::matches(GameInput &other, const char *mask) const
+{
+   ASSERT(size && size == other.size);
+   for (int i = 0; i < size; i++) {
+      if ((bits[i] ^ other.bits[i]) & mask[i]) {
+         return false;
+      }
+   }
+   return true;
+}
+
@@ -35,6 +35,7 @@ struct GameInput {
    void desc(char *buf, size_t buf_size, bool show_frame = true) const;
    void log(char *prefix, bool show_frame = true) const;
    bool equal(GameInput &input, bool bitsonly = false);
+   bool matches(GameInput &input, const char *mask) const;
 };
 
 #endif
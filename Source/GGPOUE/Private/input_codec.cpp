@@ -0,0 +1,157 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "input_codec.h"
+#include "varint.h"
+#include <string.h>
+#include <limits.h>
+
+#define INPUT_CODEC_MAX_BYTES    (GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS)
+
+void
+InputCodec_BeginEncode(InputEncoder *enc, uint8 *out, int capacity)
+{
+   enc->out = out;
+   enc->capacity = capacity;
+   enc->offset = 0;
+   enc->run = 0;
+}
+
+/*
+ * Appends cur to the stream.  Returns false, leaving the stream as it was,
+ * if the frame doesn't fit.
+ */
+bool
+InputCodec_EncodeFrame(InputEncoder *enc, const GameInput &prev, const GameInput &cur)
+{
+   uint8 changed[INPUT_CODEC_MAX_BYTES];
+   uint8 xor_bytes[INPUT_CODEC_MAX_BYTES];
+   int count = 0;
+
+   ASSERT(cur.size <= INPUT_CODEC_MAX_BYTES);
+
+   /*
+    * Find the changed bytes a word at a time.  Input is rarely more than a
+    * word or two, and most words don't change from frame to frame.
+    */
+   for (int i = 0; i < cur.size; i += 8) {
+      int n = MIN(8, cur.size - i);
+      uint64 a = 0, b = 0;
+      memcpy(&a, cur.bits + i, n);
+      memcpy(&b, prev.bits + i, n);
+      uint64 x = a ^ b;
+      for (int j = i; x; j++, x >>= 8) {
+         if (x & 0xff) {
+            changed[count] = (uint8)j;
+            xor_bytes[count++] = (uint8)(cur.bits[j] ^ prev.bits[j]);
+         }
+      }
+   }
+
+   if (count == 0) {
+      /*
+       * Only take the frame if EndEncode will have room for the longer run.
+       */
+      if (enc->offset + VarintSize(enc->run + 1) > enc->capacity) {
+         return false;
+      }
+      enc->run++;
+      return true;
+   }
+
+   int offset = WriteVarint(enc->out, enc->offset, enc->capacity, enc->run);
+   int pos = 0;
+   for (int i = 0; i < count && offset >= 0; i++) {
+      uint32 more = i + 1 < count;
+      offset = WriteVarint(enc->out, offset, enc->capacity, ((changed[i] - pos) << 1) | more);
+      if (offset >= 0 && offset < enc->capacity) {
+         enc->out[offset++] = xor_bytes[i];
+      } else {
+         offset = -1;
+      }
+      pos = changed[i] + 1;
+   }
+   if (offset < 0) {
+      return false;
+   }
+   enc->offset = offset;
+   enc->run = 0;
+   return true;
+}
+
+/*
+ * Flushes any trailing run of unchanged frames and returns the length of
+ * the stream.  EncodeFrame made sure the run fits.
+ */
+int
+InputCodec_EndEncode(InputEncoder *enc)
+{
+   if (enc->run) {
+      enc->offset = WriteVarint(enc->out, enc->offset, enc->capacity, enc->run);
+      ASSERT(enc->offset >= 0);
+      enc->run = 0;
+   }
+   return enc->offset;
+}
+
+void
+InputCodec_BeginDecode(InputDecoder *dec, const uint8 *in, int len)
+{
+   dec->in = in;
+   dec->len = len;
+   dec->offset = 0;
+   dec->run = 0;
+   dec->failed = false;
+}
+
+/*
+ * Reads the next frame's delta and, if apply is set, XORs it into input.
+ * Returns false at the end of the stream, or with dec->failed set if the
+ * stream is malformed.  The stream comes off the wire, so nothing in it is
+ * trusted.
+ */
+bool
+InputCodec_DecodeFrame(InputDecoder *dec, GameInput *input, bool apply)
+{
+   uint32 value;
+
+   if (dec->run == 0) {
+      if (dec->offset >= dec->len) {
+         return false;
+      }
+      /*
+       * The extra 1 accounts for the changed frame that follows the run.
+       */
+      if (!ReadVarint(dec->in, dec->len, &dec->offset, &value) || value >= INT_MAX) {
+         dec->failed = true;
+         return false;
+      }
+      dec->run = (int)value + 1;
+   }
+   if (--dec->run > 0) {
+      return true;
+   }
+   if (dec->offset >= dec->len) {
+      return false;
+   }
+
+   int pos = 0;
+   do {
+      if (!ReadVarint(dec->in, dec->len, &dec->offset, &value) ||
+          (value >> 1) >= (uint32)(input->size - pos) || dec->offset >= dec->len) {
+         dec->failed = true;
+         return false;
+      }
+      pos += (int)(value >> 1);
+      uint8 x = dec->in[dec->offset++];
+      if (apply) {
+         input->bits[pos] ^= x;
+      }
+      pos++;
+   } while (value & 1);
+   return true;
+}
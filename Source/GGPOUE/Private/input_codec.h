@@ -0,0 +1,50 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _INPUT_CODEC_H
+#define _INPUT_CODEC_H
+
+#include "types.h"
+#include "game_input.h"
+
+/*
+ * Byte-oriented delta coding for a run of consecutive input frames.  Each
+ * frame is XORed against the one before it, so a whole run of unchanged
+ * frames costs one varint, and a changed frame lists only the bytes that
+ * differ:
+ *
+ *    stream := { run [frame] }
+ *    run    := varint                        unchanged frames before the next change
+ *    frame  := { varint (gap << 1) | more, uint8 xor }
+ *
+ * Gaps are relative to the byte after the previous changed one, and the low
+ * bit says whether another changed byte follows in the same frame.  The
+ * stream may end after a run or after a frame.
+ */
+struct InputEncoder {
+   uint8       *out;
+   int         capacity;
+   int         offset;
+   int         run;
+};
+
+struct InputDecoder {
+   const uint8 *in;
+   int         len;
+   int         offset;
+   int         run;
+   bool        failed;
+};
+
+void InputCodec_BeginEncode(InputEncoder *enc, uint8 *out, int capacity);
+bool InputCodec_EncodeFrame(InputEncoder *enc, const GameInput &prev, const GameInput &cur);
+int InputCodec_EndEncode(InputEncoder *enc);
+
+void InputCodec_BeginDecode(InputDecoder *dec, const uint8 *in, int len);
+bool InputCodec_DecodeFrame(InputDecoder *dec, GameInput *input, bool apply);
+
+#endif // _INPUT_CODEC_H
@@ -0,0 +1,188 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "input_predictor.h"
+#include "input_queue.h"
+#include "types.h"
+
+#define PATTERN_LENGTH           4
+
+/*
+ * Copies the confirmed inputs leading up to last_frame into history, newest
+ * first, and returns how many there were.
+ */
+static int
+ReadHistory(InputQueue &queue, int last_frame, GameInput *history)
+{
+   int count = 0;
+   for (int frame = last_frame; frame >= 0 && count < PREDICTOR_HISTORY; frame--) {
+      if (!queue.GetConfirmedInput(frame, history + count)) {
+         break;
+      }
+      count++;
+   }
+   return count;
+}
+
+InputPredictor *
+InputPredictor::Create(EGGPOInputPredictor type)
+{
+   switch (type) {
+   case EGGPOInputPredictor::REPEAT_LAST:
+      return new RepeatLastPredictor();
+   case EGGPOInputPredictor::HOLD:
+      return new HoldPredictor();
+   case EGGPOInputPredictor::PATTERN:
+      return new PatternPredictor();
+   }
+   return NULL;
+}
+
+void
+RepeatLastPredictor::Predict(InputQueue &queue, int last_frame, int frame, GameInput *prediction)
+{
+   if (last_frame != GameInput::NullFrame) {
+      queue.GetConfirmedInput(last_frame, prediction);
+   }
+}
+
+HoldPredictor::HoldPredictor() :
+   _last_frame(GameInput::NullFrame)
+{
+   _last.erase();
+   memset(_held, 0, sizeof _held);
+   memset(_expected, 0, sizeof _expected);
+}
+
+void
+HoldPredictor::Update(InputQueue &queue, int last_frame)
+{
+   GameInput history[PREDICTOR_HISTORY];
+
+   if (last_frame == _last_frame) {
+      return;
+   }
+   _last_frame = last_frame;
+
+   int count = ReadHistory(queue, last_frame, history);
+   ASSERT(count > 0);
+   _last = history[0];
+
+   /*
+    * For every pressed bit, measure the current press and the last two
+    * complete presses before it.  Only trust a release time if those two
+    * agree; anything else is treated as being held indefinitely.
+    */
+   for (int bit = 0; bit < _last.size * 8; bit++) {
+      _held[bit] = 0;
+      _expected[bit] = 0;
+      if (!_last.value(bit)) {
+         continue;
+      }
+
+      int i = 0;
+      while (i < count && history[i].value(bit)) {
+         i++;
+      }
+      _held[bit] = i;
+
+      int presses[2], npresses = 0;
+      while (npresses < 2) {
+         while (i < count && !history[i].value(bit)) {
+            i++;
+         }
+         int start = i;
+         while (i < count && history[i].value(bit)) {
+            i++;
+         }
+         /*
+          * A press that runs off the end of the history might have started
+          * earlier, unless it started on frame 0.
+          */
+         if (i == start || (i == count && last_frame - i + 1 != 0)) {
+            break;
+         }
+         presses[npresses++] = i - start;
+      }
+      if (npresses == 2 && presses[0] == presses[1] && presses[0] > _held[bit]) {
+         _expected[bit] = presses[0];
+      }
+   }
+}
+
+void
+HoldPredictor::Predict(InputQueue &queue, int last_frame, int frame, GameInput *prediction)
+{
+   if (last_frame == GameInput::NullFrame) {
+      return;
+   }
+   Update(queue, last_frame);
+
+   memcpy(prediction->bits, _last.bits, sizeof(prediction->bits));
+   int ahead = frame - last_frame;
+   for (int bit = 0; bit < _last.size * 8; bit++) {
+      if (_expected[bit] && _held[bit] + ahead > _expected[bit]) {
+         prediction->clear(bit);
+      }
+   }
+}
+
+PatternPredictor::PatternPredictor() :
+   _last_frame(GameInput::NullFrame),
+   _match(0)
+{
+}
+
+void
+PatternPredictor::Update(InputQueue &queue, int last_frame)
+{
+   GameInput history[PREDICTOR_HISTORY];
+
+   if (last_frame == _last_frame) {
+      return;
+   }
+   _last_frame = last_frame;
+   _match = 0;
+
+   /*
+    * Find the most recent earlier point in the history where the same
+    * PATTERN_LENGTH inputs were entered.  _match is how far back it was.
+    */
+   int count = ReadHistory(queue, last_frame, history);
+   int size = history[0].size;
+   for (int d = 1; d + PATTERN_LENGTH <= count; d++) {
+      int i = 0;
+      while (i < PATTERN_LENGTH && !memcmp(history[i].bits, history[d + i].bits, size)) {
+         i++;
+      }
+      if (i == PATTERN_LENGTH) {
+         _match = d;
+         break;
+      }
+   }
+}
+
+void
+PatternPredictor::Predict(InputQueue &queue, int last_frame, int frame, GameInput *prediction)
+{
+   if (last_frame == GameInput::NullFrame) {
+      return;
+   }
+   Update(queue, last_frame);
+
+   /*
+    * Replay whatever followed the match.  The inputs since then are the
+    * same sequence again, so predicting further ahead than that just
+    * repeats it.
+    */
+   int ahead = frame - last_frame;
+   if (_match) {
+      queue.GetConfirmedInput(last_frame - _match + 1 + ((ahead - 1) % _match), prediction);
+   } else {
+      queue.GetConfirmedInput(last_frame, prediction);
+   }
+}
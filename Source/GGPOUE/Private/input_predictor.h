@@ -0,0 +1,96 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _INPUT_PREDICTOR_H
+#define _INPUT_PREDICTOR_H
+
+#include "game_input.h"
+#include "include/ggponet.h"
+
+/*
+ * How far back the built-in predictors look through a queue's confirmed
+ * inputs.  Must stay well below INPUT_QUEUE_LENGTH.
+ */
+#define PREDICTOR_HISTORY        64
+
+class InputQueue;
+
+/*
+ * InputPredictor --
+ *
+ * Guesses a player's input for frames we haven't received yet.  Predict is
+ * only ever given confirmed inputs to work from, so the same history always
+ * produces the same guess.  InputQueue remembers what it handed out for each
+ * frame and checks the real inputs against that.
+ */
+class InputPredictor {
+public:
+   virtual ~InputPredictor() { }
+
+   /*
+    * Fill in prediction->bits for frame.  last_frame is the newest frame
+    * queue has a confirmed input for, or GameInput::NullFrame if it has
+    * none; older ones can be read with queue.GetConfirmedInput.  prediction
+    * arrives erased, with its size already set.
+    */
+   virtual void Predict(InputQueue &queue, int last_frame, int frame, GameInput *prediction) = 0;
+
+   static InputPredictor *Create(EGGPOInputPredictor type);
+};
+
+/*
+ * The player keeps doing whatever they did last.
+ */
+class RepeatLastPredictor : public InputPredictor {
+public:
+   virtual void Predict(InputQueue &queue, int last_frame, int frame, GameInput *prediction);
+};
+
+/*
+ * Like RepeatLastPredictor, except that a button the player has been
+ * releasing after the same number of frames every time is predicted to be
+ * released after that many frames again.
+ */
+class HoldPredictor : public InputPredictor {
+public:
+   HoldPredictor();
+   virtual void Predict(InputQueue &queue, int last_frame, int frame, GameInput *prediction);
+
+protected:
+   void Update(InputQueue &queue, int last_frame);
+
+protected:
+   /*
+    * For the newest confirmed input, how long each pressed bit has been
+    * held and how long it is expected to be held in total (0 if unknown).
+    */
+   int         _last_frame;
+   GameInput   _last;
+   int         _held[GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS * 8];
+   int         _expected[GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS * 8];
+};
+
+/*
+ * Looks for the last time the player's most recent PATTERN_LENGTH inputs
+ * occurred in the history and predicts they'll carry on the same way, which
+ * catches motion inputs and other fixed sequences.  Falls back to repeating
+ * the last input when there is no match.
+ */
+class PatternPredictor : public InputPredictor {
+public:
+   PatternPredictor();
+   virtual void Predict(InputQueue &queue, int last_frame, int frame, GameInput *prediction);
+
+protected:
+   void Update(InputQueue &queue, int last_frame);
+
+protected:
+   int         _last_frame;
+   int         _match;
+};
+
+#endif
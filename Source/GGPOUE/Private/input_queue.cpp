@@ -10,13 +10,15 @@
 
 #define PREVIOUS_FRAME(offset)   (((offset) == 0) ? (INPUT_QUEUE_LENGTH - 1) : ((offset) - 1))
 
-InputQueue::InputQueue(int input_size)
+InputQueue::InputQueue(int input_size) :
+   _predictor(NULL)
 {
    Init(-1, input_size);
 }
 
 InputQueue::~InputQueue()
 {
+   delete _predictor;
 }
 
 void
@@ -35,13 +37,37 @@ InputQueue::Init(int id, int input_size)
 
    _prediction.init(GameInput::NullFrame, NULL, input_size);
 
+   delete _predictor;
+   _predictor = new RepeatLastPredictor();
+
    /*
     * This is safe because we know the GameInput is a proper structure (as in,
     * no virtual methods, no contained classes, etc.).
     */
    memset(_inputs, 0, sizeof _inputs);
+   memset(_predictions, 0, sizeof _predictions);
+   memset(_relevance_mask, 0xff, sizeof _relevance_mask);
    for (int i = 0; i < ARRAY_SIZE(_inputs); i++) {
       _inputs[i].size = input_size;
+      _predictions[i].frame = GameInput::NullFrame;
+   }
+}
+
+void
+InputQueue::SetPredictor(InputPredictor *predictor)
+{
+   ASSERT(predictor);
+   delete _predictor;
+   _predictor = predictor;
+}
+
+void
+InputQueue::SetRelevanceMask(const char *mask)
+{
+   if (mask) {
+      memcpy(_relevance_mask, mask, _prediction.size);
+   } else {
+      memset(_relevance_mask, 0xff, sizeof _relevance_mask);
    }
 }
 
@@ -99,6 +125,16 @@ InputQueue::ResetPrediction(int frame)
    _prediction.frame = GameInput::NullFrame;
    _first_incorrect_frame = GameInput::NullFrame;
    _last_frame_requested = GameInput::NullFrame;
+
+   /*
+    * Guesses made on the timeline we're throwing away were based on less
+    * history than we have now.  Make new ones when we get there again.
+    */
+   for (int i = 0; i < ARRAY_SIZE(_predictions); i++) {
+      if (_predictions[i].frame >= frame) {
+         _predictions[i].frame = GameInput::NullFrame;
+      }
+   }
 }
 
 bool
@@ -150,32 +186,38 @@ InputQueue::GetInput(int requested_frame, GameInput *input)
 
       /*
        * The requested frame isn't in the queue.  Bummer.  This means we need
-       * to return a prediction frame.  Predict that the user will do the
-       * same thing they did last time.
+       * to return a prediction frame.  Everything from the frame after the
+       * last one we have will be guessed by the predictor.
        */
       if (requested_frame == 0) {
          Log("basing new prediction frame from nothing, you're client wants frame 0.\n");
-         _prediction.erase();
+         _prediction.frame = 0;
       } else if (_last_added_frame == GameInput::NullFrame) {
          Log("basing new prediction frame from nothing, since we have no frames yet.\n");
-         _prediction.erase();
+         _prediction.frame = 0;
       } else {
          Log("basing new prediction frame from previously added frame (queue entry:%d, frame:%d).\n",
               PREVIOUS_FRAME(_head), _inputs[PREVIOUS_FRAME(_head)].frame);
-         _prediction = _inputs[PREVIOUS_FRAME(_head)];
+         _prediction.frame = _last_added_frame + 1;
       }
-      _prediction.frame++;
    }
 
    ASSERT(_prediction.frame >= 0);
 
    /*
-    * If we've made it this far, we must be predicting.  Go ahead and
-    * forward the prediction frame contents.  Be sure to return the
-    * frame number requested by the client, though.
+    * If we've made it this far, we must be predicting.  Hand out the guess
+    * we already made for this frame, or make one now and remember it so
+    * we can check it when the real input arrives.
     */
-   *input = _prediction;
-   input->frame = requested_frame;
+   GameInput &prediction = _predictions[requested_frame % INPUT_QUEUE_LENGTH];
+   if (prediction.frame != requested_frame) {
+      prediction.init(GameInput::NullFrame, NULL, _prediction.size);
+      _predictor->Predict(*this, _last_added_frame, requested_frame, &prediction);
+      prediction.frame = requested_frame;
+      prediction.size = _prediction.size;
+   }
+   memcpy(_prediction_masks[requested_frame % INPUT_QUEUE_LENGTH], _relevance_mask, _prediction.size);
+   *input = prediction;
    Log("returning prediction frame number %d (%d).\n", input->frame, _prediction.frame);
 
    return false;
@@ -240,11 +282,15 @@ InputQueue::AddDelayedInputToQueue(GameInput &input, int frame_number)
 
       /*
        * We've been predicting...  See if the inputs we've gotten match
-       * what we've been predicting.  If so, don't worry about it.  If not,
+       * what we've been predicting, in the bits the game said it cares
+       * about.  If so, don't worry about it.  If not,
        * remember the first input which was incorrect so we can report it
        * in GetFirstIncorrectFrame()
        */
-      if (_first_incorrect_frame == GameInput::NullFrame && !_prediction.equal(input, true)) {
+      int offset = frame_number % INPUT_QUEUE_LENGTH;
+      GameInput &prediction = _predictions[offset];
+      if (_first_incorrect_frame == GameInput::NullFrame &&
+          (prediction.frame != frame_number || !prediction.matches(input, _prediction_masks[offset]))) {
          Log("frame %d does not match prediction.  marking error.\n", frame_number);
          _first_incorrect_frame = frame_number;
       }
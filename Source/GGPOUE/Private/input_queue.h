@@ -9,6 +9,7 @@
 #define _INPUT_QUEUE_H
 
 #include "game_input.h"
+#include "input_predictor.h"
 
 #define INPUT_QUEUE_LENGTH    128
 #define DEFAULT_INPUT_SIZE      4
@@ -25,6 +26,8 @@ public:
    int GetLength() { return _length; }
 
    void SetFrameDelay(int delay) { _frame_delay = delay; }
+   void SetPredictor(InputPredictor *predictor);
+   void SetRelevanceMask(const char *mask);
    void ResetPrediction(int frame);
    void DiscardConfirmedFrames(int frame);
    bool GetConfirmedInput(int frame, GameInput *input);
@@ -52,6 +55,22 @@ protected:
 
    GameInput            _inputs[INPUT_QUEUE_LENGTH];
    GameInput            _prediction;
+
+   /*
+    * What the predictor handed out for each frame, indexed by frame modulo
+    * INPUT_QUEUE_LENGTH.  _prediction.frame is the oldest one not yet
+    * checked against a real input.
+    */
+   InputPredictor       *_predictor;
+   GameInput            _predictions[INPUT_QUEUE_LENGTH];
+
+   /*
+    * Only bits set in the relevance mask count when checking a prediction.
+    * Each prediction is checked with the mask that was current when it was
+    * handed out.
+    */
+   char                 _relevance_mask[GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS];
+   char                 _prediction_masks[INPUT_QUEUE_LENGTH][GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS];
 };
 
 #endif
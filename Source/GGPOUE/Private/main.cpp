@@ -52,11 +52,28 @@ GGPONet::ggpo_start_session(GGPOSession **session,
                    int input_size,
                    unsigned short localport)
 {
+   return ggpo_start_session(session, cb, game, num_players, input_size, localport,
+                             GGPO_MAX_PREDICTION_FRAMES);
+}
+
+GGPOErrorCode
+GGPONet::ggpo_start_session(GGPOSession **session,
+                   GGPOSessionCallbacks *cb,
+                   const char *game,
+                   int num_players,
+                   int input_size,
+                   unsigned short localport,
+                   int max_prediction_frames)
+{
+   if (max_prediction_frames < 1 || max_prediction_frames > GGPO_PREDICTION_FRAMES_LIMIT) {
+      return GGPO_ERRORCODE_INVALID_REQUEST;
+   }
    *session= (GGPOSession *)new Peer2PeerBackend(cb,
                                                  game,
                                                  localport,
                                                  num_players,
-                                                 input_size);
+                                                 input_size,
+                                                 max_prediction_frames);
    return GGPO_OK;
 }
 
@@ -205,6 +222,78 @@ GGPONet::ggpo_try_synchronize_local(GGPOSession* ggpo)
     return ggpo->TrySynchronizeLocal();
 }
 
+GGPOErrorCode
+GGPONet::ggpo_set_state_compression(GGPOSession *ggpo, bool enable)
+{
+   if (!ggpo) {
+      return GGPO_ERRORCODE_INVALID_SESSION;
+   }
+   return ggpo->SetStateCompression(enable);
+}
+
+GGPOErrorCode
+GGPONet::ggpo_register_state_region(GGPOSession *ggpo, void *base, int size)
+{
+   if (!ggpo) {
+      return GGPO_ERRORCODE_INVALID_SESSION;
+   }
+   return ggpo->RegisterStateRegion(base, size);
+}
+
+GGPOErrorCode
+GGPONet::ggpo_set_speculation(GGPOSession *ggpo, int num_branches, int num_threads)
+{
+   if (!ggpo) {
+      return GGPO_ERRORCODE_INVALID_SESSION;
+   }
+   return ggpo->SetSpeculation(num_branches, num_threads);
+}
+
+GGPOErrorCode
+GGPONet::ggpo_set_rollback_coalescing(GGPOSession *ggpo, bool enable)
+{
+   if (!ggpo) {
+      return GGPO_ERRORCODE_INVALID_SESSION;
+   }
+   return ggpo->SetRollbackCoalescing(enable);
+}
+
+GGPOErrorCode
+GGPONet::ggpo_set_input_predictor(GGPOSession *ggpo, GGPOPlayerHandle player, EGGPOInputPredictor predictor)
+{
+   if (!ggpo) {
+      return GGPO_ERRORCODE_INVALID_SESSION;
+   }
+   return ggpo->SetInputPredictor(player, predictor);
+}
+
+GGPOErrorCode
+GGPONet::ggpo_set_input_relevance_mask(GGPOSession *ggpo, void *mask, int size)
+{
+   if (!ggpo) {
+      return GGPO_ERRORCODE_INVALID_SESSION;
+   }
+   return ggpo->SetInputRelevanceMask(mask, size);
+}
+
+GGPOErrorCode
+GGPONet::ggpo_set_network_thread(GGPOSession *ggpo, bool enable)
+{
+   if (!ggpo) {
+      return GGPO_ERRORCODE_INVALID_SESSION;
+   }
+   return ggpo->SetNetworkThread(enable);
+}
+
+GGPOErrorCode
+GGPONet::ggpo_set_network_conditions(GGPOSession *ggpo, GGPOPlayerHandle player, const GGPONetworkConditions *conditions)
+{
+   if (!ggpo) {
+      return GGPO_ERRORCODE_INVALID_SESSION;
+   }
+   return ggpo->SetNetworkConditions(player, conditions);
+}
+
 GGPOErrorCode GGPONet::ggpo_start_spectating(GGPOSession **session,
                                     GGPOSessionCallbacks *cb,
                                     const char *game,
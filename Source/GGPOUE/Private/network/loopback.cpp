@@ -0,0 +1,183 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "loopback.h"
+#include "../types.h"
+#if defined(POLL_EPOLL)
+#include <sys/eventfd.h>
+#endif
+
+/*
+ * Every LoopbackTransport that has claimed a port.  The lock is held while
+ * a packet is handed over, so the receiver can't go away half way through.
+ */
+static std::mutex             loopback_registry_lock;
+static LoopbackTransport      *loopback_registry[MAX_LOOPBACK_TRANSPORTS];
+
+LoopbackTransport::LoopbackTransport() :
+   _port(0),
+   _callbacks(NULL),
+   _inbox_head(0),
+   _inbox_count(0)
+{
+   _inbox = new Packet[LOOPBACK_QUEUE_SIZE];
+   _recv = new Packet;
+#if defined(POLL_EPOLL)
+   _event_fd = -1;
+#endif
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+   {
+      std::lock_guard<std::mutex> lock(loopback_registry_lock);
+      for (int i = 0; i < MAX_LOOPBACK_TRANSPORTS; i++) {
+         if (loopback_registry[i] == this) {
+            loopback_registry[i] = NULL;
+         }
+      }
+   }
+#if defined(POLL_EPOLL)
+   if (_event_fd != -1) {
+      close(_event_fd);
+   }
+#endif
+   delete [] _inbox;
+   delete _recv;
+}
+
+void
+LoopbackTransport::Init(uint16 port, Poll *poll, Callbacks *callbacks)
+{
+   _callbacks = callbacks;
+
+   {
+      std::lock_guard<std::mutex> lock(loopback_registry_lock);
+      int slot = -1;
+      for (int i = MAX_LOOPBACK_TRANSPORTS - 1; i >= 0; i--) {
+         if (!loopback_registry[i]) {
+            slot = i;
+         } else if (loopback_registry[i]->_port == htons(port)) {
+            Log(EGGPOLogVerbosity::Info, "port %d is already taken.\n", port);
+            return;
+         }
+      }
+      if (slot == -1) {
+         Log(EGGPOLogVerbosity::Info, "too many transports, can't take port %d.\n", port);
+         return;
+      }
+      Log(EGGPOLogVerbosity::Info, "taking port %d.\n", port);
+      _port = htons(port);
+      loopback_registry[slot] = this;
+   }
+
+#if defined(POLL_EPOLL)
+   _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   poll->RegisterHandle(this, _event_fd);
+#else
+   poll->RegisterLoop(this);
+#endif
+}
+
+void
+LoopbackTransport::SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen)
+{
+   ASSERT(len <= MAX_UDP_PACKET_SIZE);
+   uint16 port = ((sockaddr_in *)dst)->sin_port;
+
+   std::lock_guard<std::mutex> lock(loopback_registry_lock);
+   for (int i = 0; i < MAX_LOOPBACK_TRANSPORTS; i++) {
+      LoopbackTransport *to = loopback_registry[i];
+      if (to && to->_port == port) {
+         to->Deliver(buffer, len, _port);
+         return;
+      }
+   }
+   Log(EGGPOLogVerbosity::VeryVerbose, "nobody on port %d, dropping packet of length %d.\n", ntohs(port), len);
+}
+
+void
+LoopbackTransport::Deliver(char *buffer, int len, uint16 from_port)
+{
+   {
+      std::lock_guard<std::mutex> lock(_lock);
+      if (_inbox_count == LOOPBACK_QUEUE_SIZE) {
+         Log(EGGPOLogVerbosity::Info, "queue full, dropping packet of length %d.\n", len);
+         return;
+      }
+      Packet *packet = _inbox + (_inbox_head + _inbox_count++) % LOOPBACK_QUEUE_SIZE;
+      packet->len = len;
+      packet->port = from_port;
+      memcpy(packet->data, buffer, len);
+   }
+#if defined(POLL_EPOLL)
+   uint64 one = 1;
+   if (write(_event_fd, &one, sizeof one) != sizeof one) {
+      Log(EGGPOLogVerbosity::VeryVerbose, "eventfd write returned errno %d.\n", errno);
+   }
+#endif
+}
+
+bool
+LoopbackTransport::OnHandlePoll(void *cookie)
+{
+#if defined(POLL_EPOLL)
+   uint64 count;
+   if (read(_event_fd, &count, sizeof count) != sizeof count && errno != EAGAIN) {
+      Log(EGGPOLogVerbosity::VeryVerbose, "eventfd read returned errno %d.\n", errno);
+   }
+#endif
+   return OnLoopPoll(cookie);
+}
+
+bool
+LoopbackTransport::OnLoopPoll(void *cookie)
+{
+   sockaddr_in from;
+   memset(&from, 0, sizeof from);
+   from.sin_family = AF_INET;
+   from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   /*
+    * Take the packets one at a time, so that the lock isn't held while the
+    * callbacks send packets of their own.
+    */
+   for (;;) {
+      {
+         std::lock_guard<std::mutex> lock(_lock);
+         if (_inbox_count == 0) {
+            break;
+         }
+         Packet *packet = _inbox + _inbox_head;
+         _recv->len = packet->len;
+         _recv->port = packet->port;
+         memcpy(_recv->data, packet->data, packet->len);
+         _inbox_head = (_inbox_head + 1) % LOOPBACK_QUEUE_SIZE;
+         _inbox_count--;
+      }
+      from.sin_port = _recv->port;
+      Log(EGGPOLogVerbosity::VeryVerbose, "received packet (len:%d  from port:%d).\n", _recv->len, ntohs(_recv->port));
+      _callbacks->OnMsg(from, (UdpMsg *)_recv->data, _recv->len);
+   }
+   return true;
+}
+
+void
+LoopbackTransport::Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...)
+{
+   char buf[1024];
+   size_t offset;
+   va_list args;
+
+   strcpy_s(buf, "loopback | ");
+   offset = strlen(buf);
+   va_start(args, fmt);
+   vsnprintf(buf + offset, ARRAY_SIZE(buf) - offset - 1, fmt, args);
+   buf[ARRAY_SIZE(buf)-1] = '\0';
+   ::Log(Verbosity, "%s", buf);
+   va_end(args);
+}
@@ -0,0 +1,70 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _LOOPBACK_H
+#define _LOOPBACK_H
+
+#include <mutex>
+#include "udp.h"
+
+#define LOOPBACK_QUEUE_SIZE         128
+#define MAX_LOOPBACK_TRANSPORTS     64
+
+/*
+ * LoopbackTransport --
+ *
+ * Carries packets between sessions in the same process through in-memory
+ * queues instead of sockets, so benchmarks and soak tests of the whole
+ * stack don't depend on the kernel.  Each transport claims the port it is
+ * given to Init, and SendTo hands a copy of the packet straight to the
+ * transport that claimed the destination port, ignoring the address.  It
+ * arrives from 127.0.0.1 and the sender's port, so peers should be added
+ * with that address.
+ *
+ * Packets are delivered in the order they were sent, the next time the
+ * receiver's Poll is pumped, and none are ever lost unless the receiver
+ * lets LOOPBACK_QUEUE_SIZE of them pile up.
+ */
+class LoopbackTransport : public Transport, public IPollSink
+{
+public:
+   LoopbackTransport();
+   virtual ~LoopbackTransport();
+
+   virtual void Init(uint16 port, Poll *p, Callbacks *callbacks);
+   virtual void SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen);
+
+   virtual bool OnHandlePoll(void *cookie);
+   virtual bool OnLoopPoll(void *cookie);
+
+protected:
+   struct Packet {
+      int            len;
+      uint16         port;
+      uint8          data[MAX_UDP_PACKET_SIZE];
+   };
+
+   void Deliver(char *buffer, int len, uint16 from_port);
+   void Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...);
+
+protected:
+   uint16         _port;      /* network byte order */
+   Callbacks      *_callbacks;
+
+   // _inbox is a ring of LOOPBACK_QUEUE_SIZE packets, guarded by _lock
+   std::mutex     _lock;
+   Packet         *_inbox;
+   int            _inbox_head;
+   int            _inbox_count;
+   Packet         *_recv;
+
+#if defined(POLL_EPOLL)
+   int            _event_fd;  /* readable while there's something in _inbox */
+#endif
+};
+
+#endif
@@ -0,0 +1,468 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "shm_transport.h"
+#include "../types.h"
+
+#if defined(SHM_TRANSPORT)
+
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+
+static const uint32 SHM_INBOX_MAGIC = 0x4747504d;     /* 'GGPM' */
+
+static_assert(std::atomic<uint32>::is_always_lock_free, "futexes need plain 32-bit words");
+
+/*
+ * The inboxes of other processes are shared futexes; only the private ones
+ * could use FUTEX_*_PRIVATE.
+ */
+static long
+Futex(std::atomic<uint32> *word, int op, uint32 value)
+{
+   return syscall(SYS_futex, (uint32 *)word, op, value, NULL, NULL, 0);
+}
+
+static void
+InboxName(char *name, int size, uint16 port)
+{
+   snprintf(name, size, "/ggpo-%d", ntohs(port));
+}
+
+ShmTransport::ShmTransport() :
+   _mode(0),
+   _port(0),
+   _poll(NULL),
+   _callbacks(NULL),
+   _inbox(NULL),
+   _event_fd(-1),
+   _waker_quit(false),
+   _simulate_all(false)
+{
+   memset(_peers, 0, sizeof _peers);
+}
+
+ShmTransport::~ShmTransport()
+{
+   Inbox *inbox = _inbox.load(std::memory_order_relaxed);
+   if (inbox) {
+      _waker_quit = true;
+      inbox->doorbell.fetch_add(1);
+      Futex(&inbox->doorbell, FUTEX_WAKE, INT_MAX);
+      _waker_thread.join();
+
+      char name[32];
+      InboxName(name, sizeof name, _port);
+      inbox->owner.store(0, std::memory_order_release);
+      shm_unlink(name);
+      CloseInbox(inbox);
+   }
+   if (_event_fd != -1) {
+      close(_event_fd);
+   }
+   for (int i = 0; i < MAX_UDP_ENDPOINTS; i++) {
+      if (_peers[i].inbox) {
+         CloseInbox(_peers[i].inbox);
+      }
+   }
+}
+
+void
+ShmTransport::Init(uint16 port, Poll *poll, Callbacks *callbacks)
+{
+   _udp.Init(port, poll, callbacks);
+
+   _port = htons(port);
+   _poll = poll;
+   _callbacks = callbacks;
+   _mode = Platform::GetConfigInt("ggpo.network.shm");
+   if (_mode < 0) {
+      return;
+   }
+
+   /*
+    * The inbox may not turn up until SendTo has something for a peer, by
+    * which time the network thread can be blocked in Poll::Wait.  So hook
+    * into the Poll now, while nobody else is using it, and have the
+    * callbacks check for the inbox.
+    */
+   _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   _poll->RegisterHandle(this, _event_fd);
+   _poll->RegisterLoop(this);
+   _poll->RegisterWait(this);
+
+   /*
+    * Peers at a loopback address will be using one of those too, so there's
+    * no need for an inbox until we have something for one of them.
+    */
+   if (_mode > 0) {
+      CreateInbox();
+   }
+}
+
+bool
+ShmTransport::CreateInbox()
+{
+   char name[32];
+   InboxName(name, sizeof name, _port);
+
+   /*
+    * Whoever had the port before us may have died without cleaning up.
+    */
+   int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+   if (fd == -1 && errno == EEXIST) {
+      Inbox *old = OpenInbox(_port);
+      if (old) {
+         CloseInbox(old);
+         Log(EGGPOLogVerbosity::Info, "%s belongs to another live session.  Not using shared memory.\n", name);
+         _mode = -1;
+         return false;
+      }
+      shm_unlink(name);
+      fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+   }
+   if (fd == -1) {
+      Log(EGGPOLogVerbosity::Info, "failed to create %s (errno: %d).  Not using shared memory.\n", name, errno);
+      _mode = -1;
+      return false;
+   }
+   void *mem = MAP_FAILED;
+   if (ftruncate(fd, sizeof(Inbox)) == 0) {
+      mem = mmap(NULL, sizeof(Inbox), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   }
+   close(fd);
+   if (mem == MAP_FAILED) {
+      Log(EGGPOLogVerbosity::Info, "failed to map %s (errno: %d).  Not using shared memory.\n", name, errno);
+      shm_unlink(name);
+      _mode = -1;
+      return false;
+   }
+
+   /*
+    * The new pages are zeroed.  Setting the owner last tells senders the
+    * rest is ready, and publishing _inbox after that tells our own Poll
+    * callbacks.
+    */
+   Inbox *inbox = (Inbox *)mem;
+   inbox->magic = SHM_INBOX_MAGIC;
+   inbox->size = sizeof(Inbox);
+   for (int i = 0; i < SHM_INBOX_SLOTS; i++) {
+      inbox->slots[i].seq.store(i, std::memory_order_relaxed);
+   }
+   inbox->owner.store(getpid(), std::memory_order_release);
+   _inbox.store(inbox, std::memory_order_release);
+   Log(EGGPOLogVerbosity::Info, "created %s.\n", name);
+
+   _waker_thread = std::thread(&ShmTransport::WakerThreadMain, this);
+   return true;
+}
+
+/*
+ * Maps the inbox for port, if there is one and its owner is still alive.
+ */
+ShmTransport::Inbox *
+ShmTransport::OpenInbox(uint16 port)
+{
+   char name[32];
+   InboxName(name, sizeof name, port);
+
+   int fd = shm_open(name, O_RDWR, 0);
+   if (fd == -1) {
+      return NULL;
+   }
+   struct stat st;
+   void *mem = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && st.st_size == sizeof(Inbox)) {
+      mem = mmap(NULL, sizeof(Inbox), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   }
+   close(fd);
+   if (mem == MAP_FAILED) {
+      return NULL;
+   }
+
+   Inbox *inbox = (Inbox *)mem;
+   pid_t owner = (pid_t)inbox->owner.load(std::memory_order_acquire);
+   if (!owner || inbox->magic != SHM_INBOX_MAGIC || inbox->size != sizeof(Inbox) ||
+       (kill(owner, 0) == -1 && errno == ESRCH)) {
+      CloseInbox(inbox);
+      return NULL;
+   }
+   return inbox;
+}
+
+void
+ShmTransport::CloseInbox(Inbox *inbox)
+{
+   munmap(inbox, sizeof(Inbox));
+}
+
+bool
+ShmTransport::IsLocal(sockaddr_in *addr)
+{
+   return (ntohl(addr->sin_addr.s_addr) >> 24) == 127;
+}
+
+ShmTransport::Peer *
+ShmTransport::GetPeer(sockaddr_in *addr)
+{
+   Peer *unused = NULL;
+   for (int i = 0; i < MAX_UDP_ENDPOINTS; i++) {
+      Peer *peer = _peers + i;
+      if (!peer->used) {
+         unused = unused ? unused : peer;
+      } else if (peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr && peer->addr.sin_port == addr->sin_port) {
+         return peer;
+      }
+   }
+   if (unused) {
+      memset(unused, 0, sizeof *unused);
+      unused->used = true;
+      unused->addr = *addr;
+      unused->next_try = Platform::GetCurrentTimeMS();
+   }
+   return unused;
+}
+
+void
+ShmTransport::SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen)
+{
+   sockaddr_in *to = (sockaddr_in *)dst;
+
+   if (_mode >= 0 && !_simulate_all && (_mode > 0 || IsLocal(to))) {
+      if (!_inbox.load(std::memory_order_relaxed)) {
+         CreateInbox();
+      }
+      Peer *peer = GetPeer(to);
+      if (peer && !peer->simulated) {
+         unsigned int now = Platform::GetCurrentTimeMS();
+         if (!peer->inbox && (int)(now - peer->next_try) >= 0) {
+            peer->inbox = OpenInbox(to->sin_port);
+            peer->next_try = now + SHM_RETRY_INTERVAL;
+            if (peer->inbox) {
+               Log(EGGPOLogVerbosity::Info, "sending to port %d through shared memory.\n", ntohs(to->sin_port));
+            }
+         }
+         if (peer->inbox && !peer->inbox->owner.load(std::memory_order_relaxed)) {
+            Log(EGGPOLogVerbosity::Info, "port %d closed its inbox.\n", ntohs(to->sin_port));
+            CloseInbox(peer->inbox);
+            peer->inbox = NULL;
+         }
+         if (peer->inbox) {
+            if (!Push(peer->inbox, buffer, len)) {
+               Log(EGGPOLogVerbosity::VeryVerbose, "inbox for port %d is full, dropping packet of length %d.\n", ntohs(to->sin_port), len);
+            }
+            return;
+         }
+      }
+   }
+   _udp.SendTo(buffer, len, flags, dst, destlen);
+}
+
+bool
+ShmTransport::Push(Inbox *inbox, char *buffer, int len)
+{
+   ASSERT(len <= MAX_UDP_PACKET_SIZE);
+
+   /*
+    * A slot is ours to fill when its seq matches the position we claim.
+    * If it's behind, the owner hasn't emptied it yet and the ring is full.
+    */
+   uint32 pos = inbox->enqueue_pos.load(std::memory_order_relaxed);
+   Slot *slot;
+   for (;;) {
+      slot = inbox->slots + (pos & (SHM_INBOX_SLOTS - 1));
+      int diff = (int)(slot->seq.load(std::memory_order_acquire) - pos);
+      if (diff == 0) {
+         if (inbox->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+         }
+      } else if (diff < 0) {
+         return false;
+      } else {
+         pos = inbox->enqueue_pos.load(std::memory_order_relaxed);
+      }
+   }
+   slot->len = (uint16)len;
+   slot->port = _port;
+   memcpy(slot->data, buffer, len);
+   slot->seq.store(pos + 1, std::memory_order_release);
+
+   /*
+    * Pairs with the fence in OnWaitPoll: either the owner sees this packet
+    * before it blocks, or we see it waiting.
+    */
+   inbox->doorbell.fetch_add(1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (inbox->waiting.load(std::memory_order_relaxed) && inbox->waiting.exchange(0)) {
+      Futex(&inbox->doorbell, FUTEX_WAKE, 1);
+   }
+   return true;
+}
+
+void
+ShmTransport::Drain()
+{
+   Inbox *inbox = _inbox.load(std::memory_order_acquire);
+   sockaddr_in from;
+   memset(&from, 0, sizeof from);
+   from.sin_family = AF_INET;
+
+   /*
+    * The packets are handed over where they lie, and each slot goes back to
+    * the senders once the callback is done with it.
+    */
+   for (;;) {
+      uint32 pos = inbox->dequeue_pos.load(std::memory_order_relaxed);
+      Slot *slot = inbox->slots + (pos & (SHM_INBOX_SLOTS - 1));
+      if ((int)(slot->seq.load(std::memory_order_acquire) - (pos + 1)) < 0) {
+         break;
+      }
+
+      /*
+       * Say it came from whatever address we know the sender's port by, so
+       * that it matches the endpoint's.
+       */
+      from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      from.sin_port = slot->port;
+      for (int i = 0; i < MAX_UDP_ENDPOINTS; i++) {
+         if (_peers[i].used && _peers[i].addr.sin_port == slot->port) {
+            from.sin_addr = _peers[i].addr.sin_addr;
+            break;
+         }
+      }
+      Log(EGGPOLogVerbosity::VeryVerbose, "received packet (len:%d  from port:%d).\n", slot->len, ntohs(slot->port));
+      _callbacks->OnMsg(from, (UdpMsg *)slot->data, slot->len);
+
+      slot->seq.store(pos + SHM_INBOX_SLOTS, std::memory_order_release);
+      inbox->dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+   }
+}
+
+void
+ShmTransport::Flush()
+{
+   _udp.Flush();
+}
+
+void
+ShmTransport::SetNetworkConditions(sockaddr_in *peer, const GGPONetworkConditions *conditions)
+{
+   _udp.SetNetworkConditions(peer, conditions);
+
+   if (!peer) {
+      _simulate_all = conditions != NULL;
+      for (int i = 0; i < MAX_UDP_ENDPOINTS; i++) {
+         _peers[i].simulated = false;
+      }
+   } else {
+      Peer *p = GetPeer(peer);
+      if (p) {
+         p->simulated = conditions != NULL;
+      }
+   }
+}
+
+bool
+ShmTransport::OnHandlePoll(void *cookie)
+{
+   uint64 count;
+   if (read(_event_fd, &count, sizeof count) != sizeof count && errno != EAGAIN) {
+      Log(EGGPOLogVerbosity::VeryVerbose, "eventfd read returned errno %d.\n", errno);
+   }
+   if (_inbox.load(std::memory_order_relaxed)) {
+      Drain();
+   }
+   return true;
+}
+
+bool
+ShmTransport::OnLoopPoll(void *cookie)
+{
+   if (_inbox.load(std::memory_order_relaxed)) {
+      Drain();
+   }
+   return true;
+}
+
+/*
+ * OnWaitPoll and OnWakePoll can run on the network thread without the
+ * network lock while SendTo creates the inbox, so they go by _inbox alone.
+ */
+bool
+ShmTransport::OnWaitPoll(void *cookie)
+{
+   Inbox *inbox = _inbox.load(std::memory_order_acquire);
+   if (!inbox) {
+      return true;
+   }
+   inbox->waiting.store(1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+
+   uint32 pos = inbox->dequeue_pos.load(std::memory_order_relaxed);
+   Slot *slot = inbox->slots + (pos & (SHM_INBOX_SLOTS - 1));
+   return (int)(slot->seq.load(std::memory_order_acquire) - (pos + 1)) < 0;
+}
+
+void
+ShmTransport::OnWakePoll(void *cookie)
+{
+   Inbox *inbox = _inbox.load(std::memory_order_acquire);
+   if (inbox) {
+      inbox->waiting.store(0, std::memory_order_relaxed);
+   }
+}
+
+/*
+ * Sleeps on the doorbell and pokes _event_fd whenever a sender wakes it.
+ * Senders only do that while our Poll is blocked, so this thread spends
+ * nearly all its time asleep.  Any ring in between also counts, since the
+ * wake may have come before we went back to sleep.
+ */
+void
+ShmTransport::WakerThreadMain()
+{
+   Inbox *inbox = _inbox.load(std::memory_order_acquire);
+   uint32 seen = inbox->doorbell.load(std::memory_order_acquire);
+   while (!_waker_quit) {
+      long res = Futex(&inbox->doorbell, FUTEX_WAIT, seen);
+      uint32 bell = inbox->doorbell.load(std::memory_order_acquire);
+      if (_waker_quit) {
+         break;
+      }
+      if (res == 0 || bell != seen) {
+         seen = bell;
+         uint64 one = 1;
+         if (write(_event_fd, &one, sizeof one) != sizeof one) {
+            Log(EGGPOLogVerbosity::VeryVerbose, "eventfd write returned errno %d.\n", errno);
+         }
+      }
+   }
+}
+
+void
+ShmTransport::Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...)
+{
+   char buf[1024];
+   size_t offset;
+   va_list args;
+
+   strcpy_s(buf, "shm | ");
+   offset = strlen(buf);
+   va_start(args, fmt);
+   vsnprintf(buf + offset, ARRAY_SIZE(buf) - offset - 1, fmt, args);
+   buf[ARRAY_SIZE(buf)-1] = '\0';
+   ::Log(Verbosity, "%s", buf);
+   va_end(args);
+}
+
+#endif
@@ -0,0 +1,126 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _SHM_TRANSPORT_H
+#define _SHM_TRANSPORT_H
+
+#include "udp.h"
+
+/*
+ * Sessions on the same Linux host can skip the network stack altogether
+ * and leave packets for each other in shared memory, waking each other
+ * with futexes.
+ */
+#if defined(__linux__)
+#  define SHM_TRANSPORT
+#endif
+
+#if defined(SHM_TRANSPORT)
+
+#include <atomic>
+#include <thread>
+
+#define SHM_INBOX_SLOTS          256      /* must be a power of 2 */
+#define SHM_RETRY_INTERVAL       1000
+
+/*
+ * ShmTransport --
+ *
+ * Udp, except that packets for a peer on the same host go through shared
+ * memory instead.  Every transport that takes part has an inbox named
+ * after its port, a ring of packet slots that any number of senders can
+ * fill without a lock while the owner empties it from its Poll loop.  A
+ * sender looks for the peer's inbox the first time it has something for
+ * it, and keeps using the socket until it turns up.
+ *
+ * The ggpo.network.shm config setting picks the peers: 0, the default,
+ * means those at a loopback address, 1 any peer whose port has an inbox on
+ * this host whatever address it was given, and -1 none at all.  Packets
+ * for a peer with simulated network conditions always take the socket.
+ *
+ * Nothing is done per packet while the owner is busy polling.  Just before
+ * its Poll blocks it sets the inbox's waiter flag, and the first sender to
+ * see it set clears it and wakes the owner's waker thread with a futex,
+ * which in turn pokes an eventfd the Poll is waiting on.
+ */
+class ShmTransport : public Transport, public IPollSink
+{
+public:
+   ShmTransport();
+   virtual ~ShmTransport();
+
+   virtual void Init(uint16 port, Poll *p, Callbacks *callbacks);
+   virtual void SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen);
+   virtual void Flush();
+   virtual void SetNetworkConditions(sockaddr_in *peer, const GGPONetworkConditions *conditions);
+
+   virtual bool OnHandlePoll(void *cookie);
+   virtual bool OnLoopPoll(void *cookie);
+   virtual bool OnWaitPoll(void *cookie);
+   virtual void OnWakePoll(void *cookie);
+
+protected:
+   struct Slot {
+      std::atomic<uint32>  seq;
+      uint16               len;
+      uint16               port;       /* the sender's, network byte order */
+      uint8                data[MAX_UDP_PACKET_SIZE];
+   };
+
+   /*
+    * A bounded multi-producer queue after Dmitry Vyukov's: a sender claims
+    * a slot by bumping enqueue_pos, and each slot's seq says whose turn it
+    * is, the sender's or the owner's.
+    */
+   struct Inbox {
+      uint32               magic;
+      uint32               size;
+      std::atomic<uint32>  owner;      /* pid, or 0 once closed */
+      alignas(64) std::atomic<uint32>  enqueue_pos;
+      alignas(64) std::atomic<uint32>  dequeue_pos;
+      alignas(64) std::atomic<uint32>  doorbell;
+      std::atomic<uint32>  waiting;
+      alignas(64) Slot     slots[SHM_INBOX_SLOTS];
+   };
+
+   struct Peer {
+      bool                 used;
+      sockaddr_in          addr;
+      bool                 simulated;
+      Inbox                *inbox;
+      unsigned int         next_try;
+   };
+
+   bool CreateInbox();
+   Inbox *OpenInbox(uint16 port);
+   void CloseInbox(Inbox *inbox);
+   Peer *GetPeer(sockaddr_in *addr);
+   bool IsLocal(sockaddr_in *addr);
+   bool Push(Inbox *inbox, char *buffer, int len);
+   void Drain();
+   void WakerThreadMain();
+   void Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...);
+
+protected:
+   Udp            _udp;
+   int            _mode;
+   uint16         _port;      /* network byte order */
+   Poll           *_poll;
+   Callbacks      *_callbacks;
+
+   std::atomic<Inbox *> _inbox;
+   int            _event_fd;
+   std::thread    _waker_thread;
+   std::atomic<bool> _waker_quit;
+
+   Peer           _peers[MAX_UDP_ENDPOINTS];
+   bool           _simulate_all;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "transport.h"
+#include "../types.h"
+#include "udp.h"
+#include "loopback.h"
+#include "shm_transport.h"
+
+Transport *
+Transport::Create()
+{
+   if (Platform::GetConfigBool("ggpo.network.loopback")) {
+      return new LoopbackTransport();
+   }
+#if defined(SHM_TRANSPORT)
+   if (Platform::GetConfigInt("ggpo.network.shm") >= 0) {
+      return new ShmTransport();
+   }
+#endif
+   return new Udp();
+}
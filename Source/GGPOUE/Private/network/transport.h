@@ -0,0 +1,60 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _TRANSPORT_H
+#define _TRANSPORT_H
+
+#include "../poll.h"
+
+// Forward declarations
+struct UdpMsg;
+struct GGPONetworkConditions;
+
+/*
+ * Transport --
+ *
+ * Whatever carries UdpMsgs between the backends and their peers.  Normally
+ * that's Udp, or on Linux ShmTransport, which is Udp with a shortcut for
+ * peers on the same host.  The ggpo.network.loopback config setting swaps
+ * in LoopbackTransport so that several sessions in one process can talk to
+ * each other without touching a socket.  Peers are still named by
+ * sockaddr_in either way.
+ */
+class Transport
+{
+public:
+   struct Callbacks {
+      virtual ~Callbacks() { }
+      virtual void OnMsg(sockaddr_in &from, UdpMsg *msg, int len) = 0;
+   };
+
+public:
+   /*
+    * Makes the transport the config settings ask for.
+    */
+   static Transport *Create();
+
+   virtual ~Transport() { }
+
+   virtual void Init(uint16 port, Poll *p, Callbacks *callbacks) = 0;
+   virtual void SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen) = 0;
+
+   /*
+    * Pushes out anything SendTo has batched up.  Backends call this at the
+    * end of each poll and after sending local input.
+    */
+   virtual void Flush() { }
+
+   /*
+    * Simulates a worse network for packets to peer, or to everyone if peer
+    * is NULL.  See ggpo_set_network_conditions.  Transports that can't
+    * ignore it.
+    */
+   virtual void SetNetworkConditions(sockaddr_in *peer, const GGPONetworkConditions *conditions) { }
+};
+
+#endif
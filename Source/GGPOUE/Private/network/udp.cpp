@@ -7,6 +7,13 @@
 
 #include "udp.h"
 #include "../types.h"
+#include "udp_uring.h"
+#include "udp_sim.h"
+
+/*
+ * How often packets held back by the network simulator are checked.
+ */
+static const int UDP_SIM_INTERVAL = 1;
 
 SOCKET
 CreateSocket(uint16 bind_port, int retries)
@@ -18,7 +25,9 @@ CreateSocket(uint16 bind_port, int retries)
 
    s = socket(AF_INET, SOCK_DGRAM, 0);
    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&optval, sizeof optval);
+#if defined(SO_DONTLINGER)
    setsockopt(s, SOL_SOCKET, SO_DONTLINGER, (const char *)&optval, sizeof optval);
+#endif
 
    // non-blocking...
    u_long iMode = 1;
@@ -39,33 +48,160 @@ CreateSocket(uint16 bind_port, int retries)
 
 Udp::Udp() :
    _socket(INVALID_SOCKET),
-   _callbacks(NULL)
+   _callbacks(NULL),
+   _sim(NULL)
 {
+#if defined(UDP_BATCHED_IO)
+   _recv_batch = NULL;
+   _send_batch = NULL;
+   _send_count = 0;
+#endif
+#if defined(UDP_IO_URING)
+   _uring = NULL;
+#endif
 }
 
 Udp::~Udp(void)
 {
+   delete _sim;
+#if defined(UDP_IO_URING)
+   delete _uring;
+#endif
    if (_socket != INVALID_SOCKET) {
       closesocket(_socket);
       _socket = INVALID_SOCKET;
    }
+#if defined(UDP_BATCHED_IO)
+   delete _recv_batch;
+   delete _send_batch;
+#endif
+}
+
+#if defined(UDP_BATCHED_IO)
+Udp::Batch *
+Udp::NewBatch()
+{
+   Batch *batch = new Batch;
+   memset(batch->msgs, 0, sizeof batch->msgs);
+   for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+      batch->iovecs[i].iov_base = batch->bufs[i];
+      batch->iovecs[i].iov_len = MAX_UDP_PACKET_SIZE;
+      batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+      batch->msgs[i].msg_hdr.msg_namelen = sizeof batch->addrs[i];
+      batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+      batch->msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+   return batch;
 }
+#endif
 
 void
 Udp::Init(uint16 port, Poll *poll, Callbacks *callbacks)
 {
    _callbacks = callbacks;
 
+   Log(EGGPOLogVerbosity::Info, "binding udp socket to port %d.\n", port);
+   _socket = CreateSocket(port, 0);
+
+   bool use_uring = false;
+#if defined(UDP_IO_URING)
+   if (_socket != INVALID_SOCKET && Platform::GetConfigBool("ggpo.network.io_uring")) {
+      _uring = UdpUring::Create(_socket);
+      use_uring = _uring != NULL;
+   }
+#endif
+#if defined(UDP_BATCHED_IO)
+   if (!use_uring) {
+      _recv_batch = NewBatch();
+      _send_batch = NewBatch();
+   }
+#endif
+
+   /*
+    * Where Poll can wait on the socket itself we only need to read from it
+    * when something has arrived.  With io_uring it's the ring we wait on,
+    * which is readable whenever there are completions to reap.
+    */
    _poll = poll;
+#if defined(POLL_EPOLL)
+   if (_socket != INVALID_SOCKET) {
+      PollHandle handle = _socket;
+#if defined(UDP_IO_URING)
+      if (use_uring) {
+         handle = _uring->GetFd();
+      }
+#endif
+      _poll->RegisterHandle(this, handle);
+   }
+#else
    _poll->RegisterLoop(this);
+#endif
 
-   Log(EGGPOLogVerbosity::Info, "binding udp socket to port %d.\n", port);
-   _socket = CreateSocket(port, 0);
+   GGPONetworkConditions conditions;
+   if (UdpSim::GetConfigConditions(&conditions)) {
+      SetNetworkConditions(NULL, &conditions);
+   }
+}
+
+void
+Udp::SetNetworkConditions(sockaddr_in *peer, const GGPONetworkConditions *conditions)
+{
+   if (!_sim) {
+      if (!conditions) {
+         return;
+      }
+      _sim = new UdpSim();
+      _poll->RegisterPeriodic(this, UDP_SIM_INTERVAL);
+   }
+   _sim->SetConditions(peer, conditions);
+}
+
+bool
+Udp::OnPeriodicPoll(void *cookie, int last_fired)
+{
+   UdpSim::Packet *packet;
+   while ((packet = _sim->NextDue(Platform::GetCurrentTimeMS())) != NULL) {
+      Transmit((char *)packet->data, packet->len, 0, (struct sockaddr *)&packet->dst, sizeof packet->dst);
+      _sim->Pop(packet);
+   }
+   return true;
 }
 
 void
 Udp::SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen)
 {
+   if (_sim && _sim->Send(buffer, len, (sockaddr_in *)dst)) {
+      return;
+   }
+   Transmit(buffer, len, flags, dst, destlen);
+}
+
+void
+Udp::Transmit(char *buffer, int len, int flags, struct sockaddr *dst, int destlen)
+{
+#if defined(UDP_IO_URING)
+   if (_uring) {
+      _uring->SendTo(buffer, len, dst, destlen);
+      return;
+   }
+#endif
+#if defined(UDP_BATCHED_IO)
+   /*
+    * The caller is free to reuse buffer as soon as we return, so take a copy.
+    * sendmmsg only takes one set of flags for the whole batch; nobody passes
+    * any.
+    */
+   ASSERT(flags == 0);
+   ASSERT(len <= MAX_UDP_PACKET_SIZE && destlen <= (int)sizeof(sockaddr_in));
+   if (_send_count == UDP_BATCH_SIZE) {
+      Flush();
+   }
+   int i = _send_count++;
+   memcpy(_send_batch->bufs[i], buffer, len);
+   memcpy(&_send_batch->addrs[i], dst, destlen);
+   _send_batch->iovecs[i].iov_len = len;
+   _send_batch->msgs[i].msg_hdr.msg_namelen = destlen;
+#else
    struct sockaddr_in *to = (struct sockaddr_in *)dst;
 
    int res = sendto(_socket, buffer, len, flags, dst, destlen);
@@ -76,11 +212,80 @@ Udp::SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen)
    }
    char dst_ip[1024];
    Log(EGGPOLogVerbosity::VeryVerbose, "sent packet length %d to %s:%d (ret:%d).\n", len, inet_ntop(AF_INET, (void *)&to->sin_addr, dst_ip, ARRAY_SIZE(dst_ip)), ntohs(to->sin_port), res);
+#endif
+}
+
+void
+Udp::Flush()
+{
+#if defined(UDP_IO_URING)
+   if (_uring) {
+      _uring->Submit();
+      return;
+   }
+#endif
+#if defined(UDP_BATCHED_IO)
+   int sent = 0;
+   while (sent < _send_count) {
+      int res = sendmmsg(_socket, _send_batch->msgs + sent, _send_count - sent, 0);
+      if (res == SOCKET_ERROR) {
+         Log(EGGPOLogVerbosity::Info, "unknown error in sendmmsg (errno: %d).\n", errno);
+         ASSERT(false && "Unknown error in sendmmsg");
+      }
+      for (int i = sent; i < sent + res; i++) {
+         char dst_ip[1024];
+         sockaddr_in *to = &_send_batch->addrs[i];
+         Log(EGGPOLogVerbosity::VeryVerbose, "sent packet length %d to %s:%d.\n", _send_batch->msgs[i].msg_len, inet_ntop(AF_INET, (void *)&to->sin_addr, dst_ip, ARRAY_SIZE(dst_ip)), ntohs(to->sin_port));
+      }
+      sent += res;
+   }
+   _send_count = 0;
+#endif
+}
+
+bool
+Udp::OnHandlePoll(void *cookie)
+{
+   return OnLoopPoll(cookie);
 }
 
 bool
 Udp::OnLoopPoll(void *cookie)
 {
+#if defined(UDP_IO_URING)
+   if (_uring) {
+      _uring->Drain(_callbacks);
+      return true;
+   }
+#endif
+#if defined(UDP_BATCHED_IO)
+   Flush();
+
+   for (;;) {
+      for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+         _recv_batch->msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      }
+      int count = recvmmsg(_socket, _recv_batch->msgs, UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+      if (count == -1) {
+         if (errno != EWOULDBLOCK) {
+            Log(EGGPOLogVerbosity::VeryVerbose, "recvmmsg returned errno %d.\n", errno);
+         }
+         break;
+      }
+      for (int i = 0; i < count; i++) {
+         int len = _recv_batch->msgs[i].msg_len;
+         if (len > 0) {
+            char src_ip[1024];
+            sockaddr_in &recv_addr = _recv_batch->addrs[i];
+            Log(EGGPOLogVerbosity::VeryVerbose, "recvmmsg returned (len:%d  from:%s:%d).\n", len, inet_ntop(AF_INET, (void*)&recv_addr.sin_addr, src_ip, ARRAY_SIZE(src_ip)), ntohs(recv_addr.sin_port) );
+            _callbacks->OnMsg(recv_addr, (UdpMsg *)_recv_batch->bufs[i], len);
+         }
+      }
+      if (count < UDP_BATCH_SIZE) {
+         break;
+      }
+   }
+#else
    uint8          recv_buf[MAX_UDP_PACKET_SIZE];
    sockaddr_in    recv_addr;
    int            recv_addr_len;
@@ -104,6 +309,7 @@ Udp::OnLoopPoll(void *cookie)
          _callbacks->OnMsg(recv_addr, msg, len);
       } 
    }
+#endif
    return true;
 }
 
@@ -8,16 +8,30 @@
 #ifndef _UDP_H
 #define _UDP_H
 
-#include "../poll.h"
+#include "transport.h"
 
 // Forward declarations
-struct UdpMsg;
+class UdpUring;
+class UdpSim;
 
 #define MAX_UDP_ENDPOINTS     16
 
 static const int MAX_UDP_PACKET_SIZE = 4096;
 
-class Udp : public IPollSink
+/*
+ * Linux can move a whole batch of datagrams per syscall with recvmmsg and
+ * sendmmsg, or hand the socket to io_uring altogether when the
+ * ggpo.network.io_uring config setting is on.  Everywhere else SendTo goes
+ * straight to sendto.
+ */
+#if defined(__linux__)
+#  define UDP_BATCHED_IO
+#  define UDP_IO_URING
+#endif
+
+#define UDP_BATCH_SIZE        32
+
+class Udp : public Transport, public IPollSink
 {
 public:
    struct Stats {
@@ -26,26 +40,26 @@ public:
       float    kbps_sent;
    };
 
-   struct Callbacks {
-      virtual ~Callbacks() { }
-      virtual void OnMsg(sockaddr_in &from, UdpMsg *msg, int len) = 0;
-   };
-
-
 protected:
    void Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...);
 
 public:
    Udp();
 
-   void Init(uint16 port, Poll *p, Callbacks *callbacks);
-   
-   void SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen);
+   virtual void Init(uint16 port, Poll *p, Callbacks *callbacks);
+   virtual void SendTo(char *buffer, int len, int flags, struct sockaddr *dst, int destlen);
+   virtual void Flush();
+   virtual void SetNetworkConditions(sockaddr_in *peer, const GGPONetworkConditions *conditions);
 
+   virtual bool OnHandlePoll(void *cookie);
    virtual bool OnLoopPoll(void *cookie);
+   virtual bool OnPeriodicPoll(void *cookie, int last_fired);
 
 public:
-   ~Udp(void);
+   virtual ~Udp(void);
+
+protected:
+   void Transmit(char *buffer, int len, int flags, struct sockaddr *dst, int destlen);
 
 protected:
    // Network transmission information
@@ -54,6 +68,28 @@ protected:
    // state management
    Callbacks      *_callbacks;
    Poll           *_poll;
+
+#if defined(UDP_BATCHED_IO)
+   struct Batch {
+      struct mmsghdr    msgs[UDP_BATCH_SIZE];
+      struct iovec      iovecs[UDP_BATCH_SIZE];
+      sockaddr_in       addrs[UDP_BATCH_SIZE];
+      uint8             bufs[UDP_BATCH_SIZE][MAX_UDP_PACKET_SIZE];
+   };
+   Batch          *NewBatch();
+
+   // SendTo copies outgoing datagrams into _send_batch until the next Flush
+   Batch          *_recv_batch;
+   Batch          *_send_batch;
+   int            _send_count;
+#endif
+
+#if defined(UDP_IO_URING)
+   UdpUring       *_uring;
+#endif
+
+   // only created once there are network conditions to simulate
+   UdpSim         *_sim;
 };
 
 #endif
@@ -0,0 +1,125 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "udp_fec.h"
+
+UdpFec::UdpFec() :
+   _count(0),
+   _first_seq(0),
+   _seq_mask(0),
+   _len_xor(0),
+   _data_len(0),
+   _last_add_time(0)
+{
+   memset(_data, 0, sizeof(_data));
+   memset(_received, 0, sizeof(_received));
+}
+
+bool
+UdpFec::Add(UdpMsg *msg)
+{
+   int len = msg->PacketSize();
+   uint16 offset = (uint16)(msg->hdr.sequence_number - _first_seq);
+
+   if (len > MAX_PARITY_BYTES) {
+      return false;
+   }
+   if (_count == 0) {
+      _first_seq = msg->hdr.sequence_number;
+      offset = 0;
+   } else if (offset >= MAX_PARITY_SPAN) {
+      return false;
+   }
+
+   uint8 *bytes = (uint8 *)msg;
+   for (int i = 0; i < len; i++) {
+      _data[i] ^= bytes[i];
+   }
+   _data_len = MAX(_data_len, len);
+   _len_xor ^= (uint16)len;
+   _seq_mask |= (1 << offset);
+   _last_add_time = Platform::GetCurrentTimeMS();
+   _count++;
+   return true;
+}
+
+void
+UdpFec::Close(UdpMsg *parity)
+{
+   ASSERT(_count > 0);
+   parity->u.input_parity.first_seq = _first_seq;
+   parity->u.input_parity.seq_mask = _seq_mask;
+   parity->u.input_parity.len_xor = _len_xor;
+   parity->u.input_parity.data_len = (uint16)_data_len;
+   memcpy(parity->u.input_parity.data, _data, _data_len);
+
+   memset(_data, 0, _data_len);
+   _data_len = 0;
+   _len_xor = 0;
+   _seq_mask = 0;
+   _count = 0;
+}
+
+void
+UdpFec::OnReceived(UdpMsg *msg, int len)
+{
+   Received &entry = _received[msg->hdr.sequence_number % MAX_PARITY_SPAN];
+   entry.valid = len <= MAX_PARITY_BYTES;
+   entry.seq = msg->hdr.sequence_number;
+   entry.len = len;
+   if (entry.valid) {
+      memcpy(entry.data, msg, len);
+   }
+}
+
+bool
+UdpFec::Recover(UdpMsg *parity, UdpMsg *out, int *len)
+{
+   int data_len = parity->u.input_parity.data_len;
+   uint16 first_seq = parity->u.input_parity.first_seq;
+   uint16 mask = parity->u.input_parity.seq_mask;
+   int missing = -1;
+
+   if (data_len > MAX_PARITY_BYTES) {
+      return false;
+   }
+   for (int i = 0; i < MAX_PARITY_SPAN; i++) {
+      if (mask & (1 << i)) {
+         uint16 seq = (uint16)(first_seq + i);
+         Received &entry = _received[seq % MAX_PARITY_SPAN];
+         if (!entry.valid || entry.seq != seq) {
+            if (missing >= 0) {
+               return false;
+            }
+            missing = seq;
+         }
+      }
+   }
+   if (missing < 0) {
+      return false;
+   }
+
+   uint8 *bytes = (uint8 *)out;
+   int missing_len = parity->u.input_parity.len_xor;
+   memcpy(bytes, parity->u.input_parity.data, data_len);
+   for (int i = 0; i < MAX_PARITY_SPAN; i++) {
+      uint16 seq = (uint16)(first_seq + i);
+      if ((mask & (1 << i)) && seq != missing) {
+         Received &entry = _received[seq % MAX_PARITY_SPAN];
+         for (int j = 0; j < entry.len; j++) {
+            bytes[j] ^= entry.data[j];
+         }
+         missing_len ^= entry.len;
+      }
+   }
+   if (missing_len <= 0 || missing_len > data_len ||
+       out->hdr.sequence_number != missing) {
+      return false;
+   }
+   *len = missing_len;
+   return true;
+}
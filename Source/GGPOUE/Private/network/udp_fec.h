@@ -0,0 +1,70 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _UDP_FEC_H
+#define _UDP_FEC_H
+
+#include "../types.h"
+#include "udp_msg.h"
+
+/*
+ * UdpFec --
+ *
+ * XOR parity over groups of input packets.  The sender folds each input
+ * packet it sends into the open group, and closes the group with an
+ * InputParity packet.  The receiver keeps the last few input packets it got,
+ * and when a parity packet shows exactly one of its group missing, rebuilds
+ * it from the parity and the rest.
+ *
+ * Groups are identified by the sequence numbers they cover, which must all
+ * fall within MAX_PARITY_SPAN of the first.  Packets bigger than
+ * MAX_PARITY_BYTES aren't covered.
+ */
+class UdpFec {
+public:
+   UdpFec();
+
+   /*
+    * Sender side.  Add returns false, leaving the group alone, if msg can't
+    * join it, in which case the caller should close the group and retry.
+    */
+   bool Add(UdpMsg *msg);
+   int Count() { return _count; }
+   int LastAddTime() { return _last_add_time; }
+   void Close(UdpMsg *parity);
+
+   /*
+    * Receiver side.
+    */
+   void OnReceived(UdpMsg *msg, int len);
+   bool Recover(UdpMsg *parity, UdpMsg *out, int *len);
+
+protected:
+   /*
+    * The open group.
+    */
+   int            _count;
+   uint16         _first_seq;
+   uint16         _seq_mask;
+   uint16         _len_xor;
+   int            _data_len;
+   uint8          _data[MAX_PARITY_BYTES];
+   int            _last_add_time;
+
+   /*
+    * Recently received input packets, indexed by sequence number.
+    */
+   struct Received {
+      bool        valid;
+      uint16      seq;
+      int         len;
+      uint8       data[MAX_PARITY_BYTES];
+   };
+   Received       _received[MAX_PARITY_SPAN];
+};
+
+#endif
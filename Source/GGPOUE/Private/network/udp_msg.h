@@ -10,6 +10,8 @@
 
 #define MAX_COMPRESSED_BITS       4096
 #define UDP_MSG_MAX_PLAYERS          4
+#define MAX_PARITY_BYTES           256
+#define MAX_PARITY_SPAN             16
 
 #pragma pack(push, 1)
 
@@ -24,6 +26,30 @@ struct UdpMsg
       QualityReply  = 5,
       KeepAlive     = 6,
       InputAck      = 7,
+      CompactInput  = 8,
+      InputParity   = 9,
+      InputNack     = 10,
+   };
+
+   /*
+    * Optional protocol features, advertised by both ends in the sync
+    * handshake.  A feature is only used once both ends have it.  Peers that
+    * predate the handshake field advertise none.
+    */
+   enum Capabilities {
+      InputXorCodec         = (1 << 0),  /* input may be an InputCodec stream instead of a BitVector */
+      InputRangeCoder       = (1 << 1),  /* input.bits holds a RangeCoder stream */
+      InputRangeCoderWanted = (1 << 2),  /* ask for InputRangeCoder even if the other end didn't */
+      InputCompactHeader    = (1 << 3),  /* send CompactInput instead of Input */
+      InputParityFec        = (1 << 4),  /* understands InputParity */
+      InputNackRetransmit   = (1 << 5),  /* understands InputNack */
+   };
+
+   enum CompactInputFlags {
+      DisconnectRequested   = (1 << 0),
+      HasConnectStatus      = (1 << 1),  /* data starts with the sender's connect status */
+      HasInput              = (1 << 2),  /* data ends with the start frame and coded input */
+      BitVectorInput        = (1 << 3),  /* the coded input is a BitVector, padded with 1 bits */
    };
 
    struct connect_status {
@@ -41,15 +67,20 @@ struct UdpMsg
          uint32      random_request;  /* please reply back with this random data */
          uint16      remote_magic;
          uint8       remote_endpoint;
+         uint8       capabilities;    /* capabilities and input_size must be last */
+         uint8       input_size;      /* size of the input we'll send you */
       } sync_request;
       
       struct {
          uint32      random_reply;    /* OK, here's your random data back */
+         uint8       capabilities;    /* capabilities and input_size must be last */
+         uint8       input_size;
       } sync_reply;
       
       struct {
          int8        frame_advantage; /* what's the other guy's frame advantage? */
          uint32      ping;
+         uint8       fraction_lost;   /* of your packets since the last report, in 256ths; must be last */
       } quality_report;
       
       struct {
@@ -64,7 +95,8 @@ struct UdpMsg
          int               disconnect_requested:1;
          int               ack_frame:31;
 
-         uint16            num_bits;
+         uint16            num_bits:15;     /* length of bits, in bits, whichever the encoding */
+         uint16            bit_vector:1;    /* bits is a BitVector even though InputXorCodec is on */
          uint8             input_size; // XXX: shouldn't be in every single packet!
          uint8             bits[MAX_COMPRESSED_BITS]; /* must be last */
       } input;
@@ -73,6 +105,42 @@ struct UdpMsg
          int               ack_frame:31;
       } input_ack;
 
+      /*
+       * Sent when a packet shows up after a gap in the sequence numbers.
+       * Any input sent after recv_seq was already on its way, so the
+       * receiver only resends if its last input packet was older.
+       */
+      struct {
+         int               ack_frame:31;
+         uint16            recv_seq;        /* the packet that showed the gap */
+      } input_nack;
+
+      /*
+       * input without the fields that rarely change.  input_size comes
+       * from the handshake, ack_frame is only its low 16 bits, and data
+       * holds, in order and only when flagged:
+       *
+       *    HasConnectStatus:  uint8 (disconnected << 4) | present, then a
+       *                       zigzag varint last_frame - ack_frame for
+       *                       each present entry
+       *    HasInput:          zigzag varint start_frame - ack_frame, then
+       *                       the coded input to the end of data
+       */
+      struct {
+         uint16            flags:4;         /* CompactInputFlags */
+         uint16            data_len:12;
+         uint16            ack_frame;
+         uint8             data[MAX_COMPRESSED_BITS / 8]; /* must be last */
+      } compact_input;
+
+      struct {
+         uint16            first_seq;
+         uint16            seq_mask;        /* bit i covers packet first_seq + i */
+         uint16            len_xor;         /* XOR of the covered packets' lengths */
+         uint16            data_len;
+         uint8             data[MAX_PARITY_BYTES]; /* XOR of the covered packets; must be last */
+      } input_parity;
+
    } u;
 
 public:
@@ -89,16 +157,27 @@ public:
       case QualityReport: return sizeof(u.quality_report);
       case QualityReply:  return sizeof(u.quality_reply);
       case InputAck:      return sizeof(u.input_ack);
+      case InputNack:     return sizeof(u.input_nack);
       case KeepAlive:     return 0;
       case Input:
          size = (int)((char *)&u.input.bits - (char *)&u.input);
          size += (u.input.num_bits + 7) / 8;
          return size;
+      case CompactInput:
+         size = (int)((char *)&u.compact_input.data - (char *)&u.compact_input);
+         size += u.compact_input.data_len;
+         return size;
+      case InputParity:
+         size = (int)((char *)&u.input_parity.data - (char *)&u.input_parity);
+         size += u.input_parity.data_len;
+         return size;
       }
       ASSERT(false);
       return 0;
    }
 
+   bool IsInput() { return hdr.type == Input || hdr.type == CompactInput; }
+
    UdpMsg(MsgType t) { hdr.type = (uint8)t; }
 };
 
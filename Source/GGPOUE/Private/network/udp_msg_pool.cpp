@@ -0,0 +1,93 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "udp_msg_pool.h"
+
+static const int SLOT_SIZES[] = {
+   UDP_MSG_POOL_SMALL_SIZE,
+   sizeof(UdpMsg),
+};
+
+UdpMsgPool::UdpMsgPool() :
+   _chunks(NULL)
+{
+   memset(_free, 0, sizeof _free);
+}
+
+UdpMsgPool::~UdpMsgPool()
+{
+   while (_chunks) {
+      char *next = *(char **)_chunks;
+      delete [] _chunks;
+      _chunks = next;
+   }
+}
+
+UdpMsg *
+UdpMsgPool::Alloc(UdpMsg::MsgType type)
+{
+   bool large = type == UdpMsg::Input || type == UdpMsg::CompactInput || type == UdpMsg::InputParity;
+   UdpMsg *msg = AllocSlot(large ? Large : Small);
+   msg->hdr.type = (uint8)type;
+   return msg;
+}
+
+UdpMsg *
+UdpMsgPool::Trim(UdpMsg *msg)
+{
+   int size = msg->PacketSize();
+   if (SlotOf(msg)->size_class == Small || size > SLOT_SIZES[Small]) {
+      return msg;
+   }
+   UdpMsg *small = AllocSlot(Small);
+   memcpy(small, msg, size);
+   Free(msg);
+   return small;
+}
+
+void
+UdpMsgPool::Free(UdpMsg *msg)
+{
+   Slot *slot = SlotOf(msg);
+   slot->next = _free[slot->size_class];
+   _free[slot->size_class] = slot;
+}
+
+UdpMsg *
+UdpMsgPool::AllocSlot(int size_class)
+{
+   if (!_free[size_class]) {
+      Grow(size_class);
+   }
+   Slot *slot = _free[size_class];
+   _free[size_class] = slot->next;
+   slot->next = NULL;
+   return Message(slot);
+}
+
+void
+UdpMsgPool::Grow(int size_class)
+{
+   /*
+    * Each chunk starts with a pointer to the previously allocated chunk so
+    * the destructor can find them all, followed by the slots.
+    */
+   int stride = sizeof(Slot) + SLOT_SIZES[size_class];
+   stride = (stride + sizeof(void *) - 1) & ~((int)sizeof(void *) - 1);
+
+   char *chunk = new char[sizeof(Slot) + stride * UDP_MSG_POOL_CHUNK_SLOTS];
+   *(char **)chunk = _chunks;
+   _chunks = chunk;
+
+   char *p = chunk + sizeof(Slot);
+   for (int i = 0; i < UDP_MSG_POOL_CHUNK_SLOTS; i++, p += stride) {
+      Slot *slot = (Slot *)p;
+      slot->size_class = size_class;
+      slot->next = _free[size_class];
+      _free[size_class] = slot;
+   }
+}
@@ -0,0 +1,74 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _UDP_MSG_POOL_H
+#define _UDP_MSG_POOL_H
+
+#include "../types.h"
+#include "udp_msg.h"
+
+/*
+ * Slots in the small size class hold every message except unusually long
+ * runs of input.  Anything bigger goes in a slot as big as a whole UdpMsg.
+ */
+#define UDP_MSG_POOL_SMALL_SIZE        128
+#define UDP_MSG_POOL_CHUNK_SLOTS       16
+
+/*
+ * UdpMsgPool --
+ *
+ * Free lists of message buffers for the send queue.  Only the first
+ * PacketSize() bytes of a message are ever read, so most messages live in
+ * slots far smaller than sizeof(UdpMsg).  The pool grows a chunk at a time
+ * and never gives memory back until it is destroyed, so once the send queue
+ * has reached its working size no more allocations happen.
+ */
+class UdpMsgPool {
+public:
+   UdpMsgPool();
+   ~UdpMsgPool();
+
+   /*
+    * Returns a message with hdr.type set.  Input messages get a full size
+    * slot, since their length isn't known until they have been encoded;
+    * call Trim once they have been.
+    */
+   UdpMsg *Alloc(UdpMsg::MsgType type);
+
+   /*
+    * Moves msg into the smallest slot that will hold it and returns the
+    * message to use from then on.
+    */
+   UdpMsg *Trim(UdpMsg *msg);
+
+   void Free(UdpMsg *msg);
+
+protected:
+   enum SizeClass {
+      Small,
+      Large,
+      NumSizeClasses
+   };
+
+   struct Slot {
+      Slot        *next;
+      int         size_class;
+      int         pad;
+   };
+
+   static UdpMsg *Message(Slot *slot) { return (UdpMsg *)(slot + 1); }
+   static Slot *SlotOf(UdpMsg *msg) { return (Slot *)msg - 1; }
+
+   UdpMsg *AllocSlot(int size_class);
+   void Grow(int size_class);
+
+protected:
+   Slot     *_free[NumSizeClasses];
+   char     *_chunks;
+};
+
+#endif
@@ -8,21 +8,52 @@
 #include "udp_proto.h"
 #include "../types.h"
 #include "../bitvector.h"
+#include "../input_codec.h"
+#include "../range_coder.h"
+#include "../varint.h"
+#include <math.h>
 
 static const int UDP_HEADER_SIZE = 28;     /* Size of IP + UDP headers */
 static const int NUM_SYNC_PACKETS = 5;
 static const int SYNC_RETRY_INTERVAL = 2000;
 static const int SYNC_FIRST_RETRY_INTERVAL = 500;
 static const int RUNNING_RETRY_INTERVAL = 200;
+static const int MIN_RETRY_INTERVAL     = 34;      /* two frames */
+static const int MAX_RETRY_INTERVAL     = 2000;
+static const int MAX_RETRY_BACKOFF      = 4;
 static const int KEEP_ALIVE_INTERVAL    = 200;
+static const int MIN_KEEP_ALIVE_INTERVAL = 50;
 static const int QUALITY_REPORT_INTERVAL = 1000;
 static const int NETWORK_STATS_INTERVAL  = 1000;
 static const int UDP_SHUTDOWN_TIMER = 5000;
 static const int MAX_SEQ_DISTANCE = (1 << 15);
+static const int CONNECT_STATUS_REFRESH_FRAMES = 8;
+static const int FEC_IDLE_FLUSH_INTERVAL = 32;
+static const float STATS_EWMA_WEIGHT = 0.25f;
+
+/*
+ * Parity group size for a reported fraction of packets lost, in 256ths.
+ */
+static int
+FecGroupSize(int fraction_lost)
+{
+   if (fraction_lost < 3) {         /* < 1% */
+      return 0;
+   } else if (fraction_lost < 8) {  /* < 3% */
+      return 8;
+   } else if (fraction_lost < 26) { /* < 10% */
+      return 4;
+   }
+   return 2;
+}
 
 UdpProtocol::UdpProtocol() :
    _round_trip_time(0),
-   _kbps_sent(0),
+   _srtt(0),
+   _rttvar(0),
+   _rto(RUNNING_RETRY_INTERVAL),
+   _retry_backoff(0),
+   _rtt_ack_frame(-1),
    _local_frame_advantage(0),
    _remote_frame_advantage(0),
    _queue(-1),
@@ -31,6 +62,9 @@ UdpProtocol::UdpProtocol() :
    _packets_sent(0),
    _bytes_sent(0),
    _stats_start_time(0),
+   _stats_windows(0),
+   _jitter_time(0),
+   _jitter_frame(-1),
    _last_send_time(0),
    _shutdown_timeout(0),
    _disconnect_timeout(0),
@@ -38,24 +72,43 @@ UdpProtocol::UdpProtocol() :
    _disconnect_notify_sent(false),
    _disconnect_event_sent(false),
    _connected(false),
+   _capabilities(UdpMsg::InputXorCodec | UdpMsg::InputRangeCoder | UdpMsg::InputCompactHeader | UdpMsg::InputParityFec |
+                 UdpMsg::InputNackRetransmit),
+   _remote_capabilities(0),
+   _input_size(0),
+   _remote_input_size(0),
+   _connect_status_resend_frame(-1),
+   _exact_connect_status(false),
+   _recv_packets(0),
+   _recv_expected(0),
+   _fec_group_size(0),
+   _last_input_seq(-1),
+   _last_input_send_seq(-1),
    _next_send_seq(0),
    _next_recv_seq(0),
-   _udp(NULL)
+   _transport(NULL)
 {
    _last_sent_input.init(-1, NULL, 1);
    _last_received_input.init(-1, NULL, 1);
    _last_acked_input.init(-1, NULL, 1);
+   _recv_model_input.init(-1, NULL, 1);
+   RangeModel_Init(&_send_model);
+   RangeModel_Init(&_recv_model);
 
    memset(&_state, 0, sizeof _state);
+   memset(&_stats_window, 0, sizeof _stats_window);
+   memset(&_stats_avg, 0, sizeof _stats_avg);
    memset(_peer_connect_status, 0, sizeof(_peer_connect_status));
    for (int i = 0; i < ARRAY_SIZE(_peer_connect_status); i++) {
       _peer_connect_status[i].last_frame = -1;
    }
+   memcpy(_last_sent_connect_status, _peer_connect_status, sizeof(_last_sent_connect_status));
    memset(&_peer_addr, 0, sizeof _peer_addr);
-   _oo_packet.msg = NULL;
 
-   _send_latency = Platform::GetConfigInt("ggpo.network.delay");
-   _oop_percent = Platform::GetConfigInt("ggpo.oop.percent");
+   if (Platform::GetConfigBool("ggpo.network.range_coder")) {
+      _capabilities |= UdpMsg::InputRangeCoderWanted;
+   }
+   _fec_enabled = Platform::GetConfigBool("ggpo.network.fec");
 }
 
 UdpProtocol::~UdpProtocol()
@@ -64,15 +117,17 @@ UdpProtocol::~UdpProtocol()
 }
 
 void
-UdpProtocol::Init(Udp *udp,
+UdpProtocol::Init(Transport *transport,
                   Poll &poll,
                   int queue,
                   char *ip,
                   u_short port,
+                  int input_size,
                   UdpMsg::connect_status *status)
 {  
-   _udp = udp;
+   _transport = transport;
    _queue = queue;
+   _input_size = input_size;
    _local_connect_status = status;
 
    _peer_addr.sin_family = AF_INET;
@@ -88,7 +143,7 @@ UdpProtocol::Init(Udp *udp,
 void
 UdpProtocol::SendInput(GameInput &input)
 {
-   if (_udp) {
+   if (_transport) {
       if (_current_state == Running) {
          /*
           * Check to see if this is a good time to adjust for the rift...
@@ -104,6 +159,7 @@ UdpProtocol::SendInput(GameInput &input)
           * the odds of this happening...
           */
          _pending_output.push(input);
+         _input_send_time[input.frame % UDP_BUFFER_SIZE] = Platform::GetCurrentTimeMS();
       }
       SendPendingOutput();
    }  
@@ -112,34 +168,33 @@ UdpProtocol::SendInput(GameInput &input)
 void
 UdpProtocol::SendPendingOutput()
 {
-   UdpMsg *msg = new UdpMsg(UdpMsg::Input);
-   int i, j, offset = 0;
-   uint8 *bits;
-   GameInput last;
-
    if (_pending_output.size()) {
-      last = _last_acked_input;
-      bits = msg->u.input.bits;
+      int last = MIN(_last_sent_input.frame, _pending_output.item(_pending_output.size() - 1).frame);
+      _stats_window.redundant_frames += MAX(0, last - _pending_output.front().frame + 1);
+   }
+
+   if (UseCapability(UdpMsg::InputCompactHeader)) {
+      SendCompactInput();
+      return;
+   }
 
+   UdpMsg *msg = _msg_pool.Alloc(UdpMsg::Input);
+   bool bit_vector = false;
+   int offset = 0;
+
+   if (_pending_output.size()) {
       msg->u.input.start_frame = _pending_output.front().frame;
       msg->u.input.input_size = (uint8)_pending_output.front().size;
 
-      ASSERT(last.frame == -1 || last.frame + 1 == msg->u.input.start_frame);
-      for (j = 0; j < _pending_output.size(); j++) {
-         GameInput &current = _pending_output.item(j);
-         if (memcmp(current.bits, last.bits, current.size) != 0) {
-            ASSERT((GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS * 8) < (1 << BITVECTOR_NIBBLE_SIZE));
-            for (i = 0; i < current.size * 8; i++) {
-               ASSERT(i < (1 << BITVECTOR_NIBBLE_SIZE));
-               if (current.value(i) != last.value(i)) {
-                  BitVector_SetBit(msg->u.input.bits, &offset);
-                  (current.value(i) ? BitVector_SetBit : BitVector_ClearBit)(bits, &offset);
-                  BitVector_WriteNibblet(bits, i, &offset);
-               }
-            }
-         }
-         BitVector_ClearBit(msg->u.input.bits, &offset);
-         last = _last_sent_input = current;
+      ASSERT(_last_acked_input.frame == -1 || _last_acked_input.frame + 1 == msg->u.input.start_frame);
+      if (UseRangeCoder()) {
+         offset = EncodeRangeCoder(msg->u.input.bits, MAX_COMPRESSED_BITS / 8) * 8;
+      } else if (UseCapability(UdpMsg::InputXorCodec)) {
+         offset = EncodeSmallerCodec(msg->u.input.bits, MAX_COMPRESSED_BITS / 8, false, &bit_vector);
+      } else {
+         offset = EncodeBitVector(msg->u.input.bits, MAX_COMPRESSED_BITS, _pending_output.size());
+         ASSERT(offset >= 0);
+         _last_sent_input = _pending_output.item(_pending_output.size() - 1);
       }
    } else {
       msg->u.input.start_frame = 0;
@@ -147,6 +202,7 @@ UdpProtocol::SendPendingOutput()
    }
    msg->u.input.ack_frame = _last_received_input.frame;
    msg->u.input.num_bits = (uint16)offset;
+   msg->u.input.bit_vector = bit_vector;
 
    msg->u.input.disconnect_requested = _current_state == Disconnected;
    if (_local_connect_status) {
@@ -155,19 +211,247 @@ UdpProtocol::SendPendingOutput()
       memset(msg->u.input.peer_connect_status, 0, sizeof(UdpMsg::connect_status) * UDP_MSG_MAX_PLAYERS);
    }
 
-   ASSERT(offset < MAX_COMPRESSED_BITS);
+   SendMsg(_msg_pool.Trim(msg));
+}
 
-   SendMsg(msg);
+void
+UdpProtocol::SendCompactInput()
+{
+   UdpMsg *msg = _msg_pool.Alloc(UdpMsg::CompactInput);
+   uint8 *data = msg->u.compact_input.data;
+   int capacity = ARRAY_SIZE(msg->u.compact_input.data);
+   int ack_frame = _last_received_input.frame;
+   int flags = 0;
+   int offset = 0;
+
+   if (_current_state == Disconnected) {
+      flags |= UdpMsg::DisconnectRequested;
+   }
+
+   /*
+    * In a two player game exact last frames only matter once someone
+    * disconnects.  Until then they just let the remote end throw away
+    * confirmed input, which can lag a few frames.  So only send our connect
+    * status when a disconnect flag changes or a frame moves far enough
+    * (every frame with more than two players), then keep sending it until the
+    * remote end acks a frame we hadn't queued yet at that point.  Every
+    * packet carrying that frame carries the new status too.
+    */
+   if (_local_connect_status) {
+      if (ConnectStatusChanged()) {
+         memcpy(_last_sent_connect_status, _local_connect_status, sizeof(_last_sent_connect_status));
+         _connect_status_resend_frame = (_pending_output.size() ? _pending_output.item(_pending_output.size() - 1).frame : _last_acked_input.frame) + 1;
+      }
+      if (_last_acked_input.frame < _connect_status_resend_frame) {
+         flags |= UdpMsg::HasConnectStatus;
+         offset = EncodeConnectStatus(data, offset, capacity, ack_frame);
+      }
+   }
+
+   if (_pending_output.size()) {
+      int start_frame = _pending_output.front().frame;
+      ASSERT(_last_acked_input.frame == -1 || _last_acked_input.frame + 1 == start_frame);
+      ASSERT(_pending_output.front().size == _input_size);
+
+      flags |= UdpMsg::HasInput;
+      offset = WriteVarint(data, offset, capacity, ZigZag(start_frame - ack_frame));
+      ASSERT(offset > 0);
+      if (UseRangeCoder()) {
+         offset += EncodeRangeCoder(data + offset, capacity - offset);
+      } else {
+         bool bit_vector = false;
+         offset += EncodeSmallerCodec(data + offset, capacity - offset, true, &bit_vector) / 8;
+         if (bit_vector) {
+            flags |= UdpMsg::BitVectorInput;
+         }
+      }
+   }
+
+   msg->u.compact_input.flags = flags;
+   msg->u.compact_input.data_len = offset;
+   msg->u.compact_input.ack_frame = (uint16)ack_frame;
+
+   SendMsg(_msg_pool.Trim(msg));
+}
+
+bool
+UdpProtocol::ConnectStatusChanged()
+{
+   int refresh_frames = _exact_connect_status ? 1 : CONNECT_STATUS_REFRESH_FRAMES;
+   for (int i = 0; i < UDP_MSG_MAX_PLAYERS; i++) {
+      if (_local_connect_status[i].disconnected != _last_sent_connect_status[i].disconnected ||
+          _local_connect_status[i].last_frame - _last_sent_connect_status[i].last_frame >= refresh_frames) {
+         return true;
+      }
+   }
+   return false;
+}
+
+/*
+ * Writes the entries of _last_sent_connect_status that say anything, with
+ * frames relative to base.  Returns the new offset.
+ */
+int
+UdpProtocol::EncodeConnectStatus(uint8 *data, int offset, int capacity, int base)
+{
+   int header = offset++;
+   uint8 present = 0, disconnected = 0;
+
+   for (int i = 0; i < UDP_MSG_MAX_PLAYERS; i++) {
+      UdpMsg::connect_status &status = _last_sent_connect_status[i];
+      if (!status.disconnected && status.last_frame == -1) {
+         continue;
+      }
+      present |= (1 << i);
+      disconnected |= (status.disconnected << i);
+      offset = WriteVarint(data, offset, capacity, ZigZag(status.last_frame - base));
+      ASSERT(offset > 0);
+   }
+   data[header] = (uint8)((disconnected << 4) | present);
+   return offset;
+}
+
+/*
+ * Encodes the first frames of _pending_output into bits one bit at a time,
+ * as (changed, value, index) triples.  Returns the number of bits written,
+ * or -1 if they don't fit in capacity bits.  This is the only encoding
+ * peers without UdpMsg::InputXorCodec understand.
+ */
+int
+UdpProtocol::EncodeBitVector(uint8 *bits, int capacity, int frames)
+{
+   int i, j, offset = 0;
+   const GameInput *last = &_last_acked_input;
+
+   for (j = 0; j < frames; j++) {
+      GameInput &current = _pending_output.item(j);
+      if (memcmp(current.bits, last->bits, current.size) != 0) {
+         ASSERT((GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS * 8) < (1 << BITVECTOR_NIBBLE_SIZE));
+         for (i = 0; i < current.size * 8; i++) {
+            ASSERT(i < (1 << BITVECTOR_NIBBLE_SIZE));
+            if (current.value(i) != last->value(i)) {
+               if (offset + 2 + BITVECTOR_NIBBLE_SIZE > capacity) {
+                  return -1;
+               }
+               BitVector_SetBit(bits, &offset);
+               (current.value(i) ? BitVector_SetBit : BitVector_ClearBit)(bits, &offset);
+               BitVector_WriteNibblet(bits, i, &offset);
+            }
+         }
+      }
+      if (offset + 1 > capacity) {
+         return -1;
+      }
+      BitVector_ClearBit(bits, &offset);
+      last = &current;
+   }
+   return offset;
+}
+
+/*
+ * Encodes as many frames of _pending_output as fit into out with the
+ * InputCodec, leaving how many in *frames.  Returns the number of bytes
+ * written.
+ */
+int
+UdpProtocol::EncodeInputCodec(uint8 *out, int capacity, int *frames)
+{
+   InputEncoder enc;
+   GameInput *last = &_last_acked_input;
+   int j;
+
+   InputCodec_BeginEncode(&enc, out, capacity);
+   for (j = 0; j < _pending_output.size(); j++) {
+      GameInput &current = _pending_output.item(j);
+      if (!InputCodec_EncodeFrame(&enc, *last, current)) {
+         break;
+      }
+      last = &current;
+   }
+   *frames = j;
+   return InputCodec_EndEncode(&enc);
+}
+
+/*
+ * The InputCodec spends at least a byte on every change, which is more
+ * than a BitVector needs when a digital pad flips a button or two.  So code
+ * the frames both ways and keep the smaller one, leaving *bit_vector set
+ * if that was the BitVector.  With pad, the BitVector is filled out to a
+ * whole byte with 1 bits, which the decoder can tell from a change because
+ * a change takes more bits than that.  Returns the number of bits written.
+ */
+int
+UdpProtocol::EncodeSmallerCodec(uint8 *out, int capacity, bool pad, bool *bit_vector)
+{
+   uint8 bits[MAX_COMPRESSED_BITS / 8];
+   int frames;
+   int len = EncodeInputCodec(out, capacity, &frames) * 8;
+
+   /*
+    * Both encodings cover the same frames, so whichever goes out, these
+    * are the frames sent.
+    */
+   _last_sent_input = frames ? _pending_output.item(frames - 1) : _last_acked_input;
+
+   *bit_vector = false;
+   int offset = EncodeBitVector(bits, MIN(capacity, (int)sizeof bits) * 8, frames);
+   if (offset < 0) {
+      return len;
+   }
+   while (pad && (offset % 8)) {
+      BitVector_SetBit(bits, &offset);
+   }
+   if (offset >= len) {
+      return len;
+   }
+   if (offset % 8) {
+      bits[offset / 8] &= (1 << (offset % 8)) - 1;
+   }
+   memcpy(out, bits, (offset + 7) / 8);
+   *bit_vector = true;
+   return offset;
+}
+
+/*
+ * Range codes as many frames of _pending_output as fit into out, starting
+ * from the model the remote end will have trained by the time it sees
+ * start_frame.  Returns the number of bytes written.
+ */
+int
+UdpProtocol::EncodeRangeCoder(uint8 *out, int capacity)
+{
+   RangeEncoder enc;
+   GameInput *last = &_last_acked_input;
+
+   RangeCoder_BeginEncode(&enc, &_send_model, out, capacity);
+   for (int j = 0; j < _pending_output.size(); j++) {
+      GameInput &current = _pending_output.item(j);
+      if (!RangeCoder_EncodeFrame(&enc, *last, current)) {
+         break;
+      }
+      last = &current;
+   }
+   _last_sent_input = *last;
+   return RangeCoder_EndEncode(&enc);
 }
 
 void
 UdpProtocol::SendInputAck()
 {
-   UdpMsg *msg = new UdpMsg(UdpMsg::InputAck);
+   UdpMsg *msg = _msg_pool.Alloc(UdpMsg::InputAck);
    msg->u.input_ack.ack_frame = _last_received_input.frame;
    SendMsg(msg);
 }
 
+void
+UdpProtocol::SendInputNack(uint16 recv_seq)
+{
+   UdpMsg *msg = _msg_pool.Alloc(UdpMsg::InputNack);
+   msg->u.input_nack.ack_frame = _last_received_input.frame;
+   msg->u.input_nack.recv_seq = recv_seq;
+   SendMsg(msg);
+}
+
 bool
 UdpProtocol::IsPendingFull()
 {
@@ -177,19 +461,14 @@ UdpProtocol::IsPendingFull()
 bool
 UdpProtocol::GetEvent(UdpProtocol::Event &e)
 {
-   if (_event_queue.size() == 0) {
-      return false;
-   }
-   e = _event_queue.front();
-   _event_queue.pop();
-   return true;
+   return _event_queue.pop(e);
 }
 
 
 bool
 UdpProtocol::OnLoopPoll(void *cookie)
 {
-   if (!_udp) {
+   if (!_transport) {
       return true;
    }
 
@@ -199,25 +478,32 @@ UdpProtocol::OnLoopPoll(void *cookie)
    PumpSendQueue();
    switch (_current_state) {
    case Syncing:
-      next_interval = (_state.sync.roundtrips_remaining == NUM_SYNC_PACKETS) ? SYNC_FIRST_RETRY_INTERVAL : SYNC_RETRY_INTERVAL;
+      if (_srtt) {
+         next_interval = MIN(RetryInterval(), SYNC_RETRY_INTERVAL);
+      } else {
+         next_interval = (_state.sync.roundtrips_remaining == NUM_SYNC_PACKETS) ? SYNC_FIRST_RETRY_INTERVAL : SYNC_RETRY_INTERVAL;
+      }
       if (_last_send_time && _last_send_time + next_interval < now) {
          Log("No luck syncing after %d ms... Re-queueing sync packet.\n", next_interval);
          SendSyncRequest();
+         _retry_backoff = MIN(_retry_backoff + 1, MAX_RETRY_BACKOFF);
       }
       break;
 
    case Running:
       // xxx: rig all this up with a timer wrapper
-      if (!_state.running.last_input_packet_recv_time || _state.running.last_input_packet_recv_time + RUNNING_RETRY_INTERVAL < now) {
+      if (!_state.running.last_input_packet_recv_time || _state.running.last_input_packet_recv_time + RetryInterval() < now) {
          Log("Haven't exchanged packets in a while (last received:%d  last sent:%d).  Resending.\n", _last_received_input.frame, _last_sent_input.frame);
          SendPendingOutput();
          _state.running.last_input_packet_recv_time = now;
+         _retry_backoff = MIN(_retry_backoff + 1, MAX_RETRY_BACKOFF);
       }
 
       if (!_state.running.last_quality_report_time || _state.running.last_quality_report_time + QUALITY_REPORT_INTERVAL < now) {
-         UdpMsg *msg = new UdpMsg(UdpMsg::QualityReport);
+         UdpMsg *msg = _msg_pool.Alloc(UdpMsg::QualityReport);
          msg->u.quality_report.ping = Platform::GetCurrentTimeMS();
          msg->u.quality_report.frame_advantage = (uint8)_local_frame_advantage;
+         msg->u.quality_report.fraction_lost = FractionLost();
          SendMsg(msg);
          _state.running.last_quality_report_time = now;
       }
@@ -227,9 +513,17 @@ UdpProtocol::OnLoopPoll(void *cookie)
          _state.running.last_network_stats_interval =  now;
       }
 
-      if (_last_send_time && _last_send_time + KEEP_ALIVE_INTERVAL < now) {
+      /*
+       * If we've gone quiet, don't leave the last few input packets
+       * unprotected until the next one.
+       */
+      if (_fec.Count() && _fec.LastAddTime() + FEC_IDLE_FLUSH_INTERVAL < now) {
+         SendMsg(CloseFecGroup());
+      }
+
+      if (_last_send_time && _last_send_time + MIN(MAX(2 * _rto, MIN_KEEP_ALIVE_INTERVAL), KEEP_ALIVE_INTERVAL) < now) {
          Log("Sending keep alive packet\n");
-         SendMsg(new UdpMsg(UdpMsg::KeepAlive));
+         SendMsg(_msg_pool.Alloc(UdpMsg::KeepAlive));
       }
 
       if (_disconnect_timeout && _disconnect_notify_start && 
@@ -253,7 +547,7 @@ UdpProtocol::OnLoopPoll(void *cookie)
    case Disconnected:
       if (_shutdown_timeout < now) {
          ::Log(EGGPOLogVerbosity::Info, "Shutting down udp connection.\n");
-         _udp = NULL;
+         _transport = NULL;
          _shutdown_timeout = 0;
       }
 
@@ -274,8 +568,11 @@ void
 UdpProtocol::SendSyncRequest()
 {
    _state.sync.random = rand() & 0xFFFF;
-   UdpMsg *msg = new UdpMsg(UdpMsg::SyncRequest);
+   _state.sync.request_time = Platform::GetCurrentTimeMS();
+   UdpMsg *msg = _msg_pool.Alloc(UdpMsg::SyncRequest);
    msg->u.sync_request.random_request = _state.sync.random;
+   msg->u.sync_request.capabilities = _capabilities;
+   msg->u.sync_request.input_size = (uint8)_input_size;
    SendMsg(msg);
 }
 
@@ -287,19 +584,55 @@ UdpProtocol::SendMsg(UdpMsg *msg)
    _packets_sent++;
    _last_send_time = Platform::GetCurrentTimeMS();
    _bytes_sent += msg->PacketSize();
+   _stats_window.packets_sent++;
+   _stats_window.bytes_sent += msg->PacketSize();
+   if (msg->IsInput()) {
+      _stats_window.input_packets++;
+      _stats_window.input_bytes += msg->PacketSize();
+   }
 
    msg->hdr.magic = _magic_number;
    msg->hdr.sequence_number = _next_send_seq++;
+   if (msg->IsInput()) {
+      _last_input_send_seq = msg->hdr.sequence_number;
+   }
+
+   /*
+    * Fold input packets into the parity group.  The parity packet has to
+    * go out after msg, or msg's lower sequence number would get it
+    * dropped as out of order.
+    */
+   UdpMsg *parity = NULL;
+   if (msg->IsInput() && UseFec()) {
+      if (!_fec.Add(msg) && _fec.Count()) {
+         parity = CloseFecGroup();
+         _fec.Add(msg);
+      } else if (_fec.Count() >= _fec_group_size) {
+         parity = CloseFecGroup();
+      }
+   }
 
    _send_queue.push(QueueEntry(Platform::GetCurrentTimeMS(), _peer_addr, msg));
    PumpSendQueue();
+
+   if (parity) {
+      SendMsg(parity);
+   }
+}
+
+UdpMsg *
+UdpProtocol::CloseFecGroup()
+{
+   UdpMsg *parity = _msg_pool.Alloc(UdpMsg::InputParity);
+   _fec.Close(parity);
+   return _msg_pool.Trim(parity);
 }
 
 bool
 UdpProtocol::HandlesMsg(sockaddr_in &from,
                         UdpMsg *msg)
 {
-   if (!_udp) {
+   if (!_transport) {
       return false;
    }
    return _peer_addr.sin_addr.S_un.S_addr == from.sin_addr.S_un.S_addr &&
@@ -320,6 +653,9 @@ UdpProtocol::OnMsg(UdpMsg *msg, int len)
       &UdpProtocol::OnQualityReply,        /* QualityReply */
       &UdpProtocol::OnKeepAlive,           /* KeepAlive */
       &UdpProtocol::OnInputAck,            /* InputAck */
+      &UdpProtocol::OnCompactInput,        /* CompactInput */
+      &UdpProtocol::OnInputParity,         /* InputParity */
+      &UdpProtocol::OnInputNack,           /* InputNack */
    };
 
    // filter out messages that don't match what we expect
@@ -334,10 +670,38 @@ UdpProtocol::OnMsg(UdpMsg *msg, int len)
       // filter out out-of-order packets
       uint16 skipped = (uint16)((int)seq - (int)_next_recv_seq);
       // Log("checking sequence number -> next - seq : %d - %d = %d\n", seq, _next_recv_seq, skipped);
+      _stats_window.packets_recv++;
+      _stats_window.bytes_recv += len;
       if (skipped > MAX_SEQ_DISTANCE) {
          Log("dropping out of order packet (seq: %d, last seq:%d)\n", seq, _next_recv_seq);
+         _stats_window.out_of_order++;
          return;
       }
+      if (skipped == 0) {
+         /*
+          * The same packet again.  Counting it as an arrival would hide a
+          * lost one from the loss stats and the FEC strength.
+          */
+         _stats_window.duplicates++;
+      } else {
+         _recv_expected += skipped;
+         _recv_packets++;
+         _stats_window.expected += skipped;
+         _stats_window.in_order++;
+      }
+
+      if (msg->IsInput()) {
+         _fec.OnReceived(msg, len);
+         _last_input_seq = seq;
+      } else if (skipped > 1 && _current_state == Running && UseCapability(UdpMsg::InputNackRetransmit)) {
+         /*
+          * Something went missing.  If it was input, nothing we have
+          * covers it (input packets carry all unacked input, so a newer
+          * one would), so ask for it now rather than waiting on the
+          * remote end's retry timer.
+          */
+         SendInputNack(seq);
+      }
    }
 
    _next_recv_seq = seq;
@@ -356,29 +720,58 @@ UdpProtocol::OnMsg(UdpMsg *msg, int len)
    }
 }
 
+static float
+Ewma(float avg, float sample, bool first)
+{
+   return first ? sample : avg + (sample - avg) * STATS_EWMA_WEIGHT;
+}
+
 void
 UdpProtocol::UpdateNetworkStats(void)
 {
-   int now = Platform::GetCurrentTimeMS();
+   unsigned int now = Platform::GetCurrentTimeMS();
 
-   if (_stats_start_time == 0) {
+   if (_stats_start_time == 0 || now == _stats_start_time) {
       _stats_start_time = now;
+      memset(&_stats_window, 0, sizeof _stats_window);
+      return;
    }
 
-   int total_bytes_sent = _bytes_sent + (UDP_HEADER_SIZE * _packets_sent);
-   float seconds = (float)((now - _stats_start_time) / 1000.0);
-   float Bps = total_bytes_sent / seconds;
-   float udp_overhead = (float)(100.0 * (UDP_HEADER_SIZE * _packets_sent) / _bytes_sent);
+   float seconds = (now - _stats_start_time) / 1000.0f;
+   int bytes_sent = _stats_window.bytes_sent + (UDP_HEADER_SIZE * _stats_window.packets_sent);
+   int bytes_recv = _stats_window.bytes_recv + (UDP_HEADER_SIZE * _stats_window.packets_recv);
+   bool first = _stats_windows++ == 0;
 
-   _kbps_sent = int(Bps / 1024);
+   _stats_avg.kbps_sent = Ewma(_stats_avg.kbps_sent, bytes_sent * 8 / 1000.0f / seconds, first);
+   _stats_avg.kbps_recv = Ewma(_stats_avg.kbps_recv, bytes_recv * 8 / 1000.0f / seconds, first);
+   _stats_avg.pps_sent = Ewma(_stats_avg.pps_sent, _stats_window.packets_sent / seconds, first);
+   _stats_avg.pps_recv = Ewma(_stats_avg.pps_recv, _stats_window.packets_recv / seconds, first);
 
-   Log("Network Stats -- Bandwidth: %.2f KBps   Packets Sent: %5d (%.2f pps)   "
-       "KB Sent: %.2f    UDP Overhead: %.2f %%.\n",
-       _kbps_sent, 
-       _packets_sent,
-       (float)_packets_sent * 1000 / (now - _stats_start_time),
-       total_bytes_sent / 1024.0,
-       udp_overhead);
+   /*
+    * Packets that arrived after a later one were counted missing when the
+    * gap showed up, but they did make it.
+    */
+   if (_stats_window.expected) {
+      int lost = MAX(0, _stats_window.expected - _stats_window.in_order - _stats_window.out_of_order);
+      _stats_avg.packet_loss = Ewma(_stats_avg.packet_loss, 100.0f * lost / _stats_window.expected, first);
+   }
+   if (_stats_window.packets_recv) {
+      _stats_avg.out_of_order = Ewma(_stats_avg.out_of_order, 100.0f * _stats_window.out_of_order / _stats_window.packets_recv, first);
+   }
+   if (_stats_window.input_packets) {
+      _stats_avg.input_packet_size = Ewma(_stats_avg.input_packet_size, (float)_stats_window.input_bytes / _stats_window.input_packets, first);
+      _stats_avg.redundant_frames = Ewma(_stats_avg.redundant_frames, (float)_stats_window.redundant_frames / _stats_window.input_packets, first);
+   }
+
+   Log("Network Stats -- Bandwidth: %.2f kbps out  %.2f kbps in   Packets: %.2f pps out  %.2f pps in   "
+       "Loss: %.2f %%   Out of order: %.2f %%   Duplicates: %d   Jitter: %.2f ms   Input packets: %.2f bytes, %.2f redundant frames.\n",
+       _stats_avg.kbps_sent, _stats_avg.kbps_recv,
+       _stats_avg.pps_sent, _stats_avg.pps_recv,
+       _stats_avg.packet_loss, _stats_avg.out_of_order, _stats_window.duplicates, _stats_avg.jitter,
+       _stats_avg.input_packet_size, _stats_avg.redundant_frames);
+
+   memset(&_stats_window, 0, sizeof _stats_window);
+   _stats_start_time = now;
 }
 
 
@@ -386,13 +779,14 @@ void
 UdpProtocol::QueueEvent(const UdpProtocol::Event &evt)
 {
    LogEvent("Queuing event", evt);
-   _event_queue.push(evt);
+   bool queued = _event_queue.push(evt);
+   ASSERT(queued);
 }
 
 void
 UdpProtocol::Synchronize()
 {
-   if (_udp) {
+   if (_transport) {
       _current_state = Syncing;
       _state.sync.roundtrips_remaining = NUM_SYNC_PACKETS;
       SendSyncRequest();
@@ -446,9 +840,18 @@ UdpProtocol::LogMsg(const char *prefix, UdpMsg *msg)
    case UdpMsg::Input:
       Log("%s game-compressed-input %d (+ %d bits).\n", prefix, msg->u.input.start_frame, msg->u.input.num_bits);
       break;
+   case UdpMsg::InputNack:
+      Log("%s input-nack (ack %d, seq %d).\n", prefix, msg->u.input_nack.ack_frame, msg->u.input_nack.recv_seq);
+      break;
    case UdpMsg::InputAck:
       Log("%s input ack.\n", prefix);
       break;
+   case UdpMsg::CompactInput:
+      Log("%s compact-input (ack %d, %d bytes).\n", prefix, msg->u.compact_input.ack_frame, msg->u.compact_input.data_len);
+      break;
+   case UdpMsg::InputParity:
+      Log("%s input-parity (seq %d, mask %04x).\n", prefix, msg->u.input_parity.first_seq, msg->u.input_parity.seq_mask);
+      break;
    default:
       ASSERT(false && "Unknown UdpMsg type.");
    }
@@ -479,8 +882,15 @@ UdpProtocol::OnSyncRequest(UdpMsg *msg, int len)
            msg->hdr.magic, _remote_magic_number);
       return false;
    }
-   UdpMsg *reply = new UdpMsg(UdpMsg::SyncReply);
+   if (len >= msg->PacketSize()) {
+      _remote_capabilities = msg->u.sync_request.capabilities;
+      _remote_input_size = msg->u.sync_request.input_size;
+   }
+
+   UdpMsg *reply = _msg_pool.Alloc(UdpMsg::SyncReply);
    reply->u.sync_reply.random_reply = msg->u.sync_request.random_request;
+   reply->u.sync_reply.capabilities = _capabilities;
+   reply->u.sync_reply.input_size = (uint8)_input_size;
    SendMsg(reply);
    return true;
 }
@@ -499,6 +909,18 @@ UdpProtocol::OnSyncReply(UdpMsg *msg, int len)
       return false;
    }
 
+   /*
+    * Every retry picks a new random, so this can only be the reply to the
+    * latest request.
+    */
+   OnRttSample(Platform::GetCurrentTimeMS() - _state.sync.request_time);
+   _retry_backoff = 0;
+
+   if (len >= msg->PacketSize()) {
+      _remote_capabilities = msg->u.sync_reply.capabilities;
+      _remote_input_size = msg->u.sync_reply.input_size;
+   }
+
    if (!_connected) {
       QueueEvent(Event(Event::Connected));
       _connected = true;
@@ -509,6 +931,7 @@ UdpProtocol::OnSyncReply(UdpMsg *msg, int len)
       ::Log(EGGPOLogVerbosity::Info, "Synchronized!\n");
       QueueEvent(UdpProtocol::Event(UdpProtocol::Event::Synchronzied));
       _current_state = Running;
+      memset(&_state.running, 0, sizeof _state.running);
       _last_received_input.frame = -1;
       _remote_magic_number = msg->hdr.magic;
    } else {
@@ -529,105 +952,401 @@ UdpProtocol::OnInput(UdpMsg *msg, int len)
     */
    bool disconnect_requested = msg->u.input.disconnect_requested;
    if (disconnect_requested) {
-      if (_current_state != Disconnected && !_disconnect_event_sent) {
-         ::Log(EGGPOLogVerbosity::Info, "Disconnecting endpoint on remote request.\n");
-         QueueEvent(Event(Event::Disconnected));
-         _disconnect_event_sent = true;
-      }
+      OnDisconnectRequested();
    } else {
-      /*
-       * Update the peer connection status if this peer is still considered to be part
-       * of the network.
-       */
-      UdpMsg::connect_status* remote_status = msg->u.input.peer_connect_status;
-      for (int i = 0; i < ARRAY_SIZE(_peer_connect_status); i++) {
-         ASSERT(remote_status[i].last_frame >= _peer_connect_status[i].last_frame);
-         _peer_connect_status[i].disconnected = _peer_connect_status[i].disconnected || remote_status[i].disconnected;
-         _peer_connect_status[i].last_frame = MAX(_peer_connect_status[i].last_frame, remote_status[i].last_frame);
-      }
+      UpdatePeerConnectStatus(msg->u.input.peer_connect_status);
    }
 
    /*
     * Decompress the input.
     */
-   int last_received_frame_number = _last_received_input.frame;
-   if (msg->u.input.num_bits) {
-      int offset = 0;
-      uint8 *bits = (uint8 *)msg->u.input.bits;
-      int numBits = msg->u.input.num_bits;
-      int currentFrame = msg->u.input.start_frame;
+   int num_bits = msg->u.input.num_bits;
+   int header = (int)((char *)msg->u.input.bits - (char *)msg);
+   if (num_bits > MAX_COMPRESSED_BITS || (num_bits + 7) / 8 > len - header ||
+       msg->u.input.input_size > GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS) {
+      Log("dropping input with %d bits in a %d byte packet.\n", num_bits, len);
+      return false;
+   }
+   if (num_bits) {
+      bool bit_vector = msg->u.input.bit_vector || !UseCapability(UdpMsg::InputXorCodec);
+      if (!DecodeInput(msg->u.input.start_frame, msg->u.input.input_size, msg->u.input.bits, num_bits, bit_vector)) {
+         return false;
+      }
+   }
+
+   /*
+    * Get rid of our buffered input
+    */
+   AckPendingOutput(msg->u.input.ack_frame);
+   return true;
+}
+
+bool
+UdpProtocol::OnCompactInput(UdpMsg *msg, int len)
+{
+   uint8 *data = msg->u.compact_input.data;
+   int data_len = msg->u.compact_input.data_len;
+   int flags = msg->u.compact_input.flags;
+   int offset = 0;
+   uint32 value;
+
+   /*
+    * Nothing in data is trusted: a packet that runs past itself or past a
+    * varint is dropped rather than decoded.
+    */
+   int header = (int)((char *)data - (char *)msg);
+   if (data_len > ARRAY_SIZE(msg->u.compact_input.data) || data_len > len - header) {
+      Log("dropping compact input with %d bytes of data in a %d byte packet.\n", data_len, len);
+      return false;
+   }
+
+   /*
+    * The remote end has acked something between our last acked frame and
+    * our last sent one, which is much closer than 2^15 frames.
+    */
+   int ack_frame = _last_acked_input.frame + 1;
+   ack_frame += (int16)(msg->u.compact_input.ack_frame - (uint16)ack_frame);
 
-      _last_received_input.size = msg->u.input.input_size;
-      if (_last_received_input.frame < 0) {
-         _last_received_input.frame = msg->u.input.start_frame - 1;
+   if (flags & UdpMsg::HasConnectStatus) {
+      UdpMsg::connect_status remote_status[UDP_MSG_MAX_PLAYERS];
+      if (offset >= data_len) {
+         return false;
       }
-      while (offset < numBits) {
-         /*
-          * Keep walking through the frames (parsing bits) until we reach
-          * the inputs for the frame right after the one we're on.
-          */
-         ASSERT(currentFrame <= (_last_received_input.frame + 1));
-         bool useInputs = currentFrame == _last_received_input.frame + 1;
-
-         while (BitVector_ReadBit(bits, &offset)) {
-            int on = BitVector_ReadBit(bits, &offset);
-            int button = BitVector_ReadNibblet(bits, &offset);
-            if (useInputs) {
-               if (on) {
-                  _last_received_input.set(button);
-               } else {
-                  _last_received_input.clear(button);
-               }
+      uint8 present = data[offset++];
+      for (int i = 0; i < UDP_MSG_MAX_PLAYERS; i++) {
+         remote_status[i].disconnected = (present >> (4 + i)) & 1;
+         remote_status[i].last_frame = -1;
+         if (present & (1 << i)) {
+            if (!ReadVarint(data, data_len, &offset, &value)) {
+               return false;
             }
+            remote_status[i].last_frame = ack_frame + UnZigZag(value);
+         }
+         if (remote_status[i].last_frame < _peer_connect_status[i].last_frame) {
+            Log("ignoring connect status for %d that went backwards.\n", i);
+            remote_status[i].last_frame = _peer_connect_status[i].last_frame;
          }
-         ASSERT(offset <= numBits);
+      }
+      if (!(flags & UdpMsg::DisconnectRequested)) {
+         UpdatePeerConnectStatus(remote_status);
+      }
+   }
+   if (flags & UdpMsg::DisconnectRequested) {
+      OnDisconnectRequested();
+   }
 
-         /*
-          * Now if we want to use these inputs, go ahead and send them to
-          * the emulator.
-          */
-         if (useInputs) {
-            /*
-             * Move forward 1 frame in the stream.
-             */
-            char desc[1024];
-            ASSERT(currentFrame == _last_received_input.frame + 1);
-            _last_received_input.frame = currentFrame;
+   if (flags & UdpMsg::HasInput) {
+      if (!ReadVarint(data, data_len, &offset, &value) || offset >= data_len) {
+         return false;
+      }
+      int start_frame = ack_frame + UnZigZag(value);
+      if (!DecodeInput(start_frame, _remote_input_size, data + offset, (data_len - offset) * 8,
+                       (flags & UdpMsg::BitVectorInput) != 0)) {
+         return false;
+      }
+   }
+
+   AckPendingOutput(ack_frame);
+   return true;
+}
+
+bool
+UdpProtocol::OnInputParity(UdpMsg *msg, int len)
+{
+   UdpMsg *recovered = _msg_pool.Alloc(UdpMsg::Input);
+   int recovered_len;
+
+   /*
+    * Every input packet repeats whatever unacked input the one before it
+    * had, so a rebuilt packet is only news if nothing newer got through.
+    */
+   if (_fec.Recover(msg, recovered, &recovered_len) && recovered->IsInput() &&
+       (_last_input_seq < 0 || (int16)(recovered->hdr.sequence_number - (uint16)_last_input_seq) > 0)) {
+      LogMsg("recovered", recovered);
+      _last_input_seq = recovered->hdr.sequence_number;
+      if (recovered->hdr.type == UdpMsg::CompactInput) {
+         OnCompactInput(recovered, recovered_len);
+      } else {
+         OnInput(recovered, recovered_len);
+      }
+   }
+   _msg_pool.Free(recovered);
+   return true;
+}
+
+void
+UdpProtocol::OnDisconnectRequested()
+{
+   if (_current_state != Disconnected && !_disconnect_event_sent) {
+      ::Log(EGGPOLogVerbosity::Info, "Disconnecting endpoint on remote request.\n");
+      QueueEvent(Event(Event::Disconnected));
+      _disconnect_event_sent = true;
+   }
+}
+
+/*
+ * Update the peer connection status if this peer is still considered to be part
+ * of the network.
+ */
+void
+UdpProtocol::UpdatePeerConnectStatus(UdpMsg::connect_status *remote_status)
+{
+   for (int i = 0; i < ARRAY_SIZE(_peer_connect_status); i++) {
+      ASSERT(remote_status[i].last_frame >= _peer_connect_status[i].last_frame);
+      _peer_connect_status[i].disconnected = _peer_connect_status[i].disconnected || remote_status[i].disconnected;
+      _peer_connect_status[i].last_frame = MAX(_peer_connect_status[i].last_frame, remote_status[i].last_frame);
+   }
+}
+
+/*
+ * Returns false if the input is malformed.  Any frames before the bad part
+ * have been queued by then.
+ */
+bool
+UdpProtocol::DecodeInput(int start_frame, int input_size, uint8 *bits, int num_bits, bool bit_vector)
+{
+   int last_received_frame_number = _last_received_input.frame;
+   bool ok;
 
-            /*
-             * Send the event to the emualtor
-             */
-            UdpProtocol::Event evt(UdpProtocol::Event::Input);
-            evt.u.input.input = _last_received_input;
+   if (last_received_frame_number >= 0 && start_frame > last_received_frame_number + 1) {
+      Log("dropping input starting at frame %d after a gap (last received %d).\n", start_frame, last_received_frame_number);
+      return false;
+   }
+   _last_received_input.size = input_size;
+   if (_last_received_input.frame < 0) {
+      _last_received_input.frame = start_frame - 1;
+   }
+   if (UseRangeCoder()) {
+      ok = DecodeRangeCoder(start_frame, bits, num_bits / 8);
+   } else if (!bit_vector) {
+      ok = DecodeInputCodec(start_frame, bits, num_bits / 8);
+   } else {
+      ok = DecodeBitVector(start_frame, bits, num_bits);
+   }
+   ASSERT(_last_received_input.frame >= last_received_frame_number);
+   if (!ok) {
+      Log("dropping the rest of a malformed input packet starting at frame %d.\n", start_frame);
+   }
 
-            _last_received_input.desc(desc, ARRAY_SIZE(desc));
+   /*
+    * Jitter is how much the arrival of each new frame wanders against the
+    * remote end's frame clock, smoothed as in RFC 3550.  Both ends run at
+    * the same rate, so our own frame period stands in for theirs.
+    */
+   int frame = _last_received_input.frame;
+   if (frame > last_received_frame_number) {
+      unsigned int now = Platform::GetCurrentTimeMS();
+      if (_jitter_frame >= 0) {
+         float d = (now - _jitter_time) - (frame - _jitter_frame) * _timesync.frame_period();
+         _stats_avg.jitter += (fabsf(d) - _stats_avg.jitter) / 16;
+      }
+      _jitter_time = now;
+      _jitter_frame = frame;
+   }
+   return ok;
+}
 
-            _state.running.last_input_packet_recv_time = Platform::GetCurrentTimeMS();
+bool
+UdpProtocol::DecodeBitVector(int start_frame, uint8 *bits, int numBits)
+{
+   int offset = 0;
+   int currentFrame = start_frame;
 
-            Log("Sending frame %d to emu queue %d (%s).\n", _last_received_input.frame, _queue, desc);
-            QueueEvent(evt);
+   while (offset < numBits) {
+      if (currentFrame - start_frame >= UDP_BUFFER_SIZE) {
+         return false;
+      }
+      /*
+       * Keep walking through the frames (parsing bits) until we reach
+       * the inputs for the frame right after the one we're on.
+       */
+      ASSERT(currentFrame <= (_last_received_input.frame + 1));
+      bool useInputs = currentFrame == _last_received_input.frame + 1;
 
-         } else {
-            Log("Skipping past frame:(%d) current is %d.\n", currentFrame, _last_received_input.frame);
+      for (;;) {
+         if (offset >= numBits) {
+            return false;
+         }
+         if (!BitVector_ReadBit(bits, &offset)) {
+            break;
          }
+         if (offset + 1 + BITVECTOR_NIBBLE_SIZE > numBits) {
+            return true;  /* padding; see EncodeSmallerCodec */
+         }
+         int on = BitVector_ReadBit(bits, &offset);
+         int button = BitVector_ReadNibblet(bits, &offset);
+         if (button >= _last_received_input.size * 8) {
+            return false;
+         }
+         if (useInputs) {
+            if (on) {
+               _last_received_input.set(button);
+            } else {
+               _last_received_input.clear(button);
+            }
+         }
+      }
+      ASSERT(offset <= numBits);
 
-         /*
-          * Move forward 1 frame in the input stream.
-          */
-         currentFrame++;
+      /*
+       * Now if we want to use these inputs, go ahead and send them to
+       * the emulator.
+       */
+      if (useInputs) {
+         QueueInput(currentFrame);
+      } else {
+         Log("Skipping past frame:(%d) current is %d.\n", currentFrame, _last_received_input.frame);
       }
+
+      /*
+       * Move forward 1 frame in the input stream.
+       */
+      currentFrame++;
    }
-   ASSERT(_last_received_input.frame >= last_received_frame_number);
+   return true;
+}
+
+bool
+UdpProtocol::DecodeInputCodec(int start_frame, uint8 *bits, int len)
+{
+   InputDecoder dec;
+   int currentFrame = start_frame;
 
    /*
-    * Get rid of our buffered input
+    * Each delta is against the frame before it, which we already have for
+    * every frame up to and including the first new one.
     */
-   while (_pending_output.size() && _pending_output.front().frame < msg->u.input.ack_frame) {
+   InputCodec_BeginDecode(&dec, bits, len);
+   for (;;) {
+      ASSERT(currentFrame <= (_last_received_input.frame + 1));
+      bool useInputs = currentFrame == _last_received_input.frame + 1;
+      if (currentFrame - start_frame >= UDP_BUFFER_SIZE) {
+         return false;
+      }
+      if (!InputCodec_DecodeFrame(&dec, &_last_received_input, useInputs)) {
+         break;
+      }
+      if (useInputs) {
+         QueueInput(currentFrame);
+      } else {
+         Log("Skipping past frame:(%d) current is %d.\n", currentFrame, _last_received_input.frame);
+      }
+      currentFrame++;
+   }
+   return !dec.failed;
+}
+
+bool
+UdpProtocol::DecodeRangeCoder(int start_frame, uint8 *bits, int len)
+{
+   RangeDecoder dec;
+   int currentFrame = start_frame;
+
+   /*
+    * The sender coded this packet with a model trained on every frame
+    * before start_frame.  Catch ours up to the same place.  If it's already
+    * past there, this packet is older than one we've decoded, and has
+    * nothing we don't already have.
+    */
+   while (_recv_model_pending.size() && _recv_model_pending.front().frame < currentFrame) {
+      RangeModel_Update(&_recv_model, _recv_model_input, _recv_model_pending.front());
+      _recv_model_input = _recv_model_pending.front();
+      _recv_model_pending.pop();
+   }
+   if (_recv_model_input.frame >= currentFrame) {
+      Log("Skipping input coded before frame %d (model is at %d).\n", currentFrame, _recv_model_input.frame);
+      return true;
+   }
+
+   if (!RangeCoder_BeginDecode(&dec, &_recv_model, bits, len)) {
+      return false;
+   }
+   for (;;) {
+      ASSERT(currentFrame <= (_last_received_input.frame + 1));
+      bool useInputs = currentFrame == _last_received_input.frame + 1;
+      if (currentFrame - start_frame >= UDP_BUFFER_SIZE || (useInputs && _recv_model_pending.full())) {
+         return false;
+      }
+      if (!RangeCoder_DecodeFrame(&dec, &_last_received_input, useInputs)) {
+         break;
+      }
+      if (useInputs) {
+         QueueInput(currentFrame);
+      } else {
+         Log("Skipping past frame:(%d) current is %d.\n", currentFrame, _last_received_input.frame);
+      }
+      currentFrame++;
+   }
+   return true;
+}
+
+/*
+ * Returns the fraction of the remote end's packets lost since the last
+ * call, in 256ths, from the gaps in their sequence numbers.
+ */
+uint8
+UdpProtocol::FractionLost()
+{
+   int lost = _recv_expected - _recv_packets;
+   int fraction = (_recv_expected > 0 && lost > 0) ? (lost * 256) / _recv_expected : 0;
+   _recv_expected = 0;
+   _recv_packets = 0;
+   return (uint8)MIN(fraction, 255);
+}
+
+/*
+ * Moves _last_received_input forward to frame and sends it to the emulator.
+ */
+void
+UdpProtocol::QueueInput(int frame)
+{
+   char desc[1024];
+   ASSERT(frame == _last_received_input.frame + 1);
+   _last_received_input.frame = frame;
+
+   UdpProtocol::Event evt(UdpProtocol::Event::Input);
+   evt.u.input.input = _last_received_input;
+
+   _last_received_input.desc(desc, ARRAY_SIZE(desc));
+
+   _state.running.last_input_packet_recv_time = Platform::GetCurrentTimeMS();
+   _retry_backoff = 0;
+
+   Log("Sending frame %d to emu queue %d (%s).\n", _last_received_input.frame, _queue, desc);
+   QueueEvent(evt);
+
+   if (UseRangeCoder()) {
+      _recv_model_pending.push(_last_received_input);
+   }
+}
+
+/*
+ * Drops pending output the remote end has acked, training the range coder's
+ * send model on it in order.
+ */
+void
+UdpProtocol::AckPendingOutput(int ack_frame)
+{
+   bool train = UseRangeCoder();
+
+   /*
+    * The remote end acks the newest frame it has, so the time since we
+    * first sent that frame is a round trip plus however long it held the
+    * ack for its next packet.
+    */
+   if (ack_frame > _rtt_ack_frame && ack_frame <= _last_sent_input.frame &&
+       ack_frame > _last_sent_input.frame - UDP_BUFFER_SIZE) {
+      OnRttSample(Platform::GetCurrentTimeMS() - _input_send_time[ack_frame % UDP_BUFFER_SIZE]);
+      _rtt_ack_frame = ack_frame;
+   }
+   while (_pending_output.size() && _pending_output.front().frame < ack_frame) {
       Log("Throwing away pending output frame %d\n", _pending_output.front().frame);
+      if (train) {
+         RangeModel_Update(&_send_model, _last_acked_input, _pending_output.front());
+      }
       _last_acked_input = _pending_output.front();
       _pending_output.pop();
    }
-   return true;
 }
 
 
@@ -637,10 +1356,24 @@ UdpProtocol::OnInputAck(UdpMsg *msg, int len)
    /*
     * Get rid of our buffered input
     */
-   while (_pending_output.size() && _pending_output.front().frame < msg->u.input_ack.ack_frame) {
-      Log("Throwing away pending output frame %d\n", _pending_output.front().frame);
-      _last_acked_input = _pending_output.front();
-      _pending_output.pop();
+   AckPendingOutput(msg->u.input_ack.ack_frame);
+   return true;
+}
+
+bool
+UdpProtocol::OnInputNack(UdpMsg *msg, int len)
+{
+   AckPendingOutput(msg->u.input_nack.ack_frame);
+
+   /*
+    * Only resend if no input packet has gone out since the one that showed
+    * the gap; any that has carries everything still pending.
+    */
+   int ack_frame = msg->u.input_nack.ack_frame;
+   if (_pending_output.size() && _pending_output.item(_pending_output.size() - 1).frame > ack_frame &&
+       _last_input_send_seq >= 0 && (int16)(msg->u.input_nack.recv_seq - (uint16)_last_input_send_seq) > 0) {
+      Log("Remote end is missing input after frame %d.  Resending.\n", ack_frame);
+      SendPendingOutput();
    }
    return true;
 }
@@ -649,11 +1382,14 @@ bool
 UdpProtocol::OnQualityReport(UdpMsg *msg, int len)
 {
    // send a reply so the other side can compute the round trip transmit time.
-   UdpMsg *reply = new UdpMsg(UdpMsg::QualityReply);
+   UdpMsg *reply = _msg_pool.Alloc(UdpMsg::QualityReply);
    reply->u.quality_reply.pong = msg->u.quality_report.ping;
    SendMsg(reply);
 
    _remote_frame_advantage = msg->u.quality_report.frame_advantage;
+   if (len >= msg->PacketSize()) {
+      _fec_group_size = FecGroupSize(msg->u.quality_report.fraction_lost);
+   }
    return true;
 }
 
@@ -661,9 +1397,36 @@ bool
 UdpProtocol::OnQualityReply(UdpMsg *msg, int len)
 {
    _round_trip_time = Platform::GetCurrentTimeMS() - msg->u.quality_reply.pong;
+   OnRttSample(_round_trip_time);
    return true;
 }
 
+void
+UdpProtocol::OnRttSample(int rtt)
+{
+   rtt = MAX(rtt, 1);
+   if (!_srtt) {
+      _srtt = rtt;
+      _rttvar = rtt / 2;
+   } else {
+      _rttvar = (3 * _rttvar + abs(_srtt - rtt)) / 4;
+      _srtt = (7 * _srtt + rtt) / 8;
+   }
+   _rto = _srtt + MAX(1, 4 * _rttvar);
+}
+
+/*
+ * How long to go without new input from the remote end before resending
+ * ours.  It can't drop below a couple of frames: a peer in step with us
+ * sends input once a frame, and resending between its packets would only
+ * duplicate what the next input packet is about to carry.
+ */
+unsigned int
+UdpProtocol::RetryInterval()
+{
+   return (unsigned int)MIN(MAX(_rto, MIN_RETRY_INTERVAL) << _retry_backoff, MAX_RETRY_INTERVAL);
+}
+
 bool
 UdpProtocol::OnKeepAlive(UdpMsg *msg, int len)
 {
@@ -675,7 +1438,15 @@ UdpProtocol::GetNetworkStats(struct FGGPONetworkStats *s)
 {
    s->network.ping = _round_trip_time;
    s->network.send_queue_len = _pending_output.size();
-   s->network.kbps_sent = _kbps_sent;
+   s->network.kbps_sent = (int)_stats_avg.kbps_sent;
+   s->network.kbps_received = (int)_stats_avg.kbps_recv;
+   s->network.packets_sent_per_second = (int)_stats_avg.pps_sent;
+   s->network.packets_received_per_second = (int)_stats_avg.pps_recv;
+   s->network.packet_loss = _stats_avg.packet_loss;
+   s->network.out_of_order = _stats_avg.out_of_order;
+   s->network.jitter = (int)_stats_avg.jitter;
+   s->network.avg_input_packet_size = (int)_stats_avg.input_packet_size;
+   s->network.redundant_frames = _stats_avg.redundant_frames;
    s->timesync.remote_frames_behind = _remote_frame_advantage;
    s->timesync.local_frames_behind = _local_frame_advantage;
 }
@@ -719,51 +1490,32 @@ UdpProtocol::SetDisconnectNotifyStart(int timeout)
    _disconnect_notify_start = timeout;
 }
 
+void
+UdpProtocol::SetExactConnectStatus(bool exact)
+{
+   _exact_connect_status = exact;
+}
+
 void
 UdpProtocol::PumpSendQueue()
 {
    while (!_send_queue.empty()) {
       QueueEntry &entry = _send_queue.front();
+      ASSERT(entry.dest_addr.sin_addr.s_addr);
 
-      if (_send_latency) {
-         // should really come up with a gaussian distributation based on the configured
-         // value, but this will do for now.
-         int jitter = (_send_latency * 2 / 3) + ((rand() % _send_latency) / 3);
-         if (Platform::GetCurrentTimeMS() < _send_queue.front().queue_time + jitter) {
-            break;
-         }
-      }
-      if (_oop_percent && !_oo_packet.msg && ((rand() % 100) < _oop_percent)) {
-         int delay = rand() % (_send_latency * 10 + 1000);
-         Log("creating rogue oop (seq: %d  delay: %d)\n", entry.msg->hdr.sequence_number, delay);
-         _oo_packet.send_time = Platform::GetCurrentTimeMS() + delay;
-         _oo_packet.msg = entry.msg;
-         _oo_packet.dest_addr = entry.dest_addr;
-      } else {
-         ASSERT(entry.dest_addr.sin_addr.s_addr);
-
-         _udp->SendTo((char *)entry.msg, entry.msg->PacketSize(), 0,
-                      (struct sockaddr *)&entry.dest_addr, sizeof entry.dest_addr);
+      _transport->SendTo((char *)entry.msg, entry.msg->PacketSize(), 0,
+                         (struct sockaddr *)&entry.dest_addr, sizeof entry.dest_addr);
 
-         delete entry.msg;
-      }
+      _msg_pool.Free(entry.msg);
       _send_queue.pop();
    }
-   if (_oo_packet.msg && _oo_packet.send_time < Platform::GetCurrentTimeMS()) {
-      Log("sending rogue oop!");
-      _udp->SendTo((char *)_oo_packet.msg, _oo_packet.msg->PacketSize(), 0,
-                     (struct sockaddr *)&_oo_packet.dest_addr, sizeof _oo_packet.dest_addr);
-
-      delete _oo_packet.msg;
-      _oo_packet.msg = NULL;
-   }
 }
 
 void
 UdpProtocol::ClearSendQueue()
 {
    while (!_send_queue.empty()) {
-      delete _send_queue.front().msg;
+      _msg_pool.Free(_send_queue.front().msg);
       _send_queue.pop();
    }
 }
@@ -11,10 +11,14 @@
 #include "../poll.h"
 #include "udp.h"
 #include "udp_msg.h"
+#include "udp_msg_pool.h"
+#include "udp_fec.h"
 #include "../game_input.h"
+#include "../range_coder.h"
 #include "../timesync.h"
 #include "include/ggponet.h"
 #include "../ring_buffer.h"
+#include "../spsc_ring.h"
 
 #define UDP_BUFFER_SIZE BUFFER_SIZE
 
@@ -65,15 +69,17 @@ public:
    UdpProtocol();
    virtual ~UdpProtocol();
 
-   void Init(Udp *udp, Poll &p, int queue, char *ip, u_short port, UdpMsg::connect_status *status);
+   void Init(Transport *transport, Poll &p, int queue, char *ip, u_short port, int input_size, UdpMsg::connect_status *status);
 
    void Synchronize();
    bool GetPeerConnectStatus(int id, int *frame);
-   bool IsInitialized() { return _udp != NULL; }
+   bool IsInitialized() { return _transport != NULL; }
+   sockaddr_in *GetPeerAddr() { return &_peer_addr; }
    bool IsSynchronized() { return _current_state == Running; }
    bool IsRunning() { return _current_state == Running; }
    void SendInput(GameInput &input);
    void SendInputAck();
+   void SendInputNack(uint16 recv_seq);
    bool IsPendingFull();
    bool HandlesMsg(sockaddr_in &from, UdpMsg *msg);
    void OnMsg(UdpMsg *msg, int len);
@@ -87,6 +93,13 @@ public:
    void SetDisconnectTimeout(int timeout);
    void SetDisconnectNotifyStart(int timeout);
 
+   /*
+    * With more than two players, peers work out which frames everyone has
+    * confirmed from the connect status we send them, so it has to be exact
+    * or they stall at the prediction barrier.
+    */
+   void SetExactConnectStatus(bool exact);
+
 protected:
    enum State {
       Syncing,
@@ -115,11 +128,39 @@ protected:
    void PumpSendQueue();
    void DispatchMsg(uint8 *buffer, int len);
    void SendPendingOutput();
+   void SendCompactInput();
+   bool ConnectStatusChanged();
+   int EncodeConnectStatus(uint8 *data, int offset, int capacity, int base);
+   int EncodeBitVector(uint8 *bits, int capacity, int frames);
+   int EncodeInputCodec(uint8 *out, int capacity, int *frames);
+   int EncodeSmallerCodec(uint8 *out, int capacity, bool pad, bool *bit_vector);
+   int EncodeRangeCoder(uint8 *out, int capacity);
+   bool DecodeInput(int start_frame, int input_size, uint8 *bits, int num_bits, bool bit_vector);
+   bool DecodeBitVector(int start_frame, uint8 *bits, int numBits);
+   bool DecodeInputCodec(int start_frame, uint8 *bits, int len);
+   bool DecodeRangeCoder(int start_frame, uint8 *bits, int len);
+   void OnDisconnectRequested();
+   UdpMsg *CloseFecGroup();
+   uint8 FractionLost();
+   void OnRttSample(int rtt);
+   unsigned int RetryInterval();
+   bool UseFec() { return _fec_enabled && _fec_group_size && UseCapability(UdpMsg::InputParityFec); }
+   void UpdatePeerConnectStatus(UdpMsg::connect_status *remote_status);
+   void QueueInput(int frame);
+   void AckPendingOutput(int ack_frame);
+   bool UseCapability(uint8 cap) { return (_capabilities & _remote_capabilities & cap) != 0; }
+   bool UseRangeCoder() {
+      return UseCapability(UdpMsg::InputRangeCoder) &&
+             ((_capabilities | _remote_capabilities) & UdpMsg::InputRangeCoderWanted) != 0;
+   }
    bool OnInvalid(UdpMsg *msg, int len);
    bool OnSyncRequest(UdpMsg *msg, int len);
    bool OnSyncReply(UdpMsg *msg, int len);
    bool OnInput(UdpMsg *msg, int len);
    bool OnInputAck(UdpMsg *msg, int len);
+   bool OnCompactInput(UdpMsg *msg, int len);
+   bool OnInputParity(UdpMsg *msg, int len);
+   bool OnInputNack(UdpMsg *msg, int len);
    bool OnQualityReport(UdpMsg *msg, int len);
    bool OnQualityReply(UdpMsg *msg, int len);
    bool OnKeepAlive(UdpMsg *msg, int len);
@@ -128,41 +169,90 @@ protected:
    /*
     * Network transmission information
     */
-   Udp            *_udp;
+   Transport      *_transport;
    sockaddr_in    _peer_addr; 
    uint16         _magic_number;
    int            _queue;
    uint16         _remote_magic_number;
    bool           _connected;
-   int            _send_latency;
-   int            _oop_percent;
-   struct {
-      int         send_time;
-      sockaddr_in dest_addr;
-      UdpMsg*     msg;
-   }              _oo_packet;
+   uint8          _capabilities;
+   uint8          _remote_capabilities;
+   int            _input_size;
+   int            _remote_input_size;
+   UdpMsgPool     _msg_pool;
    RingBuffer<QueueEntry, UDP_BUFFER_SIZE> _send_queue;
 
    /*
     * Stats
     */
    int            _round_trip_time;
+
+   /*
+    * Round trip estimate for our timers, as in RFC 6298, from sync replies,
+    * quality replies and acks of input frames.  _srtt is 0 until the first
+    * sample.  _retry_backoff doubles the retry interval for each retry
+    * that goes unanswered.
+    */
+   int            _srtt;
+   int            _rttvar;
+   int            _rto;
+   int            _retry_backoff;
+   int            _rtt_ack_frame;
+   unsigned int   _input_send_time[UDP_BUFFER_SIZE];
    int            _packets_sent;
    int            _bytes_sent;
-   int            _kbps_sent;
-   int            _stats_start_time;
+   unsigned int   _stats_start_time;
+   int            _stats_windows;
+
+   /*
+    * Counts since the last UpdateNetworkStats, and the moving averages
+    * it folds them into for GetNetworkStats.  Jitter is averaged as each
+    * new frame of input arrives instead, as in RFC 3550.
+    */
+   struct {
+      int         packets_sent;
+      int         bytes_sent;
+      int         packets_recv;
+      int         bytes_recv;
+      int         expected;
+      int         in_order;
+      int         out_of_order;
+      int         duplicates;
+      int         input_packets;
+      int         input_bytes;
+      int         redundant_frames;
+   } _stats_window;
+   struct {
+      float       kbps_sent;
+      float       kbps_recv;
+      float       pps_sent;
+      float       pps_recv;
+      float       packet_loss;
+      float       out_of_order;
+      float       input_packet_size;
+      float       redundant_frames;
+      float       jitter;
+   } _stats_avg;
+   unsigned int   _jitter_time;
+   int            _jitter_frame;
+   int            _recv_packets;
+   int            _recv_expected;
 
    /*
     * The state machine
     */
    UdpMsg::connect_status *_local_connect_status;
    UdpMsg::connect_status _peer_connect_status[UDP_MSG_MAX_PLAYERS];
+   UdpMsg::connect_status _last_sent_connect_status[UDP_MSG_MAX_PLAYERS];
+   int                    _connect_status_resend_frame;
+   bool                   _exact_connect_status;
 
    State          _current_state;
    union {
       struct {
          uint32   roundtrips_remaining;
          uint32   random;
+         uint32   request_time;
       } sync;
       struct {
          uint32   last_quality_report_time;
@@ -192,8 +282,30 @@ protected:
    unsigned int               _disconnect_notify_start;
    bool                       _disconnect_notify_sent;
 
+   /*
+    * Range coder models.  _send_model is trained on output as it's acked.
+    * _recv_model is trained on received input, but only once a packet shows
+    * that the sender has trained on it too, so _recv_model_pending holds
+    * what we've received since.
+    */
+   RangeModel                 _send_model;
+   RangeModel                 _recv_model;
+   GameInput                  _recv_model_input;
+   RingBuffer<GameInput, UDP_BUFFER_SIZE>  _recv_model_pending;
+
+   /*
+    * Forward error correction.  _fec_group_size is how many input packets
+    * each parity packet covers, picked from the loss the remote end
+    * reports; 0 means the link is clean enough to go without.
+    */
+   UdpFec                     _fec;
+   bool                       _fec_enabled;
+   int                        _fec_group_size;
+   int                        _last_input_seq;
+
    uint16                     _next_send_seq;
    uint16                     _next_recv_seq;
+   int                        _last_input_send_seq;
 
    /*
     * Rift synchronization.
@@ -201,9 +313,10 @@ protected:
    TimeSync                   _timesync;
 
    /*
-    * Event queue
+    * Event queue.  Events are queued wherever the protocol is pumped, which
+    * can be the session's network thread, and read by the game thread.
     */
-   RingBuffer<UdpProtocol::Event, UDP_BUFFER_SIZE>  _event_queue;
+   SpscRing<UdpProtocol::Event, UDP_BUFFER_SIZE>  _event_queue;
 };
 
 #endif
@@ -0,0 +1,278 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "udp_sim.h"
+#include <math.h>
+
+static const int UDP_SIM_HEADER_SIZE = 28;      /* IP + UDP, for the bandwidth cap */
+static const double PI = 3.14159265358979323846;
+
+static uint64
+SplitMix64(uint64 x)
+{
+   x += 0x9e3779b97f4a7c15ull;
+   x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+   x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+   return x ^ (x >> 31);
+}
+
+static void
+ConfigValue(const char *name, int *value)
+{
+   int v = Platform::GetConfigInt(name);
+   if (v) {
+      *value = v;
+   }
+}
+
+static void
+ConfigValue(const char *name, float *value)
+{
+   int v = Platform::GetConfigInt(name);
+   if (v) {
+      *value = (float)v;
+   }
+}
+
+UdpSim::UdpSim() :
+   _has_default(false),
+   _count(0),
+   _order(0)
+{
+   memset(&_default, 0, sizeof _default);
+   memset(_links, 0, sizeof _links);
+   _packets = new Packet[UDP_SIM_MAX_PACKETS];
+}
+
+UdpSim::~UdpSim()
+{
+   delete [] _packets;
+}
+
+bool
+UdpSim::GetConfigConditions(GGPONetworkConditions *conditions)
+{
+   GGPONetworkConditions none;
+   memset(&none, 0, sizeof none);
+   *conditions = none;
+
+   /*
+    * ggpo.network.delay used to mean a delay spread evenly between 2/3 and
+    * all of it, and ggpo.oop.percent a packet held back anywhere up to
+    * a second or so beyond that.
+    */
+   int delay = Platform::GetConfigInt("ggpo.network.delay");
+   int oop = Platform::GetConfigInt("ggpo.oop.percent");
+   conditions->latency = delay * 5 / 6;
+   conditions->jitter = delay / 10;
+   if (oop) {
+      conditions->reorder = (float)oop;
+      conditions->reorder_delay = delay * 5 + 500;
+   }
+
+   ConfigValue("ggpo.network.sim.latency", &conditions->latency);
+   ConfigValue("ggpo.network.sim.jitter", &conditions->jitter);
+   if (Platform::GetConfigBool("ggpo.network.sim.pareto")) {
+      conditions->distribution = EGGPOLatencyDistribution::PARETO;
+   }
+   ConfigValue("ggpo.network.sim.loss", &conditions->loss);
+   ConfigValue("ggpo.network.sim.burst_loss", &conditions->burst_loss);
+   ConfigValue("ggpo.network.sim.burst_start", &conditions->burst_start);
+   ConfigValue("ggpo.network.sim.burst_end", &conditions->burst_end);
+   ConfigValue("ggpo.network.sim.duplicate", &conditions->duplicate);
+   ConfigValue("ggpo.network.sim.reorder", &conditions->reorder);
+   ConfigValue("ggpo.network.sim.reorder_delay", &conditions->reorder_delay);
+   ConfigValue("ggpo.network.sim.bandwidth", &conditions->bandwidth);
+   ConfigValue("ggpo.network.sim.queue_limit", &conditions->queue_limit);
+   conditions->seed = (unsigned int)Platform::GetConfigInt("ggpo.network.sim.seed");
+
+   return memcmp(conditions, &none, sizeof none) != 0;
+}
+
+void
+UdpSim::SetConditions(sockaddr_in *peer, const GGPONetworkConditions *conditions)
+{
+   if (!peer) {
+      _has_default = conditions != NULL;
+      if (conditions) {
+         _default = *conditions;
+      }
+      memset(_links, 0, sizeof _links);
+      return;
+   }
+
+   Link *link = GetLink(peer, false);
+   if (link && !conditions) {
+      link->used = false;
+   } else if (conditions) {
+      if (!link) {
+         link = GetLink(peer, true);
+      }
+      if (link) {
+         ResetLink(link, peer, conditions, true);
+      }
+   }
+}
+
+/*
+ * Finds dst's link.  With create set, makes one if there's room, starting
+ * from the default conditions.
+ */
+UdpSim::Link *
+UdpSim::GetLink(sockaddr_in *dst, bool create)
+{
+   Link *unused = NULL;
+   for (int i = 0; i < MAX_UDP_ENDPOINTS; i++) {
+      Link *link = _links + i;
+      if (!link->used) {
+         unused = unused ? unused : link;
+      } else if (link->peer.sin_addr.s_addr == dst->sin_addr.s_addr && link->peer.sin_port == dst->sin_port) {
+         return link;
+      }
+   }
+   if (!create || !unused) {
+      return NULL;
+   }
+   ResetLink(unused, dst, &_default, false);
+   return unused;
+}
+
+void
+UdpSim::ResetLink(Link *link, sockaddr_in *peer, const GGPONetworkConditions *conditions, bool own)
+{
+   link->used = true;
+   link->own = own;
+   link->bad = false;
+   link->peer = *peer;
+   link->conditions = *conditions;
+   link->rng = SplitMix64(((uint64)conditions->seed << 32) ^ ((uint64)peer->sin_addr.s_addr << 16) ^ peer->sin_port);
+   link->free_time = 0;
+}
+
+/*
+ * xorshift64*, in [0, 1).
+ */
+double
+UdpSim::Uniform(Link *link)
+{
+   link->rng ^= link->rng >> 12;
+   link->rng ^= link->rng << 25;
+   link->rng ^= link->rng >> 27;
+   return ((link->rng * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool
+UdpSim::Chance(Link *link, float percent)
+{
+   return percent > 0 && Uniform(link) * 100 < percent;
+}
+
+double
+UdpSim::SampleLatency(Link *link)
+{
+   GGPONetworkConditions &c = link->conditions;
+   double latency = c.latency;
+
+   if (c.jitter > 0) {
+      if (c.distribution == EGGPOLatencyDistribution::PARETO) {
+         /*
+          * A Pareto distribution of shape 3 has a mean of 1.5 times its
+          * scale and a standard deviation of sqrt(3) / 2 times it.
+          */
+         double scale = c.jitter * 2 / sqrt(3.0);
+         latency += scale / pow(1 - Uniform(link), 1 / 3.0) - scale * 1.5;
+      } else {
+         double u = 1 - Uniform(link);
+         latency += c.jitter * sqrt(-2 * log(u)) * cos(2 * PI * Uniform(link));
+      }
+   }
+   return MAX(latency, 0.0);
+}
+
+bool
+UdpSim::Send(char *buffer, int len, sockaddr_in *dst)
+{
+   Link *link = GetLink(dst, _has_default);
+   if (!link) {
+      return false;
+   }
+   GGPONetworkConditions &c = link->conditions;
+   unsigned int now = Platform::GetCurrentTimeMS();
+
+   /*
+    * Gilbert-Elliott: the link may change state with each packet, then
+    * loses it at the rate for the state it's in.
+    */
+   if (link->bad) {
+      link->bad = !Chance(link, c.burst_end);
+   } else {
+      link->bad = Chance(link, c.burst_start);
+   }
+   if (Chance(link, link->bad ? c.burst_loss : c.loss)) {
+      ::Log(EGGPOLogVerbosity::VeryVerbose, "udp sim | losing packet of length %d.\n", len);
+      return true;
+   }
+
+   /*
+    * At a bandwidth cap, packets leave one after another once the link is
+    * free, and are dropped if too much is already waiting.
+    */
+   double start = MAX((double)now, link->free_time);
+   if (c.bandwidth > 0) {
+      int limit = c.queue_limit > 0 ? c.queue_limit : UDP_SIM_QUEUE_LIMIT;
+      if ((start - now) * c.bandwidth / 8 > limit) {
+         ::Log(EGGPOLogVerbosity::VeryVerbose, "udp sim | queue full, dropping packet of length %d.\n", len);
+         return true;
+      }
+      link->free_time = start + (len + UDP_SIM_HEADER_SIZE) * 8.0 / c.bandwidth;
+      start = link->free_time;
+   }
+
+   int copies = Chance(link, c.duplicate) ? 2 : 1;
+   for (int i = 0; i < copies; i++) {
+      if (_count == UDP_SIM_MAX_PACKETS) {
+         ::Log(EGGPOLogVerbosity::Info, "udp sim | too many packets in flight, dropping one.\n");
+         break;
+      }
+      double due = start + SampleLatency(link);
+      if (Chance(link, c.reorder)) {
+         due += c.reorder_delay;
+      }
+      Packet *packet = _packets + _count++;
+      packet->due = (unsigned int)(due + 0.5);
+      packet->order = _order++;
+      packet->len = len;
+      packet->dst = *dst;
+      memcpy(packet->data, buffer, len);
+   }
+   return true;
+}
+
+UdpSim::Packet *
+UdpSim::NextDue(unsigned int now)
+{
+   Packet *next = NULL;
+   for (int i = 0; i < _count; i++) {
+      Packet *packet = _packets + i;
+      if ((int)(packet->due - now) <= 0 &&
+          (!next || (int)(packet->due - next->due) < 0 ||
+           (packet->due == next->due && (int)(packet->order - next->order) < 0))) {
+         next = packet;
+      }
+   }
+   return next;
+}
+
+void
+UdpSim::Pop(Packet *packet)
+{
+   ASSERT(packet >= _packets && packet < _packets + _count);
+   Packet *last = _packets + --_count;
+   if (packet != last) {
+      *packet = *last;
+   }
+}
@@ -0,0 +1,98 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _UDP_SIM_H
+#define _UDP_SIM_H
+
+#include "../types.h"
+#include "include/ggponet.h"
+#include "udp.h"
+
+#define UDP_SIM_MAX_PACKETS         512
+#define UDP_SIM_QUEUE_LIMIT         (64 * 1024)
+
+/*
+ * UdpSim --
+ *
+ * Makes the network look worse than it is, for testing.  Udp hands Send
+ * every packet bound for a destination with conditions set, and Send
+ * decides whether it is lost, how many copies go out and when each is due.
+ * Udp then sends them for real as NextDue turns them up.
+ *
+ * Each destination has its own link state: the Gilbert-Elliott good/bad
+ * state, the time its bandwidth cap frees up, and a random number generator
+ * seeded from the conditions and the address, so that the same seed and the
+ * same traffic always give the same run.  Destinations without conditions
+ * of their own use the default ones, if any.
+ */
+class UdpSim {
+public:
+   struct Packet {
+      unsigned int   due;
+      unsigned int   order;
+      int            len;
+      sockaddr_in    dst;
+      uint8          data[MAX_UDP_PACKET_SIZE];
+   };
+
+public:
+   UdpSim();
+   ~UdpSim();
+
+   /*
+    * Fills in conditions from the config settings, returning false if none
+    * are set.
+    */
+   static bool GetConfigConditions(GGPONetworkConditions *conditions);
+
+   /*
+    * Sets the conditions for packets to peer, or the default ones if peer
+    * is NULL, which also throws away every destination's own.  NULL
+    * conditions go back to a perfect link (or the default, for a peer).
+    */
+   void SetConditions(sockaddr_in *peer, const GGPONetworkConditions *conditions);
+
+   /*
+    * Returns false, without taking the packet, if dst has no conditions.
+    */
+   bool Send(char *buffer, int len, sockaddr_in *dst);
+
+   /*
+    * Returns the next packet due by now, in the order they fell due, or
+    * NULL.  Call Pop once it has been sent.
+    */
+   Packet *NextDue(unsigned int now);
+   void Pop(Packet *packet);
+
+protected:
+   struct Link {
+      bool                    used;
+      bool                    own;        /* set for this peer, not the default */
+      bool                    bad;
+      sockaddr_in             peer;
+      GGPONetworkConditions   conditions;
+      uint64                  rng;
+      double                  free_time;
+   };
+
+   Link *GetLink(sockaddr_in *dst, bool create);
+   void ResetLink(Link *link, sockaddr_in *peer, const GGPONetworkConditions *conditions, bool own);
+   double Uniform(Link *link);
+   bool Chance(Link *link, float percent);
+   double SampleLatency(Link *link);
+
+protected:
+   bool           _has_default;
+   GGPONetworkConditions   _default;
+   Link           _links[MAX_UDP_ENDPOINTS];
+
+   Packet         *_packets;
+   int            _count;
+   unsigned int   _order;
+};
+
+#endif
@@ -0,0 +1,378 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "udp_uring.h"
+#include "../types.h"
+
+#if defined(UDP_IO_URING)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static const int RECV_BUFFER_SIZE = sizeof(struct io_uring_recvmsg_out) + sizeof(sockaddr_in) + MAX_UDP_PACKET_SIZE;
+static const int RECV_BUFFER_GROUP = 0;
+static const uint64 RECV_USER_DATA = ~0ULL;
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+   return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+   return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+   return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+UdpUring *
+UdpUring::Create(SOCKET s)
+{
+   UdpUring *uring = new UdpUring(s);
+   if (!uring->Init()) {
+      delete uring;
+      return NULL;
+   }
+   return uring;
+}
+
+UdpUring::UdpUring(SOCKET s) :
+   _socket(s),
+   _ring_fd(-1),
+   _ring_mem(MAP_FAILED),
+   _ring_size(0),
+   _sqes((struct io_uring_sqe *)MAP_FAILED),
+   _sq_entries(0),
+   _sq_local_tail(0),
+   _sq_pending(0),
+   _buf_ring((struct io_uring_buf_ring *)MAP_FAILED),
+   _buf_tail(0),
+   _recv_bufs(NULL),
+   _recv_armed(false),
+   _send_slots(NULL),
+   _num_free_slots(0)
+{
+}
+
+UdpUring::~UdpUring()
+{
+   if (_ring_fd != -1) {
+      close(_ring_fd);
+   }
+   if (_sqes != MAP_FAILED) {
+      munmap(_sqes, _sq_entries * sizeof(struct io_uring_sqe));
+   }
+   if (_ring_mem != MAP_FAILED) {
+      munmap(_ring_mem, _ring_size);
+   }
+   if (_buf_ring != MAP_FAILED) {
+      munmap(_buf_ring, URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+   }
+   delete [] _recv_bufs;
+   delete [] _send_slots;
+}
+
+bool
+UdpUring::Init()
+{
+   struct io_uring_params params;
+   memset(&params, 0, sizeof params);
+
+   _ring_fd = io_uring_setup(URING_ENTRIES, &params);
+   if (_ring_fd < 0) {
+      Log(EGGPOLogVerbosity::Info, "io_uring_setup failed (errno: %d).\n", errno);
+      _ring_fd = -1;
+      return false;
+   }
+   if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+      Log(EGGPOLogVerbosity::Info, "kernel io_uring is too old.\n");
+      return false;
+   }
+
+   /*
+    * Map the queues.  With IORING_FEAT_SINGLE_MMAP the submission and
+    * completion rings share one mapping.
+    */
+   size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+   _ring_size = MAX(sq_size, cq_size);
+   _ring_mem = mmap(NULL, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+   if (_ring_mem == MAP_FAILED) {
+      return false;
+   }
+   _sq_entries = params.sq_entries;
+   _sqes = (struct io_uring_sqe *)mmap(NULL, _sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+   if (_sqes == MAP_FAILED) {
+      return false;
+   }
+
+   char *ring = (char *)_ring_mem;
+   _sq_head = (unsigned *)(ring + params.sq_off.head);
+   _sq_tail = (unsigned *)(ring + params.sq_off.tail);
+   _sq_array = (unsigned *)(ring + params.sq_off.array);
+   _sq_mask = *(unsigned *)(ring + params.sq_off.ring_mask);
+   _sq_local_tail = *_sq_tail;
+   _cq_head = (unsigned *)(ring + params.cq_off.head);
+   _cq_tail = (unsigned *)(ring + params.cq_off.tail);
+   _cq_mask = *(unsigned *)(ring + params.cq_off.ring_mask);
+   _cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+   /*
+    * Register the receive buffers.  The buffer ring has to be page aligned,
+    * hence the mmap.
+    */
+   _buf_ring = (struct io_uring_buf_ring *)mmap(NULL, URING_RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (_buf_ring == MAP_FAILED) {
+      return false;
+   }
+   struct io_uring_buf_reg reg;
+   memset(&reg, 0, sizeof reg);
+   reg.ring_addr = (uint64)_buf_ring;
+   reg.ring_entries = URING_RECV_BUFFERS;
+   reg.bgid = RECV_BUFFER_GROUP;
+   if (io_uring_register(_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+      Log(EGGPOLogVerbosity::Info, "kernel doesn't support provided buffer rings (errno: %d).\n", errno);
+      return false;
+   }
+   _recv_bufs = new uint8[URING_RECV_BUFFERS * RECV_BUFFER_SIZE];
+   for (int i = 0; i < URING_RECV_BUFFERS; i++) {
+      RecycleBuffer(i);
+   }
+
+   _send_slots = new SendSlot[URING_SEND_SLOTS];
+   for (int i = URING_SEND_SLOTS - 1; i >= 0; i--) {
+      _free_slots[_num_free_slots++] = i;
+   }
+
+   /*
+    * Only the sender's address and the payload come back; the rest of the
+    * msghdr is a template for the layout of each buffer.
+    */
+   memset(&_recv_msg, 0, sizeof _recv_msg);
+   _recv_msg.msg_namelen = sizeof(sockaddr_in);
+
+   /*
+    * Multishot recvmsg came in 6.0, a release after provided buffer rings.
+    * Older kernels fail it with EINVAL as soon as it is submitted, so check
+    * for that here rather than sit on a receive that never comes back.
+    */
+   PostRecv();
+   Submit();
+   if (_sq_pending) {
+      return false;
+   }
+   unsigned head = *_cq_head;
+   if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe *cqe = &_cqes[head & _cq_mask];
+      if (cqe->user_data == RECV_USER_DATA && cqe->res == -EINVAL) {
+         Log(EGGPOLogVerbosity::Info, "kernel doesn't support multishot recvmsg.\n");
+         return false;
+      }
+   }
+   Log(EGGPOLogVerbosity::Info, "using io_uring for socket I/O.\n");
+   return true;
+}
+
+struct io_uring_sqe *
+UdpUring::GetSqe()
+{
+   unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+   if (_sq_local_tail - head >= _sq_entries) {
+      return NULL;
+   }
+   unsigned index = _sq_local_tail & _sq_mask;
+   _sq_array[index] = index;
+   _sq_local_tail++;
+   _sq_pending++;
+
+   struct io_uring_sqe *sqe = &_sqes[index];
+   memset(sqe, 0, sizeof *sqe);
+   return sqe;
+}
+
+void
+UdpUring::Submit()
+{
+   if (!_sq_pending) {
+      return;
+   }
+   __atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+   int res = io_uring_enter(_ring_fd, _sq_pending, 0, 0);
+   if (res < 0) {
+      Log(EGGPOLogVerbosity::Info, "io_uring_enter failed (errno: %d).\n", errno);
+      return;
+   }
+   _sq_pending -= res;
+}
+
+void
+UdpUring::PostRecv()
+{
+   struct io_uring_sqe *sqe = GetSqe();
+   if (!sqe) {
+      Submit();
+      sqe = GetSqe();
+      if (!sqe) {
+         return;
+      }
+   }
+   sqe->opcode = IORING_OP_RECVMSG;
+   sqe->fd = _socket;
+   sqe->addr = (uint64)&_recv_msg;
+   sqe->len = 1;
+   sqe->ioprio = IORING_RECV_MULTISHOT;
+   sqe->flags = IOSQE_BUFFER_SELECT;
+   sqe->buf_group = RECV_BUFFER_GROUP;
+   sqe->user_data = RECV_USER_DATA;
+   _recv_armed = true;
+}
+
+void
+UdpUring::RecycleBuffer(int bid)
+{
+   /*
+    * Not _buf_ring->bufs: the kernel header declares it in a way that
+    * leaves it at the wrong offset when compiled as C++.
+    */
+   struct io_uring_buf *buf = (struct io_uring_buf *)_buf_ring + (_buf_tail & (URING_RECV_BUFFERS - 1));
+   buf->addr = (uint64)(_recv_bufs + bid * RECV_BUFFER_SIZE);
+   buf->len = RECV_BUFFER_SIZE;
+   buf->bid = (uint16)bid;
+   _buf_tail++;
+   __atomic_store_n(&_buf_ring->tail, _buf_tail, __ATOMIC_RELEASE);
+}
+
+void
+UdpUring::SendTo(char *buffer, int len, struct sockaddr *dst, int destlen)
+{
+   ASSERT(len <= MAX_UDP_PACKET_SIZE && destlen <= (int)sizeof(sockaddr_in));
+
+   /*
+    * Every slot still in flight means the kernel is falling behind; just
+    * send this one the old-fashioned way rather than block.
+    */
+   struct io_uring_sqe *sqe = NULL;
+   if (_num_free_slots) {
+      sqe = GetSqe();
+      if (!sqe) {
+         Submit();
+         sqe = GetSqe();
+      }
+   }
+   if (!sqe) {
+      if (sendto(_socket, buffer, len, 0, dst, destlen) == SOCKET_ERROR) {
+         Log(EGGPOLogVerbosity::Info, "unknown error in sendto (errno: %d).\n", errno);
+      }
+      return;
+   }
+
+   int i = _free_slots[--_num_free_slots];
+   SendSlot &slot = _send_slots[i];
+   memcpy(slot.buf, buffer, len);
+   memcpy(&slot.addr, dst, destlen);
+   slot.iov.iov_base = slot.buf;
+   slot.iov.iov_len = len;
+   memset(&slot.msg, 0, sizeof slot.msg);
+   slot.msg.msg_name = &slot.addr;
+   slot.msg.msg_namelen = destlen;
+   slot.msg.msg_iov = &slot.iov;
+   slot.msg.msg_iovlen = 1;
+
+   sqe->opcode = IORING_OP_SENDMSG;
+   sqe->fd = _socket;
+   sqe->addr = (uint64)&slot.msg;
+   sqe->len = 1;
+   sqe->user_data = i;
+}
+
+void
+UdpUring::Drain(Udp::Callbacks *callbacks)
+{
+   unsigned head = *_cq_head;
+   unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+
+   while (head != tail) {
+      struct io_uring_cqe *cqe = &_cqes[head & _cq_mask];
+      if (cqe->user_data == RECV_USER_DATA) {
+         OnRecv(cqe, callbacks);
+      } else {
+         if (cqe->res < 0) {
+            Log(EGGPOLogVerbosity::Info, "unknown error in sendmsg (errno: %d).\n", -cqe->res);
+         }
+         _free_slots[_num_free_slots++] = (int)cqe->user_data;
+      }
+      head++;
+      __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+      if (head == tail) {
+         tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+      }
+   }
+
+   /*
+    * The multishot receive stops when it runs out of buffers.  They've all
+    * been recycled by now, so start it again.
+    */
+   if (!_recv_armed) {
+      PostRecv();
+   }
+   Submit();
+}
+
+void
+UdpUring::OnRecv(struct io_uring_cqe *cqe, Udp::Callbacks *callbacks)
+{
+   if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      _recv_armed = false;
+   }
+   if (cqe->res < 0) {
+      if (cqe->res != -ENOBUFS) {
+         Log(EGGPOLogVerbosity::Info, "multishot recvmsg returned errno %d.\n", -cqe->res);
+      }
+      return;
+   }
+   if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+      return;
+   }
+
+   int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+   uint8 *buf = _recv_bufs + bid * RECV_BUFFER_SIZE;
+   struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+   sockaddr_in *from = (sockaddr_in *)(out + 1);
+   uint8 *payload = (uint8 *)(out + 1) + _recv_msg.msg_namelen + _recv_msg.msg_controllen;
+   int len = out->payloadlen;
+
+   if (len > 0 && !(out->flags & MSG_TRUNC)) {
+      char src_ip[1024];
+      Log(EGGPOLogVerbosity::VeryVerbose, "recvmsg returned (len:%d  from:%s:%d).\n", len, inet_ntop(AF_INET, (void*)&from->sin_addr, src_ip, ARRAY_SIZE(src_ip)), ntohs(from->sin_port) );
+      callbacks->OnMsg(*from, (UdpMsg *)payload, len);
+   }
+   RecycleBuffer(bid);
+}
+
+void
+UdpUring::Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...)
+{
+   char buf[1024];
+   size_t offset;
+   va_list args;
+
+   strcpy_s(buf, "udp uring | ");
+   offset = strlen(buf);
+   va_start(args, fmt);
+   vsnprintf(buf + offset, ARRAY_SIZE(buf) - offset - 1, fmt, args);
+   buf[ARRAY_SIZE(buf)-1] = '\0';
+   ::Log(Verbosity, "%s", buf);
+   va_end(args);
+}
+
+#endif
@@ -0,0 +1,99 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _UDP_URING_H
+#define _UDP_URING_H
+
+#include "udp.h"
+
+#if defined(UDP_IO_URING)
+
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES            128
+#define URING_RECV_BUFFERS       64       /* must be a power of 2 */
+#define URING_SEND_SLOTS         64
+
+/*
+ * UdpUring --
+ *
+ * Does Udp's socket I/O through io_uring.  A multishot recvmsg stays posted
+ * against a ring of provided buffers, so datagrams land without any syscall
+ * at all, and sends queued by SendTo all go to the kernel in the one
+ * io_uring_enter made by Submit.  Completions are reaped by Drain, which Poll
+ * calls whenever the ring's fd becomes readable.
+ */
+class UdpUring {
+public:
+   /*
+    * Returns NULL if the kernel doesn't support everything we need, in
+    * which case Udp should carry on with its own socket calls.
+    */
+   static UdpUring *Create(SOCKET s);
+   ~UdpUring();
+
+   int GetFd() { return _ring_fd; }
+   void SendTo(char *buffer, int len, struct sockaddr *dst, int destlen);
+   void Submit();
+   void Drain(Udp::Callbacks *callbacks);
+
+protected:
+   UdpUring(SOCKET s);
+   bool Init();
+   struct io_uring_sqe *GetSqe();
+   void PostRecv();
+   void RecycleBuffer(int bid);
+   void OnRecv(struct io_uring_cqe *cqe, Udp::Callbacks *callbacks);
+   void Log(EGGPOLogVerbosity Verbosity, const char *fmt, ...);
+
+protected:
+   SOCKET                  _socket;
+   int                     _ring_fd;
+
+   /*
+    * The submission and completion queues, shared with the kernel.
+    */
+   void                    *_ring_mem;
+   size_t                  _ring_size;
+   struct io_uring_sqe     *_sqes;
+   unsigned                *_sq_head;
+   unsigned                *_sq_tail;
+   unsigned                *_sq_array;
+   unsigned                _sq_mask;
+   unsigned                _sq_entries;
+   unsigned                _sq_local_tail;
+   unsigned                _sq_pending;
+   unsigned                *_cq_head;
+   unsigned                *_cq_tail;
+   unsigned                _cq_mask;
+   struct io_uring_cqe     *_cqes;
+
+   /*
+    * Receive buffers are handed to the kernel through _buf_ring.  Each one
+    * gets an io_uring_recvmsg_out header and the sender's address ahead of
+    * the payload.
+    */
+   struct io_uring_buf_ring *_buf_ring;
+   unsigned short          _buf_tail;
+   uint8                   *_recv_bufs;
+   struct msghdr           _recv_msg;
+   bool                    _recv_armed;
+
+   struct SendSlot {
+      struct msghdr        msg;
+      struct iovec         iov;
+      sockaddr_in          addr;
+      uint8                buf[MAX_UDP_PACKET_SIZE];
+   };
+   SendSlot                *_send_slots;
+   int                     _free_slots[URING_SEND_SLOTS];
+   int                     _num_free_slots;
+};
+
+#endif
+
+#endif
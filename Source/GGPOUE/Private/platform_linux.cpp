@@ -6,20 +6,313 @@
  */
 
 #ifdef __GNUC__
-#include "platform_linux.h"
+#include "types.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
 
-struct timespec start = { 0 }
+struct timespec start = { 0 };
 
 uint32 Platform::GetCurrentTimeMS() {
+    /*
+     * The clock starts at one second rather than zero, since UdpProtocol
+     * takes a time of 0 to mean it has never sent or received anything.
+     */
     if (start.tv_sec == 0 && start.tv_nsec == 0) {
         clock_gettime(CLOCK_MONOTONIC, &start);
-        return 0
+        start.tv_sec -= 1;
     }
     struct timespec current;
     clock_gettime(CLOCK_MONOTONIC, &current);
 
     return ((current.tv_sec - start.tv_sec) * 1000) +
-           ((current.tv_nsec  - start.tv_nsec ) / 1000000) +
+           ((current.tv_nsec  - start.tv_nsec ) / 1000000);
 }
 
+int
+Platform::GetConfigInt(const char* name)
+{
+   const char *value = getenv(name);
+   if (!value) {
+      return 0;
+   }
+   return atoi(value);
+}
+
+bool Platform::GetConfigBool(const char* name)
+{
+   const char *value = getenv(name);
+   if (!value) {
+      return false;
+   }
+   return atoi(value) != 0 || strcasecmp(value, "true") == 0;
+}
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#include <atomic>
+
+/*
+ * PAGEMAP_SCAN and asynchronous userfaultfd write-protect arrived in Linux
+ * 6.7.  Older headers lack them, but the ABI is fixed, so spell it out.
+ * The kernel we actually run on decides whether they work.
+ */
+#if !defined(PAGEMAP_SCAN)
+#define PAGE_IS_WRITTEN          (1 << 1)
+#define PM_SCAN_WP_MATCHING      (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC    (1 << 1)
+
+struct page_region {
+   uint64_t start;
+   uint64_t end;
+   uint64_t categories;
+};
+
+struct pm_scan_arg {
+   uint64_t size;
+   uint64_t flags;
+   uint64_t start;
+   uint64_t end;
+   uint64_t walk_end;
+   uint64_t vec;
+   uint64_t vec_len;
+   uint64_t max_pages;
+   uint64_t category_inverted;
+   uint64_t category_mask;
+   uint64_t category_anyof_mask;
+   uint64_t return_mask;
+};
+
+#define PAGEMAP_SCAN             _IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+#if !defined(UFFD_FEATURE_WP_ASYNC)
+#define UFFD_FEATURE_WP_UNPOPULATED    (1 << 13)
+#define UFFD_FEATURE_WP_ASYNC          (1 << 15)
+#endif
+
+#if !defined(UFFD_USER_MODE_ONLY)
+#define UFFD_USER_MODE_ONLY            1
+#endif
+
+/*
+ * Dirty page tracking for a registered state region.
+ *
+ * The preferred way is an asynchronous userfaultfd write-protect on just
+ * that range.  The kernel drops the protection itself on the first write
+ * to each page, without faulting to us, and PAGEMAP_SCAN both lists the
+ * written pages and protects them again.  Nothing outside the range is
+ * touched.
+ *
+ * Older kernels fall back to the soft-dirty bits.  Clearing those through
+ * clear_refs clears them for the whole process, which would hide writes
+ * from any other tracker, so only one tracker at a time may use them.
+ */
+struct Platform::DirtyPageTracker {
+   uintptr_t   start;
+   uintptr_t   end;
+   int         pagemap_fd;
+   int         uffd;             /* -1 when using soft-dirty bits */
+   int         clear_refs_fd;    /* -1 when using userfaultfd */
+};
+
+static std::atomic<bool> soft_dirty_in_use(false);
+
+static bool
+StartWriteProtect(Platform::DirtyPageTracker *tracker)
+{
+   int fd = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+   if (fd < 0) {
+      return false;
+   }
+
+   struct uffdio_api api = { 0 };
+   api.api = UFFD_API;
+   api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+   struct uffdio_register reg = { 0 };
+   reg.range.start = tracker->start;
+   reg.range.len = tracker->end - tracker->start;
+   reg.mode = UFFDIO_REGISTER_MODE_WP;
+   if (ioctl(fd, UFFDIO_API, &api) < 0 || ioctl(fd, UFFDIO_REGISTER, &reg) < 0) {
+      close(fd);
+      return false;
+   }
+   tracker->uffd = fd;
+   return true;
+}
+
+static bool
+StartSoftDirty(Platform::DirtyPageTracker *tracker)
+{
+   bool expected = false;
+   if (!soft_dirty_in_use.compare_exchange_strong(expected, true)) {
+      return false;
+   }
+   tracker->clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+   if (tracker->clear_refs_fd < 0) {
+      soft_dirty_in_use = false;
+      return false;
+   }
+   return true;
+}
+
+/*
+ * Fills dirty[] for the pages in [start, end), which must lie within the
+ * tracked range.
+ */
+static bool
+ScanDirtyPages(Platform::DirtyPageTracker *tracker, uintptr_t start, uintptr_t end, uint8 *dirty)
+{
+   uintptr_t page_size = (uintptr_t)Platform::GetPageSize();
+
+   if (tracker->uffd >= 0) {
+      struct page_region regions[64];
+      struct pm_scan_arg arg = { 0 };
+      arg.size = sizeof arg;
+      arg.start = start;
+      arg.end = end;
+      arg.vec = (uint64_t)(uintptr_t)regions;
+      arg.vec_len = ARRAY_SIZE(regions);
+      arg.category_mask = PAGE_IS_WRITTEN;
+      arg.return_mask = PAGE_IS_WRITTEN;
+
+      memset(dirty, 0, (end - start) / page_size);
+      while (arg.start < end) {
+         int count = ioctl(tracker->pagemap_fd, PAGEMAP_SCAN, &arg);
+         if (count < 0) {
+            return false;
+         }
+         for (int i = 0; i < count; i++) {
+            for (uintptr_t page = regions[i].start; page < regions[i].end; page += page_size) {
+               dirty[(page - start) / page_size] = 1;
+            }
+         }
+         arg.start = arg.walk_end;
+      }
+      return true;
+   }
+
+   /*
+    * Soft-dirty is bit 55 of each page's pagemap entry.
+    */
+   uint64 entries[512];
+   uint64 first = start / page_size;
+   uint64 last = end / page_size;
+   for (uint64 page = first; page < last; ) {
+      int count = (int)MIN(last - page, (uint64)ARRAY_SIZE(entries));
+      ssize_t want = count * sizeof(entries[0]);
+      if (pread(tracker->pagemap_fd, entries, want, (off_t)(page * sizeof(entries[0]))) != want) {
+         return false;
+      }
+      for (int i = 0; i < count; i++) {
+         dirty[page - first + i] = (entries[i] >> 55) & 1;
+      }
+      page += count;
+   }
+   return true;
+}
+
+Platform::DirtyPageTracker *
+Platform::StartDirtyPageTracking(void *base, int size)
+{
+   uintptr_t page_size = (uintptr_t)GetPageSize();
+   DirtyPageTracker *tracker = new DirtyPageTracker;
+
+   tracker->start = (uintptr_t)base & ~(page_size - 1);
+   tracker->end = ((uintptr_t)base + size + page_size - 1) & ~(page_size - 1);
+   tracker->uffd = -1;
+   tracker->clear_refs_fd = -1;
+   tracker->pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+   if (tracker->pagemap_fd < 0 || (!StartWriteProtect(tracker) && !StartSoftDirty(tracker))) {
+      StopDirtyPageTracking(tracker);
+      return NULL;
+   }
+
+   /*
+    * Make sure tracking actually works here before trusting it.  Writing
+    * the first byte of the region back unchanged must show up as dirty.
+    */
+   volatile byte *first = (volatile byte *)base;
+   uint8 probe = 0;
+   bool ok = ResetDirtyPages(tracker);
+   *first = *first;
+   if (!ok || !ScanDirtyPages(tracker, tracker->start, tracker->start + page_size, &probe) || !probe) {
+      StopDirtyPageTracking(tracker);
+      return NULL;
+   }
+   return tracker;
+}
+
+void
+Platform::StopDirtyPageTracking(DirtyPageTracker *tracker)
+{
+   if (tracker->uffd >= 0) {
+      struct uffdio_range range;
+      range.start = tracker->start;
+      range.len = tracker->end - tracker->start;
+      ioctl(tracker->uffd, UFFDIO_UNREGISTER, &range);
+      close(tracker->uffd);
+   }
+   if (tracker->clear_refs_fd >= 0) {
+      close(tracker->clear_refs_fd);
+      soft_dirty_in_use = false;
+   }
+   if (tracker->pagemap_fd >= 0) {
+      close(tracker->pagemap_fd);
+   }
+   delete tracker;
+}
+
+bool
+Platform::ResetDirtyPages(DirtyPageTracker *tracker)
+{
+   if (tracker->uffd >= 0) {
+      struct pm_scan_arg arg = { 0 };
+      arg.size = sizeof arg;
+      arg.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+      arg.start = tracker->start;
+      arg.end = tracker->end;
+      arg.category_mask = PAGE_IS_WRITTEN;
+      return ioctl(tracker->pagemap_fd, PAGEMAP_SCAN, &arg) >= 0;
+   }
+   return write(tracker->clear_refs_fd, "4", 1) == 1;
+}
+
+bool
+Platform::GetDirtyPages(DirtyPageTracker *tracker, uint8 *dirty)
+{
+   return ScanDirtyPages(tracker, tracker->start, tracker->end, dirty);
+}
+
+#else
+
+Platform::DirtyPageTracker *
+Platform::StartDirtyPageTracking(void *base, int size)
+{
+   return NULL;
+}
+
+void
+Platform::StopDirtyPageTracking(DirtyPageTracker *tracker)
+{
+}
+
+bool
+Platform::ResetDirtyPages(DirtyPageTracker *tracker)
+{
+   return false;
+}
+
+bool
+Platform::GetDirtyPages(DirtyPageTracker *tracker, uint8 *dirty)
+{
+   return false;
+}
+
+#endif
+
 #endif
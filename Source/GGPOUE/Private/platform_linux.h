@@ -14,15 +14,46 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * The network code is written against Winsock.  These cover the parts of
+ * it that BSD sockets spell differently.
+ */
+typedef int SOCKET;
+#define INVALID_SOCKET           (-1)
+#define SOCKET_ERROR             (-1)
+#define WSAEWOULDBLOCK           EWOULDBLOCK
+#define closesocket(s)           close(s)
+#define ioctlsocket(s, cmd, arg) ioctl(s, cmd, arg)
+#define WSAGetLastError()        errno
 
 class Platform {
 public:  // types
    typedef pid_t ProcessID;
+   struct DirtyPageTracker;
 
 public:  // functions
    static ProcessID GetProcessID() { return getpid(); }
    static void AssertFailed(char *msg) { }
    static uint32 GetCurrentTimeMS();
+   static int GetConfigInt(const char* name);
+   static bool GetConfigBool(const char* name);
+   static int GetPageSize() { return (int)sysconf(_SC_PAGESIZE); }
+
+   /*
+    * Tracks which pages of [base, base + size) are written.  dirty[] gets one
+    * entry per page, counted from the page boundary at or before base.
+    * StartDirtyPageTracking returns NULL where that isn't possible.
+    */
+   static DirtyPageTracker *StartDirtyPageTracking(void *base, int size);
+   static void StopDirtyPageTracking(DirtyPageTracker *tracker);
+   static bool ResetDirtyPages(DirtyPageTracker *tracker);
+   static bool GetDirtyPages(DirtyPageTracker *tracker, uint8 *dirty);
 };
 
 #endif
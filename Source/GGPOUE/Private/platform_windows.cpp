@@ -27,4 +27,12 @@ bool Platform::GetConfigBool(const char* name)
    return atoi(buf) != 0 || _stricmp(buf, "true") == 0;
 }
 
+int
+Platform::GetPageSize()
+{
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return (int)info.dwPageSize;
+}
+
 #endif
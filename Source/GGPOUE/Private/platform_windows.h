@@ -24,6 +24,7 @@
 class Platform {
 public:  // types
    typedef DWORD ProcessID;
+   struct DirtyPageTracker;
 
 public:  // functions
    static ProcessID GetProcessID() { return GetCurrentProcessId(); }
@@ -31,6 +32,11 @@ public:  // functions
    static uint32 GetCurrentTimeMS() { return timeGetTime(); }
    static int GetConfigInt(const char* name);
    static bool GetConfigBool(const char* name);
+   static int GetPageSize();
+   static DirtyPageTracker *StartDirtyPageTracking(void *base, int size) { return NULL; }
+   static void StopDirtyPageTracking(DirtyPageTracker *tracker) { }
+   static bool ResetDirtyPages(DirtyPageTracker *tracker) { return false; }
+   static bool GetDirtyPages(DirtyPageTracker *tracker, uint8 *dirty) { return false; }
 };
 
 // UE: disallow windows platform types
@@ -8,21 +8,60 @@
 #include "poll.h"
 #include "types.h"
 
+#if defined(POLL_EPOLL)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+/*
+ * epoll hands back the index of whatever became ready: handles are numbered
+ * from 0, periodic sinks from MAX_POLLABLE_HANDLES.
+ */
+static void
+EpollAdd(int epoll_fd, int fd, uint32 id)
+{
+   struct epoll_event ev;
+   memset(&ev, 0, sizeof ev);
+   ev.events = EPOLLIN;
+   ev.data.u32 = id;
+   if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      Log(EGGPOLogVerbosity::Info, "epoll_ctl failed to add fd %d (errno: %d).\n", fd, errno);
+   }
+}
+#endif
+
 Poll::Poll(void) :
    _handle_count(0),
    _start_time(0)
 {
+#if defined(POLL_EPOLL)
+   _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   ASSERT(_epoll_fd != -1);
+#else
    /*
     * Create a dummy handle to simplify things.
     */
    _handles[_handle_count++] = CreateEvent(NULL, true, false, NULL);
+#endif
+}
+
+Poll::~Poll(void)
+{
+#if defined(POLL_EPOLL)
+   for (int i = 0; i < _periodic_sinks.size(); i++) {
+      close(_periodic_sinks[i].timer_fd);
+   }
+   close(_epoll_fd);
+#endif
 }
 
 void
-Poll::RegisterHandle(IPollSink *sink, HANDLE h, void *cookie)
+Poll::RegisterHandle(IPollSink *sink, PollHandle h, void *cookie)
 {
    ASSERT(_handle_count < MAX_POLLABLE_HANDLES - 1);
 
+#if defined(POLL_EPOLL)
+   EpollAdd(_epoll_fd, h, _handle_count);
+#endif
    _handles[_handle_count] = h;
    _handle_sinks[_handle_count] = PollSinkCb(sink, cookie);
    _handle_count++;
@@ -39,10 +78,28 @@ Poll::RegisterLoop(IPollSink *sink, void *cookie)
 {
    _loop_sinks.push_back(PollSinkCb(sink, cookie));
 }
+
+void
+Poll::RegisterWait(IPollSink *sink, void *cookie)
+{
+   _wait_sinks.push_back(PollSinkCb(sink, cookie));
+}
 void
 Poll::RegisterPeriodic(IPollSink *sink, int interval, void *cookie)
 {
-   _periodic_sinks.push_back(PollPeriodicSinkCb(sink, cookie, interval));
+   PollPeriodicSinkCb cb(sink, cookie, interval);
+#if defined(POLL_EPOLL)
+   struct itimerspec spec;
+   spec.it_interval.tv_sec = interval / 1000;
+   spec.it_interval.tv_nsec = (interval % 1000) * 1000000;
+   spec.it_value = spec.it_interval;
+
+   cb.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   ASSERT(cb.timer_fd != -1);
+   timerfd_settime(cb.timer_fd, 0, &spec, NULL);
+   EpollAdd(_epoll_fd, cb.timer_fd, MAX_POLLABLE_HANDLES + _periodic_sinks.size());
+#endif
+   _periodic_sinks.push_back(cb);
 }
 
 void
@@ -62,13 +119,42 @@ Poll::Pump(int timeout)
    if (_start_time == 0) {
       _start_time = Platform::GetCurrentTimeMS();
    }
+#if defined(POLL_EPOLL)
+   /*
+    * The timerfds wake us for the periodic sinks, so there's no need to
+    * work out how long we may sleep.
+    */
+   struct epoll_event events[MAX_POLLABLE_HANDLES + MAX_PERIODIC_SINKS];
+   res = epoll_wait(_epoll_fd, events, ARRAY_SIZE(events), BeginWait(timeout));
+   EndWait(timeout);
+   int elapsed = Platform::GetCurrentTimeMS() - _start_time;
+
+   for (int e = 0; e < res; e++) {
+      i = (int)events[e].data.u32;
+      if (i < MAX_POLLABLE_HANDLES) {
+         finished = !_handle_sinks[i].sink->OnHandlePoll(_handle_sinks[i].cookie) || finished;
+      } else {
+         PollPeriodicSinkCb &cb = _periodic_sinks[i - MAX_POLLABLE_HANDLES];
+         uint64 expirations;
+         if (read(cb.timer_fd, &expirations, sizeof expirations) == sizeof expirations) {
+            cb.last_fired = (elapsed / cb.interval) * cb.interval;
+            finished = !cb.sink->OnPeriodicPoll(cb.cookie, cb.last_fired) || finished;
+         }
+      }
+   }
+   for (i = 0; i < _msg_sinks.size(); i++) {
+      PollSinkCb &cb = _msg_sinks[i];
+      finished = !cb.sink->OnMsgPoll(cb.cookie) || finished;
+   }
+#else
    int elapsed = Platform::GetCurrentTimeMS() - _start_time;
    int maxwait = ComputeWaitTime(elapsed);
    if (maxwait != INFINITE) {
       timeout = MIN(timeout, maxwait);
    }
 
-   res = WaitForMultipleObjects(_handle_count, _handles, false, timeout);
+   res = WaitForMultipleObjects(_handle_count, _handles, false, BeginWait(timeout));
+   EndWait(timeout);
    if (res >= WAIT_OBJECT_0 && res < WAIT_OBJECT_0 + _handle_count) {
       i = res - WAIT_OBJECT_0;
       finished = !_handle_sinks[i].sink->OnHandlePoll(_handle_sinks[i].cookie) || finished;
@@ -85,6 +171,7 @@ Poll::Pump(int timeout)
          finished = !cb.sink->OnPeriodicPoll(cb.cookie, cb.last_fired) || finished;
       }
    }
+#endif
 
    for (i = 0; i < _loop_sinks.size(); i++) {
       PollSinkCb &cb = _loop_sinks[i];
@@ -93,6 +180,58 @@ Poll::Pump(int timeout)
    return finished;
 }
 
+void
+Poll::Wait(int timeout)
+{
+#if defined(POLL_EPOLL)
+   struct epoll_event ev;
+   epoll_wait(_epoll_fd, &ev, 1, BeginWait(timeout));
+   EndWait(timeout);
+#else
+   if (_start_time == 0) {
+      _start_time = Platform::GetCurrentTimeMS();
+   }
+   int maxwait = ComputeWaitTime(Platform::GetCurrentTimeMS() - _start_time);
+   if (maxwait != INFINITE) {
+      timeout = MIN(timeout, maxwait);
+   }
+   WaitForMultipleObjects(_handle_count, _handles, false, BeginWait(timeout));
+   EndWait(timeout);
+#endif
+}
+
+/*
+ * Returns how long we may block: timeout, or 0 if a wait sink still has
+ * something to do.
+ */
+int
+Poll::BeginWait(int timeout)
+{
+   if (timeout == 0) {
+      return 0;
+   }
+   for (int i = 0; i < _wait_sinks.size(); i++) {
+      PollSinkCb &cb = _wait_sinks[i];
+      if (!cb.sink->OnWaitPoll(cb.cookie)) {
+         timeout = 0;
+      }
+   }
+   return timeout;
+}
+
+void
+Poll::EndWait(int timeout)
+{
+   if (timeout == 0) {
+      return;
+   }
+   for (int i = 0; i < _wait_sinks.size(); i++) {
+      PollSinkCb &cb = _wait_sinks[i];
+      cb.sink->OnWakePoll(cb.cookie);
+   }
+}
+
+#if !defined(POLL_EPOLL)
 int
 Poll::ComputeWaitTime(int elapsed)
 {
@@ -110,3 +249,4 @@ Poll::ComputeWaitTime(int elapsed)
    }
    return waitTime;
 }
+#endif
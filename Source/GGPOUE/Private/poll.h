@@ -11,6 +11,19 @@
 #include "static_buffer.h"
 
 #define MAX_POLLABLE_HANDLES     64
+#define MAX_PERIODIC_SINKS       16
+
+/*
+ * On Linux the sockets and periodic timers all go into one epoll set, so
+ * Pump can sleep until one of them is ready.  Handles there are file
+ * descriptors.
+ */
+#if defined(__linux__)
+#  define POLL_EPOLL
+typedef int PollHandle;
+#else
+typedef HANDLE PollHandle;
+#endif
 
 
 class IPollSink {
@@ -20,21 +33,38 @@ public:
    virtual bool OnMsgPoll(void *) { return true; }
    virtual bool OnPeriodicPoll(void *, int ) { return true; }
    virtual bool OnLoopPoll(void *) { return true; }
+
+   /*
+    * Wait sinks hear about it just before Pump or Wait blocks, and can
+    * return false to keep it from blocking at all, then again on waking.
+    */
+   virtual bool OnWaitPoll(void *) { return true; }
+   virtual void OnWakePoll(void *) { }
 };
 
 class Poll {
 public:
    Poll(void);
-   void RegisterHandle(IPollSink *sink, HANDLE h, void *cookie = NULL);
+   ~Poll(void);
+   void RegisterHandle(IPollSink *sink, PollHandle h, void *cookie = NULL);
    void RegisterMsgLoop(IPollSink *sink, void *cookie = NULL);
    void RegisterPeriodic(IPollSink *sink, int interval, void *cookie = NULL);
    void RegisterLoop(IPollSink *sink, void *cookie = NULL);
+   void RegisterWait(IPollSink *sink, void *cookie = NULL);
 
    void Run();
    bool Pump(int timeout);
 
+   /*
+    * Blocks until Pump would have something to do, or timeout ms pass,
+    * without calling any sinks.
+    */
+   void Wait(int timeout);
+
 protected:
    int ComputeWaitTime(int elapsed);
+   int BeginWait(int timeout);
+   void EndWait(int timeout);
 
    struct PollSinkCb {
       IPollSink   *sink;
@@ -46,19 +76,24 @@ protected:
    struct PollPeriodicSinkCb : public PollSinkCb {
       int         interval;
       int         last_fired;
-      PollPeriodicSinkCb() : PollSinkCb(NULL, NULL), interval(0), last_fired(0) { }
+      int         timer_fd;      /* only used with POLL_EPOLL */
+      PollPeriodicSinkCb() : PollSinkCb(NULL, NULL), interval(0), last_fired(0), timer_fd(-1) { }
       PollPeriodicSinkCb(IPollSink *s, void *c, int i) :
-         PollSinkCb(s, c), interval(i), last_fired(0) { }
+         PollSinkCb(s, c), interval(i), last_fired(0), timer_fd(-1) { }
    };
 
    int               _start_time;
    int               _handle_count;
-   HANDLE            _handles[MAX_POLLABLE_HANDLES];
+   PollHandle        _handles[MAX_POLLABLE_HANDLES];
    PollSinkCb        _handle_sinks[MAX_POLLABLE_HANDLES];
+#if defined(POLL_EPOLL)
+   int               _epoll_fd;
+#endif
 
    StaticBuffer<PollSinkCb, 16>          _msg_sinks;
    StaticBuffer<PollSinkCb, 16>          _loop_sinks;
-   StaticBuffer<PollPeriodicSinkCb, 16>  _periodic_sinks;
+   StaticBuffer<PollSinkCb, 16>          _wait_sinks;
+   StaticBuffer<PollPeriodicSinkCb, MAX_PERIODIC_SINKS>  _periodic_sinks;
 };
 
 #endif
@@ -0,0 +1,289 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "range_coder.h"
+#include "varint.h"
+#include <string.h>
+#include <limits.h>
+
+/*
+ * Probabilities are the 11-bit odds of a 0, as in LZMA's coder.  They never
+ * drift closer than 31/2048 to either end, so no bit costs more than about
+ * 6 bits to code.
+ */
+#define RANGE_PROB_BITS          11
+#define RANGE_PROB_ONE           (1 << RANGE_PROB_BITS)
+#define RANGE_MOVE_BITS          5
+#define RANGE_TOP                (1 << 24)
+#define RANGE_MAX_BITS_PER_BIT   7
+
+/*
+ * A flip is the exception, so start the bit models off expecting none.
+ */
+#define RANGE_FLIP_PRIOR         (RANGE_PROB_ONE - (RANGE_PROB_ONE / 32))
+
+/*
+ * The frame count goes in front of the coded frames once we know it.
+ */
+#define RANGE_COUNT_RESERVE      2
+
+static inline void
+AdaptBit(uint16 *prob, int bit)
+{
+   if (bit) {
+      *prob -= *prob >> RANGE_MOVE_BITS;
+   } else {
+      *prob += (RANGE_PROB_ONE - *prob) >> RANGE_MOVE_BITS;
+   }
+}
+
+static inline int
+LastFlip(const RangeModel *model, int i)
+{
+   return (model->last_flips[i / 8] >> (i % 8)) & 1;
+}
+
+static inline int
+XorFrames(const GameInput &prev, const GameInput &cur, uint8 *flips)
+{
+   int changed = 0;
+   memset(flips, 0, RANGE_CODER_MAX_BYTES);
+   for (int i = 0; i < cur.size; i++) {
+      flips[i] = (uint8)(cur.bits[i] ^ prev.bits[i]);
+      changed |= flips[i];
+   }
+   return changed != 0;
+}
+
+void
+RangeModel_Init(RangeModel *model)
+{
+   model->changed[0] = model->changed[1] = RANGE_PROB_ONE / 2;
+   for (int i = 0; i < RANGE_CODER_MAX_BITS; i++) {
+      model->flipped[i][0] = model->flipped[i][1] = RANGE_FLIP_PRIOR;
+   }
+   memset(model->last_flips, 0, sizeof(model->last_flips));
+   model->last_changed = 0;
+}
+
+/*
+ * Trains the model on cur exactly as coding it would have.
+ */
+void
+RangeModel_Update(RangeModel *model, const GameInput &prev, const GameInput &cur)
+{
+   uint8 flips[RANGE_CODER_MAX_BYTES];
+   int changed = XorFrames(prev, cur, flips);
+
+   AdaptBit(&model->changed[model->last_changed], changed);
+   if (changed) {
+      for (int i = 0; i < cur.size * 8; i++) {
+         AdaptBit(&model->flipped[i][LastFlip(model, i)], (flips[i / 8] >> (i % 8)) & 1);
+      }
+   }
+   memcpy(model->last_flips, flips, sizeof(flips));
+   model->last_changed = changed;
+}
+
+static void
+ShiftLow(RangeEncoder *enc)
+{
+   if ((uint32)enc->low < 0xFF000000 || (enc->low >> 32) != 0) {
+      uint8 carry = (uint8)(enc->low >> 32);
+      uint8 temp = enc->cache;
+      do {
+         /*
+          * The very first byte is always 0, so the decoder doesn't need it.
+          */
+         if (enc->first) {
+            ASSERT((uint8)(temp + carry) == 0);
+            enc->first = false;
+         } else {
+            enc->out[enc->offset++] = (uint8)(temp + carry);
+         }
+         temp = 0xFF;
+      } while (--enc->cache_size != 0);
+      enc->cache = (uint8)(enc->low >> 24);
+   }
+   enc->cache_size++;
+   enc->low = (enc->low & 0x00FFFFFF) << 8;
+}
+
+static inline void
+EncodeBit(RangeEncoder *enc, uint16 *prob, int bit)
+{
+   uint32 bound = (enc->range >> RANGE_PROB_BITS) * *prob;
+   if (bit) {
+      enc->low += bound;
+      enc->range -= bound;
+   } else {
+      enc->range = bound;
+   }
+   AdaptBit(prob, bit);
+   while (enc->range < RANGE_TOP) {
+      enc->range <<= 8;
+      ShiftLow(enc);
+   }
+}
+
+void
+RangeCoder_BeginEncode(RangeEncoder *enc, const RangeModel *model, uint8 *out, int capacity)
+{
+   enc->model = *model;
+   enc->out = out;
+   enc->capacity = capacity;
+   enc->offset = RANGE_COUNT_RESERVE;
+   enc->frames = 0;
+   enc->low = 0;
+   enc->range = 0xFFFFFFFF;
+   enc->cache = 0;
+   enc->cache_size = 1;
+   enc->first = true;
+}
+
+/*
+ * Appends cur to the stream.  Returns false, without touching the stream,
+ * if the frame might not fit.
+ */
+bool
+RangeCoder_EncodeFrame(RangeEncoder *enc, const GameInput &prev, const GameInput &cur)
+{
+   RangeModel *model = &enc->model;
+   uint8 flips[RANGE_CODER_MAX_BYTES];
+
+   /*
+    * Leave room for the bytes still held in the coder, the worst case for
+    * this frame, and the flush.
+    */
+   int worst = ((1 + cur.size * 8) * RANGE_MAX_BITS_PER_BIT + 7) / 8;
+   if (enc->offset + enc->cache_size + 4 + worst > enc->capacity) {
+      return false;
+   }
+
+   int changed = XorFrames(prev, cur, flips);
+   EncodeBit(enc, &model->changed[model->last_changed], changed);
+   if (changed) {
+      for (int i = 0; i < cur.size * 8; i++) {
+         EncodeBit(enc, &model->flipped[i][LastFlip(model, i)], (flips[i / 8] >> (i % 8)) & 1);
+      }
+   }
+   memcpy(model->last_flips, flips, sizeof(flips));
+   model->last_changed = changed;
+   enc->frames++;
+   return true;
+}
+
+/*
+ * Flushes the coder, puts the frame count in front, and returns the length
+ * of the stream.
+ */
+int
+RangeCoder_EndEncode(RangeEncoder *enc)
+{
+   /*
+    * Any value in [low, low + range) decodes the same, and the decoder reads
+    * zeros past the end of the stream.  range is at least RANGE_TOP, so
+    * rounding low up to a multiple of it leaves just one byte to flush,
+    * and any zeros at the end can go too.
+    */
+   enc->low = (enc->low + (RANGE_TOP - 1)) & ~(uint64)(RANGE_TOP - 1);
+   ShiftLow(enc);
+   ShiftLow(enc);
+   while (enc->offset > RANGE_COUNT_RESERVE && enc->out[enc->offset - 1] == 0) {
+      enc->offset--;
+   }
+
+   uint8 count[RANGE_COUNT_RESERVE];
+   int n = WriteVarint(count, 0, RANGE_COUNT_RESERVE, enc->frames);
+   ASSERT(n > 0);
+   memmove(enc->out + n, enc->out + RANGE_COUNT_RESERVE, enc->offset - RANGE_COUNT_RESERVE);
+   memcpy(enc->out, count, n);
+   return enc->offset - RANGE_COUNT_RESERVE + n;
+}
+
+static inline uint8
+NextByte(RangeDecoder *dec)
+{
+   return dec->offset < dec->len ? dec->in[dec->offset++] : 0;
+}
+
+static inline int
+DecodeBit(RangeDecoder *dec, uint16 *prob)
+{
+   int bit;
+   uint32 bound = (dec->range >> RANGE_PROB_BITS) * *prob;
+   if (dec->code < bound) {
+      dec->range = bound;
+      bit = 0;
+   } else {
+      dec->code -= bound;
+      dec->range -= bound;
+      bit = 1;
+   }
+   AdaptBit(prob, bit);
+   while (dec->range < RANGE_TOP) {
+      dec->range <<= 8;
+      dec->code = (dec->code << 8) | NextByte(dec);
+   }
+   return bit;
+}
+
+/*
+ * Returns false if the stream doesn't start with a frame count.
+ */
+bool
+RangeCoder_BeginDecode(RangeDecoder *dec, const RangeModel *model, const uint8 *in, int len)
+{
+   uint32 frames;
+
+   dec->model = *model;
+   dec->in = in;
+   dec->len = len;
+   dec->offset = 0;
+   if (!ReadVarint(in, len, &dec->offset, &frames) || frames > INT_MAX) {
+      return false;
+   }
+   dec->frames = (int)frames;
+   dec->range = 0xFFFFFFFF;
+   dec->code = 0;
+   for (int i = 0; i < 4; i++) {
+      dec->code = (dec->code << 8) | NextByte(dec);
+   }
+   return true;
+}
+
+/*
+ * Decodes the next frame and, if apply is set, XORs its changes into input.
+ * Returns false at the end of the stream.
+ */
+bool
+RangeCoder_DecodeFrame(RangeDecoder *dec, GameInput *input, bool apply)
+{
+   RangeModel *model = &dec->model;
+   uint8 flips[RANGE_CODER_MAX_BYTES];
+
+   if (dec->frames == 0) {
+      return false;
+   }
+   dec->frames--;
+
+   memset(flips, 0, sizeof(flips));
+   int changed = DecodeBit(dec, &model->changed[model->last_changed]);
+   if (changed) {
+      for (int i = 0; i < input->size * 8; i++) {
+         flips[i / 8] |= DecodeBit(dec, &model->flipped[i][LastFlip(model, i)]) << (i % 8);
+      }
+   }
+   if (apply) {
+      for (int i = 0; i < input->size; i++) {
+         input->bits[i] ^= flips[i];
+      }
+   }
+   memcpy(model->last_flips, flips, sizeof(flips));
+   model->last_changed = changed;
+   return true;
+}
@@ -0,0 +1,72 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _RANGE_CODER_H
+#define _RANGE_CODER_H
+
+#include "types.h"
+#include "game_input.h"
+
+#define RANGE_CODER_MAX_BYTES    (GAMEINPUT_MAX_BYTES * GAMEINPUT_MAX_PLAYERS)
+#define RANGE_CODER_MAX_BITS     (RANGE_CODER_MAX_BYTES * 8)
+
+/*
+ * Adaptive binary range coding for a run of consecutive input frames.
+ *
+ * For each frame we code whether anything changed since the previous frame
+ * and, if so, whether each bit flipped.  Every bit position has its own
+ * probability, so each player's buttons (which live at their own offsets in
+ * the input) are modelled separately, and every probability is split on
+ * whether the same thing happened in the frame before.
+ *
+ * Both ends must code every packet from an identical RangeModel.  The
+ * sender trains its model on frames as the remote end acks them, and the
+ * receiver trains on the same frames, in the same order, before decoding a
+ * packet that starts just past them.  Within a packet the coder adapts a
+ * private copy of the model as it goes.
+ */
+struct RangeModel {
+   uint16      changed[2];
+   uint16      flipped[RANGE_CODER_MAX_BITS][2];
+   uint8       last_flips[RANGE_CODER_MAX_BYTES];
+   int         last_changed;
+};
+
+struct RangeEncoder {
+   RangeModel  model;
+   uint8       *out;
+   int         capacity;
+   int         offset;
+   int         frames;
+   uint64      low;
+   uint32      range;
+   uint8       cache;
+   int         cache_size;
+   bool        first;
+};
+
+struct RangeDecoder {
+   RangeModel  model;
+   const uint8 *in;
+   int         len;
+   int         offset;
+   int         frames;
+   uint32      range;
+   uint32      code;
+};
+
+void RangeModel_Init(RangeModel *model);
+void RangeModel_Update(RangeModel *model, const GameInput &prev, const GameInput &cur);
+
+void RangeCoder_BeginEncode(RangeEncoder *enc, const RangeModel *model, uint8 *out, int capacity);
+bool RangeCoder_EncodeFrame(RangeEncoder *enc, const GameInput &prev, const GameInput &cur);
+int RangeCoder_EndEncode(RangeEncoder *enc);
+
+bool RangeCoder_BeginDecode(RangeDecoder *dec, const RangeModel *model, const uint8 *in, int len);
+bool RangeCoder_DecodeFrame(RangeDecoder *dec, GameInput *input, bool apply);
+
+#endif // _RANGE_CODER_H
@@ -0,0 +1,310 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "speculation.h"
+
+Speculator::Speculator(GGPOSessionCallbacks &callbacks,
+                       int num_players,
+                       int input_size,
+                       int max_frames,
+                       int num_branches,
+                       int num_threads) :
+   _callbacks(callbacks),
+   _num_players(num_players),
+   _input_size(input_size),
+   _max_frames(max_frames),
+   _num_branches(num_branches),
+   _branch_count(0),
+   _active(false),
+   _generation(0),
+   _start_frame(0),
+   _queue(0),
+   _num_frames(0),
+   _state_capacity(0),
+   _shutdown(false)
+{
+   _input_stride = num_players * input_size + sizeof(int);
+   _inputs = new byte[_max_frames * _input_stride];
+
+   _branches = new Branch[_num_branches];
+   for (int i = 0; i < _num_branches; i++) {
+      Branch *branch = _branches + i;
+      branch->candidate = new char[input_size];
+      branch->states = NULL;
+      branch->lens = new int[_max_frames + 1];
+      branch->frames_done = 0;
+      branch->busy = false;
+      branch->failed = false;
+   }
+
+   for (int i = 0; i < num_threads; i++) {
+      _threads.push_back(std::thread(&Speculator::Run, this));
+   }
+}
+
+Speculator::~Speculator()
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _shutdown = true;
+      _generation++;
+   }
+   _work.notify_all();
+   for (size_t i = 0; i < _threads.size(); i++) {
+      _threads[i].join();
+   }
+
+   for (int i = 0; i < _num_branches; i++) {
+      delete [] _branches[i].candidate;
+      delete [] _branches[i].states;
+      delete [] _branches[i].lens;
+   }
+   delete [] _branches;
+   delete [] _inputs;
+}
+
+void
+Speculator::Start(int frame, int queue, byte *state, int len, char *candidates, int count)
+{
+   Cancel();
+
+   std::lock_guard<std::mutex> lock(_mutex);
+   if (len > _state_capacity / 2) {
+      GrowStates(len);
+   }
+
+   Log("speculating on %d inputs for queue %d from frame %d.\n", count, queue, frame);
+   _start_frame = frame;
+   _queue = queue;
+   _num_frames = 0;
+   _branch_count = MIN(count, _num_branches);
+   for (int i = 0; i < _branch_count; i++) {
+      Branch *branch = _branches + i;
+      memcpy(branch->candidate, candidates + i * _input_size, _input_size);
+      memcpy(branch->states, state, len);
+      branch->lens[0] = len;
+      branch->frames_done = 0;
+      branch->failed = false;
+   }
+   _active = true;
+}
+
+/*
+ * Record the inputs the game used for the next frame of the timeline we're
+ * speculating on.  Returns false if the frame doesn't follow on from the
+ * last one, or if we're out of room.
+ */
+bool
+Speculator::AddFrame(int frame, void *inputs, int disconnect_flags)
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_active) {
+         return false;
+      }
+      int next = _start_frame + _num_frames;
+      if (frame != next) {
+         // The game may ask for the inputs of a frame more than once.
+         return frame < next;
+      }
+      if (_num_frames == _max_frames) {
+         return false;
+      }
+
+      byte *entry = _inputs + _num_frames * _input_stride;
+      memcpy(entry, inputs, _num_players * _input_size);
+      memcpy(entry + _num_players * _input_size, &disconnect_flags, sizeof(int));
+      _num_frames++;
+   }
+   _work.notify_all();
+   return true;
+}
+
+/*
+ * Stop speculating.  Waits for the workers to finish the frames they're in
+ * the middle of so the branch buffers can be reused.
+ */
+void
+Speculator::Cancel()
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   _generation++;
+   _active = false;
+   for (;;) {
+      bool busy = false;
+      for (int i = 0; i < _branch_count; i++) {
+         busy = busy || _branches[i].busy;
+      }
+      if (!busy) {
+         break;
+      }
+      _done.wait(lock);
+   }
+}
+
+int
+Speculator::FindBranch(char *candidate)
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   for (int i = 0; i < _branch_count; i++) {
+      if (!_branches[i].failed && !memcmp(_branches[i].candidate, candidate, _input_size)) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+/*
+ * Returns true if the inputs the branch used for frame are the ones given.
+ * Pass NULL to compare against the inputs the game itself used.
+ */
+bool
+Speculator::BranchMatches(int branch, int frame, char *inputs, int disconnect_flags)
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   int i = frame - _start_frame;
+   if (!_active || i < 0 || i >= _num_frames) {
+      return false;
+   }
+
+   byte *entry = _inputs + i * _input_stride;
+   char *candidate = _branches[branch].candidate;
+   if (!inputs) {
+      return !memcmp(entry + _queue * _input_size, candidate, _input_size);
+   }
+
+   int flags;
+   memcpy(&flags, entry + _num_players * _input_size, sizeof(int));
+   if (flags != disconnect_flags) {
+      return false;
+   }
+   for (int p = 0; p < _num_players; p++) {
+      void *used = (p == _queue) ? (void *)candidate : (void *)(entry + p * _input_size);
+      if (memcmp(used, inputs + p * _input_size, _input_size)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+/*
+ * Block until the branch has simulated everything up to (but not
+ * including) frame.  Returns false if it never will.
+ */
+bool
+Speculator::WaitForBranch(int branch, int frame)
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   Branch *b = _branches + branch;
+   int needed = frame - _start_frame;
+   if (!_active || needed > _num_frames) {
+      return false;
+   }
+   while (!b->failed && b->frames_done < needed) {
+      _done.wait(lock);
+   }
+   return !b->failed;
+}
+
+byte *
+Speculator::GetBranchState(int branch, int frame, int *len)
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   Branch *b = _branches + branch;
+   int i = frame - _start_frame;
+   ASSERT(i >= 0 && i <= b->frames_done);
+
+   *len = b->lens[i];
+   return b->states + i * _state_capacity;
+}
+
+void
+Speculator::Run()
+{
+   std::vector<byte> inputs(_input_stride);
+   std::unique_lock<std::mutex> lock(_mutex);
+
+   while (!_shutdown) {
+      Branch *branch = NextBranch();
+      if (!branch) {
+         _work.wait(lock);
+         continue;
+      }
+
+      /*
+       * Grab everything we need for the next frame of this branch, then
+       * simulate it without holding the lock.
+       */
+      int generation = _generation;
+      int i = branch->frames_done;
+      int frame = _start_frame + i;
+      int capacity = _state_capacity;
+      int len = branch->lens[i];
+      int disconnect_flags;
+      byte *entry = _inputs + i * _input_stride;
+      byte *src = branch->states + i * capacity;
+      byte *dst = src + capacity;
+
+      memcpy(&inputs[0], entry, _num_players * _input_size);
+      memcpy(&inputs[0] + _queue * _input_size, branch->candidate, _input_size);
+      memcpy(&disconnect_flags, entry + _num_players * _input_size, sizeof(int));
+      branch->busy = true;
+      lock.unlock();
+
+      memcpy(dst, src, len);
+      bool success = _callbacks.advance_state(dst, &len, capacity, &inputs[0], disconnect_flags, frame);
+
+      lock.lock();
+      branch->busy = false;
+      if (generation == _generation) {
+         if (success && len <= capacity) {
+            branch->lens[i + 1] = len;
+            branch->frames_done++;
+         } else {
+            Log("speculative branch failed to simulate frame %d.\n", frame);
+            branch->failed = true;
+         }
+      }
+      _done.notify_all();
+   }
+}
+
+/*
+ * Picks the branch that's furthest behind and has work to do.  Called with
+ * the lock held.
+ */
+Speculator::Branch *
+Speculator::NextBranch()
+{
+   Branch *next = NULL;
+   if (!_active) {
+      return NULL;
+   }
+   for (int i = 0; i < _branch_count; i++) {
+      Branch *branch = _branches + i;
+      if (branch->busy || branch->failed || branch->frames_done >= _num_frames) {
+         continue;
+      }
+      if (!next || branch->frames_done < next->frames_done) {
+         next = branch;
+      }
+   }
+   return next;
+}
+
+void
+Speculator::GrowStates(int size)
+{
+   /*
+    * Give the game room for its state to grow a little while simulating.
+    */
+   _state_capacity = (size * 2 + 63) & ~63;
+   for (int i = 0; i < _num_branches; i++) {
+      delete [] _branches[i].states;
+      _branches[i].states = new byte[(_max_frames + 1) * _state_capacity];
+   }
+}
@@ -0,0 +1,93 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _SPECULATION_H
+#define _SPECULATION_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "types.h"
+#include "include/ggponet.h"
+
+/*
+ * Speculator --
+ *
+ * Simulates alternate timelines for one late player on a pool of worker
+ * threads.  Each branch starts from the same saved state and replays the
+ * inputs the game actually used, except that the late player's input is
+ * replaced by one fixed candidate.  If the real input turns out to match a
+ * branch, Sync can adopt the branch's states instead of re-simulating.
+ */
+class Speculator {
+public:
+   Speculator(GGPOSessionCallbacks &callbacks, int num_players, int input_size,
+              int max_frames, int num_branches, int num_threads);
+   virtual ~Speculator();
+
+   void Start(int frame, int queue, byte *state, int len, char *candidates, int count);
+   bool AddFrame(int frame, void *inputs, int disconnect_flags);
+   void Cancel();
+
+   bool IsActive() { return _active; }
+   int GetStartFrame() { return _start_frame; }
+   int GetLastFrame() { return _start_frame + _num_frames - 1; }
+   int GetQueue() { return _queue; }
+   int GetNumBranches() { return _num_branches; }
+
+   int FindBranch(char *candidate);
+   bool BranchMatches(int branch, int frame, char *inputs, int disconnect_flags);
+   bool WaitForBranch(int branch, int frame);
+   byte *GetBranchState(int branch, int frame, int *len);
+
+protected:
+   struct Branch {
+      char     *candidate;
+      byte     *states;
+      int      *lens;
+      int      frames_done;
+      bool     busy;
+      bool     failed;
+   };
+
+   void Run();
+   Branch *NextBranch();
+   void GrowStates(int size);
+
+protected:
+   GGPOSessionCallbacks _callbacks;
+   int            _num_players;
+   int            _input_size;
+   int            _input_stride;
+   int            _max_frames;
+   int            _num_branches;
+   int            _branch_count;
+
+   /*
+    * The timeline being speculated on.  _inputs holds the inputs the game
+    * used for each frame since _start_frame, followed by the disconnect
+    * flags.  Guarded by _mutex, as is everything in the branches.
+    */
+   bool           _active;
+   int            _generation;
+   int            _start_frame;
+   int            _queue;
+   int            _num_frames;
+   byte           *_inputs;
+   int            _state_capacity;
+   Branch         *_branches;
+
+   std::mutex     _mutex;
+   std::condition_variable _work;
+   std::condition_variable _done;
+   std::vector<std::thread> _threads;
+   bool           _shutdown;
+};
+
+#endif
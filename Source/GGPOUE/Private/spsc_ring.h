@@ -0,0 +1,70 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+#include <atomic>
+#include "types.h"
+
+/*
+ * SpscRing --
+ *
+ * A RingBuffer that one thread can push to while another pops from it,
+ * without taking a lock.  Only the producer writes _head and only the
+ * consumer writes _tail; each publishes the slot it is done with by
+ * storing its index.  Like RingBuffer it holds at most N - 1 elements.
+ */
+template<class T, int N> class SpscRing
+{
+public:
+   SpscRing<T, N>() :
+      _head(0),
+      _tail(0) {
+   }
+
+   bool push(const T &t) {
+      int head = _head.load(std::memory_order_relaxed);
+      int next = (head + 1) % N;
+      if (next == _tail.load(std::memory_order_acquire)) {
+         return false;
+      }
+      _elements[head] = t;
+      _head.store(next, std::memory_order_release);
+      return true;
+   }
+
+   bool pop(T &t) {
+      int tail = _tail.load(std::memory_order_relaxed);
+      if (tail == _head.load(std::memory_order_acquire)) {
+         return false;
+      }
+      t = _elements[tail];
+      _tail.store((tail + 1) % N, std::memory_order_release);
+      return true;
+   }
+
+   int size() {
+      int size = _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+      return size < 0 ? size + N : size;
+   }
+
+   bool empty() {
+      return size() == 0;
+   }
+
+   bool full() {
+      return size() == (N - 1);
+   }
+
+protected:
+   T                    _elements[N];
+   alignas(64) std::atomic<int> _head;
+   alignas(64) std::atomic<int> _tail;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "state_delta.h"
+#include "varint.h"
+#include <string.h>
+
+/*
+ * Short runs of unchanged bytes are cheaper to copy as literals than to
+ * close the record and start a new one.
+ */
+#define STATE_DELTA_MIN_ZERO_RUN    4
+
+static inline uint8
+XorAt(const uint8 *a, int alen, const uint8 *b, int blen, int i)
+{
+   return (i < alen ? a[i] : 0) ^ (i < blen ? b[i] : 0);
+}
+
+int
+StateDelta_MaxEncodedSize(int len)
+{
+   /*
+    * Every record but the last is followed by at least STATE_DELTA_MIN_ZERO_RUN
+    * unchanged bytes, which bounds the number of record headers.
+    */
+   int records = (len / (STATE_DELTA_MIN_ZERO_RUN + 1)) + 1;
+   return len + (records * 2 * VARINT_MAX_SIZE);
+}
+
+int
+StateDelta_Encode(const uint8 *cur, int cur_len, const uint8 *prev, int prev_len, uint8 *out, int out_capacity)
+{
+   int len = MAX(cur_len, prev_len);
+   int common = MIN(cur_len, prev_len);
+   int offset = 0;
+   int i = 0;
+
+   while (i < len) {
+      /*
+       * Skip over unchanged bytes, a word at a time while both states have
+       * data.
+       */
+      int start = i;
+      while (i + 8 <= common) {
+         uint64 a, b;
+         memcpy(&a, cur + i, sizeof a);
+         memcpy(&b, prev + i, sizeof b);
+         if (a != b) {
+            break;
+         }
+         i += 8;
+      }
+      while (i < len && XorAt(cur, cur_len, prev, prev_len, i) == 0) {
+         i++;
+      }
+      if (i == len) {
+         break;
+      }
+
+      /*
+       * Collect changed bytes until we hit a long enough unchanged run.
+       */
+      int literal = i;
+      int zeros = 0;
+      while (i < len && zeros < STATE_DELTA_MIN_ZERO_RUN) {
+         zeros = XorAt(cur, cur_len, prev, prev_len, i) ? 0 : zeros + 1;
+         i++;
+      }
+      int count = (i - zeros) - literal;
+      i -= zeros;
+
+      offset = WriteVarint(out, offset, out_capacity, (uint32)(literal - start));
+      if (offset < 0) {
+         return -1;
+      }
+      offset = WriteVarint(out, offset, out_capacity, (uint32)count);
+      if (offset < 0 || offset + count > out_capacity) {
+         return -1;
+      }
+      for (int j = 0; j < count; j++) {
+         out[offset++] = XorAt(cur, cur_len, prev, prev_len, literal + j);
+      }
+   }
+   return offset;
+}
+
+void
+StateDelta_Apply(uint8 *buf, const uint8 *delta, int delta_len)
+{
+   int offset = 0;
+   int pos = 0;
+
+   while (offset < delta_len) {
+      uint32 skip = 0, count = 0;
+      bool ok = ReadVarint(delta, delta_len, &offset, &skip) &&
+                ReadVarint(delta, delta_len, &offset, &count);
+      ASSERT(ok && offset + (int)count <= delta_len);
+      pos += (int)skip;
+      for (int j = 0; j < (int)count; j++) {
+         buf[pos++] ^= delta[offset++];
+      }
+   }
+}
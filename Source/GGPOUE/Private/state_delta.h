@@ -0,0 +1,22 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _STATE_DELTA_H
+#define _STATE_DELTA_H
+
+#include "types.h"
+
+/*
+ * XOR deltas between two saved game states, run-length encoded as a list of
+ * (varint skip, varint count, count literal bytes) records.  Because the
+ * delta is an XOR, applying it to either state yields the other one.
+ */
+int StateDelta_MaxEncodedSize(int len);
+int StateDelta_Encode(const uint8 *cur, int cur_len, const uint8 *prev, int prev_len, uint8 *out, int out_capacity);
+void StateDelta_Apply(uint8 *buf, const uint8 *delta, int delta_len);
+
+#endif // _STATE_DELTA_H
@@ -6,26 +6,95 @@
  */
 
 #include "sync.h"
+#include "state_delta.h"
+#include "speculation.h"
+
+#define SPECULATION_HISTORY      32
+
+#define ARENA_SLOT_ALIGN      64
 
 Sync::Sync(UdpMsg::connect_status *connect_status) :
  _local_connect_status(connect_status),
- _input_queues(NULL)
+ _input_queues(NULL),
+ _arena(NULL),
+ _arena_slot_size(0),
+ _delta_compression(false),
+ _delta_current(NULL),
+ _delta_current_len(-1),
+ _delta_scratch(NULL),
+ _delta_buffer_size(0),
+ _delta_encode_buf(NULL),
+ _delta_encode_size(0),
+ _region(NULL),
+ _region_size(0),
+ _region_offset(0),
+ _region_pages(0),
+ _page_size(0),
+ _region_shadow(NULL),
+ _region_dirty(NULL),
+ _region_tracker(NULL),
+ _region_saved(false),
+ _speculator(NULL),
+ _speculation_inputs(NULL),
+ _speculation_candidates(NULL),
+ _speculation_log(NULL),
+ _speculation_log_frames(NULL),
+ _speculation_log_flags(NULL)
 {
    _framecount = 0;
    _last_confirmed_frame = -1;
    _max_prediction_frames = 0;
+   _resimulated = 0;
    memset(&_savedstate, 0, sizeof(_savedstate));
+   memset(&_rollback_stats, 0, sizeof(_rollback_stats));
 }
 
 Sync::~Sync()
 {
+   /*
+    * Stop the speculation workers before the buffers they read go away.
+    */
+   delete _speculator;
+   _speculator = NULL;
+   delete [] _speculation_inputs;
+   delete [] _speculation_candidates;
+   delete [] _speculation_log;
+   delete [] _speculation_log_frames;
+   delete [] _speculation_log_flags;
+
    /*
     * Delete frames manually here rather than in a destructor of the SavedFrame
-    * structure so we can efficently copy frames via weak references.
+    * structure so we can efficently copy frames via weak references.  Frames
+    * saved into the arena, as deltas or as region pages belong to us, not
+    * the game.
     */
-   for (int i = 0; i < ARRAY_SIZE(_savedstate.frames); i++) {
-      _callbacks.free_buffer(_savedstate.frames[i].buf);
+   if (_region) {
+      for (int i = 0; i < _savedstate.count; i++) {
+         delete [] _savedstate.frames[i].pages;
+         delete [] _savedstate.frames[i].page_data;
+      }
+      if (_region_tracker) {
+         Platform::StopDirtyPageTracking(_region_tracker);
+      }
+      delete [] _region_shadow;
+      delete [] _region_dirty;
+   } else if (_delta_compression) {
+      for (int i = 0; i < _savedstate.count; i++) {
+         delete [] _savedstate.frames[i].delta;
+      }
+      delete [] _delta_current;
+      delete [] _delta_scratch;
+      delete [] _delta_encode_buf;
+   } else if (_callbacks.save_game_state_into) {
+      delete [] _arena;
+      _arena = NULL;
+   } else {
+      for (int i = 0; i < _savedstate.count; i++) {
+         _callbacks.free_buffer(_savedstate.frames[i].buf);
+      }
    }
+   delete [] _savedstate.frames;
+   _savedstate.frames = NULL;
    delete [] _input_queues;
    _input_queues = NULL;
 }
@@ -40,12 +109,143 @@ Sync::Init(Sync::Config &config)
 
    _max_prediction_frames = config.num_prediction_frames;
 
+   /*
+    * Keep enough states to roll back across the whole prediction window,
+    * plus the current frame and one to spare.
+    */
+   delete [] _savedstate.frames;
+   _savedstate.count = _max_prediction_frames + 2;
+   _savedstate.frames = new SavedFrame[_savedstate.count];
+   _savedstate.newest = -1;
+
    CreateQueues(config);
 }
 
+bool
+Sync::SetDeltaCompression(bool enable)
+{
+   /*
+    * The save format can't change once the first frame has been saved.
+    */
+   if (_framecount != 0 || _savedstate.newest >= 0 || _region || _speculator) {
+      return false;
+   }
+   _delta_compression = enable;
+   return true;
+}
+
+bool
+Sync::RegisterStateRegion(void *base, int size)
+{
+   if (_framecount != 0 || _savedstate.newest >= 0 || _region || _delta_compression || _speculator) {
+      return false;
+   }
+   if (!base || size <= 0) {
+      return false;
+   }
+
+   _region = (byte *)base;
+   _region_size = size;
+   _page_size = Platform::GetPageSize();
+   _region_offset = (int)((uintptr_t)base % _page_size);
+   _region_pages = (_region_offset + size + _page_size - 1) / _page_size;
+   _region_shadow = new byte[size];
+   _region_dirty = new uint8[_region_pages];
+   _region_saved = false;
+
+   /*
+    * Without dirty page tracking, fall back to comparing every page against
+    * the shadow.
+    */
+   _region_tracker = Platform::StartDirtyPageTracking(base, size);
+   Log("registered state region of %d bytes (%d pages, dirty page tracking %s).\n",
+       size, _region_pages, _region_tracker ? "on" : "off");
+   return true;
+}
+
+bool
+Sync::SetSpeculation(int num_branches, int num_threads)
+{
+   if (_framecount != 0 || _savedstate.newest >= 0 || _region || _delta_compression) {
+      return false;
+   }
+
+   delete _speculator;
+   _speculator = NULL;
+   delete [] _speculation_inputs;
+   _speculation_inputs = NULL;
+   delete [] _speculation_candidates;
+   _speculation_candidates = NULL;
+   delete [] _speculation_log;
+   _speculation_log = NULL;
+   delete [] _speculation_log_frames;
+   _speculation_log_frames = NULL;
+   delete [] _speculation_log_flags;
+   _speculation_log_flags = NULL;
+   if (num_branches <= 0) {
+      return true;
+   }
+
+   /*
+    * Branches are simulated with advance_state and adopted by copying them
+    * straight into our own save buffers.
+    */
+   if (!_callbacks.advance_state || !_callbacks.save_game_state_into) {
+      return false;
+   }
+   if (num_branches > GGPO_MAX_SPECULATION_BRANCHES || num_threads < 1) {
+      return false;
+   }
+   _speculator = new Speculator(_callbacks, _config.num_players, _config.input_size,
+                                _max_prediction_frames + 2, num_branches, num_threads);
+   _speculation_inputs = new char[_config.num_players * _config.input_size];
+   _speculation_candidates = new char[num_branches * _config.input_size];
+   _speculation_log = new char[_savedstate.count * _config.num_players * _config.input_size];
+   _speculation_log_frames = new int[_savedstate.count];
+   _speculation_log_flags = new int[_savedstate.count];
+   for (int i = 0; i < _savedstate.count; i++) {
+      _speculation_log_frames[i] = -1;
+   }
+   return true;
+}
+
+bool
+Sync::SetInputPredictor(int queue, EGGPOInputPredictor type)
+{
+   InputPredictor *predictor = InputPredictor::Create(type);
+   if (!predictor) {
+      return false;
+   }
+   _input_queues[queue].SetPredictor(predictor);
+   return true;
+}
+
+bool
+Sync::SetRelevanceMask(const void *mask, int size)
+{
+   if (mask && size != _config.input_size) {
+      return false;
+   }
+   for (int i = 0; i < _config.num_players; i++) {
+      _input_queues[i].SetRelevanceMask((const char *)mask);
+   }
+   return true;
+}
+
 void
 Sync::SetLastConfirmedFrame(int frame) 
 {   
+   /*
+    * Hang on to the inputs of any mispredicted frame we haven't rolled back
+    * to yet.
+    */
+   for (int i = 0; i < _config.num_players; i++) {
+      int incorrect = _input_queues[i].GetFirstIncorrectFrame();
+      if (incorrect != GameInput::NullFrame) {
+         frame = MIN(frame, incorrect);
+      }
+   }
+
    _last_confirmed_frame = frame;
    if (_last_confirmed_frame > 0) {
       for (int i = 0; i < _config.num_players; i++) {
@@ -105,19 +305,31 @@ Sync::GetConfirmedInputs(void *values, int size, int frame)
 int
 Sync::SynchronizeInputs(void *values, int size)
 {
-   int disconnect_flags = 0;
-   char *output = (char *)values;
-
    ASSERT(size >= _config.num_players * _config.input_size);
 
-   memset(output, 0, size);
+   memset(values, 0, size);
+   int disconnect_flags = GetFrameInputs(_framecount, (char *)values);
+   if (_speculator) {
+      LogSpeculationInputs((char *)values, disconnect_flags);
+      if (!_rollingback) {
+         UpdateSpeculation();
+      }
+   }
+   return disconnect_flags;
+}
+
+int
+Sync::GetFrameInputs(int frame, char *output)
+{
+   int disconnect_flags = 0;
+
    for (int i = 0; i < _config.num_players; i++) {
       GameInput input;
-      if (_local_connect_status[i].disconnected && _framecount > _local_connect_status[i].last_frame) {
+      if (_local_connect_status[i].disconnected && frame > _local_connect_status[i].last_frame) {
          disconnect_flags |= (1 << i);
          input.erase();
       } else {
-         _input_queues[i].GetInput(_framecount, &input);
+         _input_queues[i].GetInput(frame, &input);
       }
       memcpy(output + (i * _config.input_size), input.bits, _config.input_size);
    }
@@ -138,15 +350,61 @@ Sync::CheckSimulation(int timeout)
 void
 Sync::IncrementFrame(void)
 {
+   if (!_rollingback) {
+      _rollback_stats.last_frame_resimulated = _resimulated;
+      _rollback_stats.max_frame_resimulated = MAX(_rollback_stats.max_frame_resimulated, _resimulated);
+      _resimulated = 0;
+   }
    _framecount++;
-   SaveCurrentFrame();
+   if (ShouldSaveFrame(_framecount)) {
+      SaveCurrentFrame();
+   }
+}
+
+bool
+Sync::ShouldSaveFrame(int frame)
+{
+   if (!_config.elide_confirmed_saves) {
+      return true;
+   }
+
+   /*
+    * Disconnects roll back to the disconnected player's last frame, which is
+    * never older than the last confirmed frame.  Keep everything from there
+    * on so that's always possible.
+    */
+   if (frame >= _last_confirmed_frame) {
+      return true;
+   }
+
+   /*
+    * Otherwise a frame can only be rolled back to if we're about to predict
+    * an input for it.  If every connected queue already has its real input,
+    * the prediction can't be wrong and nobody will ever ask for this state.
+    */
+   for (int i = 0; i < _config.num_players; i++) {
+      if (_local_connect_status[i].disconnected && frame > _local_connect_status[i].last_frame) {
+         continue;
+      }
+      if (_input_queues[i].GetLastConfirmedFrame() < frame) {
+         return true;
+      }
+   }
+   Log("skipping save of fully confirmed frame %d.\n", frame);
+   return false;
 }
 
 void
 Sync::AdjustSimulation(int seek_to)
 {
    int framecount = _framecount;
-   int count = _framecount - seek_to;
+
+   if (_speculator) {
+      if (AdoptSpeculation(seek_to)) {
+         return;
+      }
+      _speculator->Cancel();
+   }
 
    Log("Catching up\n");
    _rollingback = true;
@@ -156,6 +414,10 @@ Sync::AdjustSimulation(int seek_to)
     */
    LoadFrame(seek_to);
    ASSERT(_framecount == seek_to);
+   int count = framecount - _framecount;
+   _rollback_stats.rollbacks++;
+   _rollback_stats.frames_resimulated += count;
+   _resimulated += count;
 
    /*
     * Advance frame by frame (stuffing notifications back to 
@@ -181,20 +443,35 @@ Sync::LoadFrame(int frame)
       return;
    }
 
-   // Move the head pointer back and load it up
-   _savedstate.head = FindSavedFrameIndex(frame);
-   SavedFrame *state = _savedstate.frames + _savedstate.head;
+   int index = FindSavedFrameIndex(frame);
+   ASSERT(index >= 0);
+   SavedFrame *state = _savedstate.frames + index;
 
    Log("=== Loading frame info %d (size: %d  checksum: %08x).\n",
        state->frame, state->cbuf, state->checksum);
 
-   ASSERT(state->buf && state->cbuf);
-   _callbacks.load_game_state(state->buf, state->cbuf);
+   if (_region) {
+      LoadRegionFrame(frame);
+   } else if (_delta_compression) {
+      LoadDeltaFrame(frame);
+   } else {
+      ASSERT(state->buf && state->cbuf);
+      _callbacks.load_game_state(state->buf, state->cbuf);
+   }
+
+   // Anything saved after this frame came from the timeline we just threw
+   // away.  Forget it so it can't be mistaken for a real state later.
+   for (int f = frame + 1; f <= _savedstate.newest; f++) {
+      SavedFrame *stale = _savedstate.frames + (f % _savedstate.count);
+      if (stale->frame == f) {
+         stale->frame = -1;
+      }
+   }
+   _savedstate.newest = frame;
 
-   // Reset framecount and the head of the state ring-buffer to point in
-   // advance of the current frame (as if we had just finished executing it).
+   // Reset framecount to point in advance of the current frame (as if we
+   // had just finished executing it).
    _framecount = state->frame;
-   _savedstate.head = (_savedstate.head + 1) % ARRAY_SIZE(_savedstate.frames);
 }
 
 void
@@ -202,42 +479,528 @@ Sync::SaveCurrentFrame()
 {
    /*
     * See StateCompress for the real save feature implemented by FinalBurn.
-    * Write everything into the head, then advance the head pointer.
+    * Write everything into the slot for this frame, replacing whatever
+    * frame was there count frames ago.
     */
-   SavedFrame *state = _savedstate.frames + _savedstate.head;
-   if (state->buf) {
-      _callbacks.free_buffer(state->buf);
-      state->buf = NULL;
-   }
+   SavedFrame *state = _savedstate.frames + (_framecount % _savedstate.count);
    state->frame = _framecount;
-   _callbacks.save_game_state(&state->buf, &state->cbuf, &state->checksum, state->frame);
+   if (_region) {
+      SaveRegionFrame(state);
+   } else if (_delta_compression) {
+      SaveDeltaFrame(state);
+   } else if (_callbacks.save_game_state_into) {
+      SaveFrameToArena(state);
+   } else {
+      if (state->buf) {
+         _callbacks.free_buffer(state->buf);
+         state->buf = NULL;
+      }
+      _callbacks.save_game_state(&state->buf, &state->cbuf, &state->checksum, state->frame);
+   }
 
    Log("=== Saved frame info %d (size: %d  checksum: %08x).\n", state->frame, state->cbuf, state->checksum);
-   _savedstate.head = (_savedstate.head + 1) % ARRAY_SIZE(_savedstate.frames);
+   _savedstate.newest = _framecount;
 }
 
-Sync::SavedFrame&
-Sync::GetLastSavedFrame()
+void
+Sync::SaveFrameToArena(SavedFrame *state)
 {
-   int i = _savedstate.head - 1;
-   if (i < 0) {
-      i = ARRAY_SIZE(_savedstate.frames) - 1;
+   /*
+    * Have the game serialize straight into the slot we own.  If the state
+    * no longer fits, grow every slot to the new size and try once more.
+    * If that fails too the slot is marked empty, so a rollback to this frame
+    * trips the assert in LoadFrame instead of loading a zero-length state.
+    */
+   int slot = (int)(state - _savedstate.frames);
+   int len = 0;
+
+   state->cbuf = 0;
+   state->buf = _arena ? _arena + (slot * _arena_slot_size) : NULL;
+   if (!_callbacks.save_game_state_into(state->buf, _arena_slot_size, &len, &state->checksum, state->frame)) {
+      if (len <= _arena_slot_size) {
+         Log(EGGPOLogVerbosity::Info, "save_game_state_into failed for frame %d.\n", state->frame);
+         state->frame = -1;
+         return;
+      }
+      GrowArena(len);
+      state->buf = _arena + (slot * _arena_slot_size);
+      if (!_callbacks.save_game_state_into(state->buf, _arena_slot_size, &len, &state->checksum, state->frame)) {
+         Log(EGGPOLogVerbosity::Info, "save_game_state_into failed for frame %d after growing to %d bytes.\n", state->frame, _arena_slot_size);
+         state->frame = -1;
+         return;
+      }
    }
-   return _savedstate.frames[i];
+   ASSERT(len <= _arena_slot_size);
+   state->cbuf = len;
 }
 
+void
+Sync::GrowArena(int size)
+{
+   /*
+    * Leave some headroom so a state that creeps up by a few bytes doesn't
+    * reallocate every frame.  Growing is rare; saved frames are carried over
+    * so we can still roll back to them.
+    */
+   int slot_size = size + (size / 4);
+   slot_size = (slot_size + ARENA_SLOT_ALIGN - 1) & ~(ARENA_SLOT_ALIGN - 1);
+
+   Log("growing save arena from %d to %d bytes per slot.\n", _arena_slot_size, slot_size);
 
-int
-Sync::FindSavedFrameIndex(int frame)
+   int count = _savedstate.count;
+   byte *arena = new byte[count * slot_size];
+   for (int i = 0; i < count; i++) {
+      SavedFrame *state = _savedstate.frames + i;
+      if (state->buf && state->cbuf) {
+         memcpy(arena + (i * slot_size), state->buf, state->cbuf);
+      }
+      state->buf = state->buf ? arena + (i * slot_size) : NULL;
+   }
+   delete [] _arena;
+   _arena = arena;
+   _arena_slot_size = slot_size;
+}
+
+void
+Sync::SaveDeltaFrame(SavedFrame *state)
+{
+   /*
+    * Serialize the new state into scratch space, then store it in the slot
+    * as a delta against the previously saved state.  A failed save is kept
+    * as an empty state so the chain of deltas stays intact.
+    */
+   int len = 0;
+   if (_callbacks.save_game_state_into) {
+      if (!_callbacks.save_game_state_into(_delta_scratch, _delta_buffer_size, &len, &state->checksum, state->frame)) {
+         if (len > _delta_buffer_size) {
+            GrowDeltaBuffers(len);
+            if (!_callbacks.save_game_state_into(_delta_scratch, _delta_buffer_size, &len, &state->checksum, state->frame)) {
+               len = 0;
+            }
+         } else {
+            len = 0;
+         }
+      }
+   } else {
+      byte *buf = NULL;
+      if (!_callbacks.save_game_state(&buf, &len, &state->checksum, state->frame) || !buf) {
+         len = 0;
+      }
+      if (len > _delta_buffer_size) {
+         GrowDeltaBuffers(len);
+      }
+      if (len) {
+         memcpy(_delta_scratch, buf, len);
+      }
+      if (buf) {
+         _callbacks.free_buffer(buf);
+      }
+   }
+   if (!len) {
+      Log("saving frame %d failed.  storing an empty state.\n", state->frame);
+   }
+
+   state->cdelta = 0;
+   if (_delta_current_len >= 0) {
+      int n = StateDelta_Encode(_delta_scratch, len, _delta_current, _delta_current_len, state->delta, state->delta_capacity);
+      if (n < 0) {
+         n = StateDelta_Encode(_delta_scratch, len, _delta_current, _delta_current_len, _delta_encode_buf, _delta_encode_size);
+         ASSERT(n >= 0);
+
+         delete [] state->delta;
+         state->delta_capacity = n + (n / 4) + 1;
+         state->delta = new byte[state->delta_capacity];
+         memcpy(state->delta, _delta_encode_buf, n);
+      }
+      state->cdelta = n;
+   }
+   state->cbuf = len;
+
+   byte *tmp = _delta_current;
+   _delta_current = _delta_scratch;
+   _delta_scratch = tmp;
+   _delta_current_len = len;
+}
+
+void
+Sync::LoadDeltaFrame(int frame)
+{
+   /*
+    * Start from the newest state and undo one delta per saved frame until
+    * we reach the requested frame.  Bytes past the end of a state read as
+    * zero.
+    */
+   ASSERT(_delta_current_len >= 0);
+   if (_delta_buffer_size) {
+      memcpy(_delta_scratch, _delta_current, _delta_current_len);
+      memset(_delta_scratch + _delta_current_len, 0, _delta_buffer_size - _delta_current_len);
+   }
+   for (int f = _savedstate.newest; f > frame; f--) {
+      SavedFrame *saved = _savedstate.frames + (f % _savedstate.count);
+      if (saved->frame == f) {
+         StateDelta_Apply(_delta_scratch, saved->delta, saved->cdelta);
+      }
+   }
+
+   SavedFrame *state = _savedstate.frames + (frame % _savedstate.count);
+   _callbacks.load_game_state(_delta_scratch, state->cbuf);
+
+   byte *tmp = _delta_current;
+   _delta_current = _delta_scratch;
+   _delta_scratch = tmp;
+   _delta_current_len = state->cbuf;
+}
+
+void
+Sync::GrowDeltaBuffers(int size)
+{
+   int buffer_size = size + (size / 4);
+   buffer_size = (buffer_size + ARENA_SLOT_ALIGN - 1) & ~(ARENA_SLOT_ALIGN - 1);
+
+   Log("growing delta buffers from %d to %d bytes.\n", _delta_buffer_size, buffer_size);
+
+   byte *current = new byte[buffer_size];
+   if (_delta_current_len > 0) {
+      memcpy(current, _delta_current, _delta_current_len);
+   }
+   delete [] _delta_current;
+   _delta_current = current;
+
+   delete [] _delta_scratch;
+   _delta_scratch = new byte[buffer_size];
+
+   delete [] _delta_encode_buf;
+   _delta_encode_size = StateDelta_MaxEncodedSize(buffer_size);
+   _delta_encode_buf = new byte[_delta_encode_size];
+
+   _delta_buffer_size = buffer_size;
+}
+
+void
+Sync::GetRegionPage(int page, int *offset, int *len)
+{
+   /*
+    * Pages are counted from the page boundary at or before the start of the
+    * region, so the first and last ones may be partial.
+    */
+   int start = MAX(page * _page_size - _region_offset, 0);
+   int end = MIN((page + 1) * _page_size - _region_offset, _region_size);
+   *offset = start;
+   *len = end - start;
+}
+
+void
+Sync::FindDirtyRegionPages()
+{
+   if (_region_tracker &&
+       !Platform::GetDirtyPages(_region_tracker, _region_dirty)) {
+      Log("reading dirty pages failed.  comparing every page from now on.\n");
+      Platform::StopDirtyPageTracking(_region_tracker);
+      _region_tracker = NULL;
+   }
+   if (!_region_tracker) {
+      memset(_region_dirty, 1, _region_pages);
+   }
+}
+
+void
+Sync::SaveRegionFrame(SavedFrame *state)
+{
+   state->cbuf = _region_size;
+   state->checksum = 0;
+   state->npages = 0;
+
+   if (!_region_saved) {
+      memcpy(_region_shadow, _region, _region_size);
+      _region_saved = true;
+      if (_region_tracker) {
+         Platform::ResetDirtyPages(_region_tracker);
+      }
+      return;
+   }
+
+   /*
+    * Remember the old contents of every page written since the last save
+    * and bring the shadow up to date.  Dirty tracking can report pages that
+    * were written with identical data, so compare before recording.
+    */
+   FindDirtyRegionPages();
+   for (int i = 0; i < _region_pages; i++) {
+      if (!_region_dirty[i]) {
+         continue;
+      }
+      int offset, len;
+      GetRegionPage(i, &offset, &len);
+      if (!memcmp(_region + offset, _region_shadow + offset, len)) {
+         continue;
+      }
+      if (state->npages == state->page_capacity) {
+         int capacity = MAX(state->page_capacity * 2, 16);
+         int *pages = new int[capacity];
+         byte *page_data = new byte[capacity * _page_size];
+         if (state->npages) {
+            memcpy(pages, state->pages, state->npages * sizeof(int));
+            memcpy(page_data, state->page_data, state->npages * _page_size);
+         }
+         delete [] state->pages;
+         delete [] state->page_data;
+         state->pages = pages;
+         state->page_data = page_data;
+         state->page_capacity = capacity;
+      }
+      state->pages[state->npages] = i;
+      memcpy(state->page_data + state->npages * _page_size, _region_shadow + offset, len);
+      memcpy(_region_shadow + offset, _region + offset, len);
+      state->npages++;
+   }
+   if (_region_tracker) {
+      Platform::ResetDirtyPages(_region_tracker);
+   }
+}
+
+void
+Sync::LoadRegionFrame(int frame)
+{
+   int offset, len;
+
+   /*
+    * First undo anything written since the newest save, which the shadow
+    * still holds...
+    */
+   FindDirtyRegionPages();
+   for (int page = 0; page < _region_pages; page++) {
+      if (_region_dirty[page]) {
+         GetRegionPage(page, &offset, &len);
+         if (memcmp(_region + offset, _region_shadow + offset, len)) {
+            memcpy(_region + offset, _region_shadow + offset, len);
+         }
+      }
+   }
+
+   /*
+    * ...then walk back one saved frame at a time, restoring the pages each
+    * one changed.
+    */
+   for (int f = _savedstate.newest; f > frame; f--) {
+      SavedFrame *state = _savedstate.frames + (f % _savedstate.count);
+      if (state->frame != f) {
+         continue;
+      }
+      for (int j = 0; j < state->npages; j++) {
+         GetRegionPage(state->pages[j], &offset, &len);
+         memcpy(_region + offset, state->page_data + j * _page_size, len);
+         memcpy(_region_shadow + offset, state->page_data + j * _page_size, len);
+      }
+   }
+   if (_region_tracker) {
+      Platform::ResetDirtyPages(_region_tracker);
+   }
+
+   /*
+    * The region now holds the requested frame.  Let the game rebuild
+    * anything it derives from it.
+    */
+   _callbacks.load_game_state(_region, _region_size);
+}
+
+void
+Sync::LogSpeculationInputs(char *inputs, int disconnect_flags)
+{
+   int size = _config.num_players * _config.input_size;
+   int slot = _framecount % _savedstate.count;
+   memcpy(_speculation_log + slot * size, inputs, size);
+   _speculation_log_frames[slot] = _framecount;
+   _speculation_log_flags[slot] = disconnect_flags;
+}
+
+void
+Sync::UpdateSpeculation()
+{
+   /*
+    * Speculate on the first player we're still predicting, starting at
+    * the first frame we don't have their input for.  That's where the
+    * rollback will go back to if their next input isn't what we guessed,
+    * so every time it moves we have to start over.
+    */
+   int queue = -1;
+   int frame = 0;
+   for (int i = 0; i < _config.num_players; i++) {
+      if (_local_connect_status[i].disconnected) {
+         continue;
+      }
+      frame = _input_queues[i].GetLastConfirmedFrame() + 1;
+      if (frame <= _framecount) {
+         queue = i;
+         break;
+      }
+   }
+
+   if (_speculator->IsActive()) {
+      if (queue != _speculator->GetQueue() || frame != _speculator->GetStartFrame()) {
+         _speculator->Cancel();
+      } else {
+         int size = _config.num_players * _config.input_size;
+         int slot = _framecount % _savedstate.count;
+         if (!_speculator->AddFrame(_framecount, _speculation_log + slot * size, _speculation_log_flags[slot])) {
+            _speculator->Cancel();
+         }
+         return;
+      }
+   }
+   if (queue >= 0) {
+      StartSpeculation(queue, frame);
+   }
+}
+
+void
+Sync::StartSpeculation(int queue, int frame)
+{
+   int index = FindSavedFrameIndex(frame);
+   if (index < 0) {
+      return;
+   }
+
+   /*
+    * We're already running the timeline where the player does what the
+    * predictor guessed.  Try them letting go of everything, then whatever
+    * else they've been pressing lately.
+    */
+   int size = _config.input_size;
+   int stride = _config.num_players * size;
+   int max = _speculator->GetNumBranches();
+   int count = 0;
+   char *predicted = _speculation_log + (frame % _savedstate.count) * stride + queue * size;
+   GameInput input;
+
+   input.erase();
+   int last = frame - 1;
+   for (int f = frame; f >= 0 && f > last - SPECULATION_HISTORY && count < max; f--) {
+      if (f <= last && !_input_queues[queue].GetConfirmedInput(f, &input)) {
+         break;
+      }
+      bool seen = !memcmp(input.bits, predicted, size);
+      for (int i = 0; i < count && !seen; i++) {
+         seen = !memcmp(input.bits, _speculation_candidates + i * size, size);
+      }
+      if (!seen) {
+         memcpy(_speculation_candidates + count * size, input.bits, size);
+         count++;
+      }
+   }
+   if (!count) {
+      return;
+   }
+
+   SavedFrame *state = _savedstate.frames + index;
+   _speculator->Start(frame, queue, state->buf, state->cbuf, _speculation_candidates, count);
+
+   /*
+    * Catch the branches up on the frames we've already run.
+    */
+   for (int f = frame; f <= _framecount; f++) {
+      int slot = f % _savedstate.count;
+      if (_speculation_log_frames[slot] != f ||
+          !_speculator->AddFrame(f, _speculation_log + slot * stride, _speculation_log_flags[slot])) {
+         _speculator->Cancel();
+         return;
+      }
+   }
+}
+
+bool
+Sync::AdoptSpeculation(int seek_to)
 {
-   int i, count = ARRAY_SIZE(_savedstate.frames);
-   for (i = 0; i < count; i++) {
-      if (_savedstate.frames[i].frame == frame) {
+   if (!_speculator->IsActive() ||
+       seek_to < _speculator->GetStartFrame() ||
+       _framecount > _speculator->GetLastFrame() + 1) {
+      return false;
+   }
+
+   /*
+    * Make the same input requests the re-simulation would and look for a
+    * branch that used exactly those inputs, and that agrees with what we
+    * already simulated before seek_to.
+    */
+   int queue = _speculator->GetQueue();
+   int branch = -1;
+
+   ResetPrediction(seek_to);
+   for (int frame = seek_to; frame < _framecount; frame++) {
+      int disconnect_flags = GetFrameInputs(frame, _speculation_inputs);
+      if (frame == seek_to) {
+         branch = _speculator->FindBranch(_speculation_inputs + queue * _config.input_size);
+         for (int f = _speculator->GetStartFrame(); f < seek_to && branch >= 0; f++) {
+            if (!_speculator->BranchMatches(branch, f, NULL, 0)) {
+               branch = -1;
+            }
+         }
+         if (branch < 0) {
+            break;
+         }
+      }
+      if (!_speculator->BranchMatches(branch, frame, _speculation_inputs, disconnect_flags)) {
+         branch = -1;
          break;
       }
    }
-   if (i == count) {
-      ASSERT(false);
+   if (branch < 0 || !_speculator->WaitForBranch(branch, _framecount)) {
+      ResetPrediction(seek_to);
+      return false;
+   }
+
+   /*
+    * The branch simulated exactly what the rollback would have.  Take its
+    * states for every frame after seek_to and load the newest one.
+    */
+   Log("adopting speculative branch %d for frames %d to %d.\n", branch, seek_to, _framecount);
+   for (int frame = seek_to + 1; frame <= _framecount; frame++) {
+      int len;
+      byte *buf = _speculator->GetBranchState(branch, frame, &len);
+      CopyFrameToArena(frame, buf, len);
+   }
+   _savedstate.newest = _framecount;
+   _speculator->Cancel();
+
+   SavedFrame &state = GetLastSavedFrame();
+   _callbacks.load_game_state(state.buf, state.cbuf);
+   return true;
+}
+
+void
+Sync::CopyFrameToArena(int frame, byte *buf, int len)
+{
+   if (len > _arena_slot_size) {
+      GrowArena(len);
+   }
+   int slot = frame % _savedstate.count;
+   SavedFrame *state = _savedstate.frames + slot;
+   state->frame = frame;
+   state->buf = _arena + slot * _arena_slot_size;
+   state->cbuf = len;
+   state->checksum = 0;
+   memcpy(state->buf, buf, len);
+}
+
+Sync::SavedFrame&
+Sync::GetLastSavedFrame()
+{
+   ASSERT(_savedstate.newest >= 0);
+   return _savedstate.frames[_savedstate.newest % _savedstate.count];
+}
+
+/*
+ * Returns the slot holding the given frame, or -1 if it was never saved or
+ * has since been replaced.
+ */
+int
+Sync::FindSavedFrameIndex(int frame)
+{
+   if (frame < 0) {
+      return -1;
+   }
+   int i = frame % _savedstate.count;
+   if (_savedstate.frames[i].frame != frame) {
+      return -1;
    }
    return i;
 }
@@ -15,9 +15,10 @@
 #include "ring_buffer.h"
 #include "network/udp_msg.h"
 
-#define MAX_PREDICTION_FRAMES    8
+#define MAX_PREDICTION_FRAMES    GGPO_MAX_PREDICTION_FRAMES
 
 class SyncTestBackend;
+class Speculator;
 
 class Sync {
 public:
@@ -26,6 +27,7 @@ public:
       int                     num_prediction_frames;
       int                     num_players;
       int                     input_size;
+      bool                    elide_confirmed_saves;
    };
    struct Event {
       enum {
@@ -43,6 +45,11 @@ public:
    virtual ~Sync();
 
    void Init(Config &config);
+   bool SetDeltaCompression(bool enable);
+   bool RegisterStateRegion(void *base, int size);
+   bool SetSpeculation(int num_branches, int num_threads);
+   bool SetInputPredictor(int queue, EGGPOInputPredictor type);
+   bool SetRelevanceMask(const void *mask, int size);
 
    void SetLastConfirmedFrame(int frame);
    void SetFrameDelay(int queue, int delay);
@@ -56,7 +63,9 @@ public:
    void IncrementFrame(void);
 
    int GetFrameCount() { return _framecount; }
+   bool HasSavedFrame(int frame) { return FindSavedFrameIndex(frame) >= 0; }
    bool InRollback() { return _rollingback; }
+   void GetRollbackStats(FGGPORollbackInfo *info) { *info = _rollback_stats; }
 
    bool GetEvent(Event &e);
 
@@ -68,18 +77,48 @@ protected:
       int      cbuf;
       int      frame;
       int      checksum;
-      SavedFrame() : buf(NULL), cbuf(0), frame(-1), checksum(0) { }
+      byte    *delta;
+      int      cdelta;
+      int      delta_capacity;
+      int     *pages;
+      byte    *page_data;
+      int      npages;
+      int      page_capacity;
+      SavedFrame() : buf(NULL), cbuf(0), frame(-1), checksum(0), delta(NULL), cdelta(0), delta_capacity(0),
+                     pages(NULL), page_data(NULL), npages(0), page_capacity(0) { }
    };
+   /*
+    * Saved frames are indexed by frame number modulo count.  Each slot's
+    * frame field says which frame it actually holds (-1 if none).
+    */
    struct SavedState {
-      SavedFrame frames[MAX_PREDICTION_FRAMES + 2];
-      int head;
+      SavedFrame *frames;
+      int count;
+      int newest;
    };
 
    void LoadFrame(int frame);
    void SaveCurrentFrame();
+   void SaveFrameToArena(SavedFrame *state);
+   void GrowArena(int size);
+   void SaveDeltaFrame(SavedFrame *state);
+   void LoadDeltaFrame(int frame);
+   void GrowDeltaBuffers(int size);
+   void SaveRegionFrame(SavedFrame *state);
+   void LoadRegionFrame(int frame);
+   void FindDirtyRegionPages();
+   void GetRegionPage(int page, int *offset, int *len);
    int FindSavedFrameIndex(int frame);
+   bool ShouldSaveFrame(int frame);
    SavedFrame &GetLastSavedFrame();
 
+   int GetFrameInputs(int frame, char *output);
+   void LogSpeculationInputs(char *inputs, int disconnect_flags);
+   void UpdateSpeculation();
+   void StartSpeculation(int queue, int frame);
+   bool AdoptSpeculation(int seek_to);
+   void CopyFrameToArena(int frame, byte *buf, int len);
+
    bool CreateQueues(Config &config);
    bool CheckSimulationConsistency(int *seekTo);
    void ResetPrediction(int frameNumber);
@@ -89,11 +128,71 @@ protected:
    SavedState     _savedstate;
    Config         _config;
 
+   /*
+    * Save buffers owned by Sync when the game provides save_game_state_into.
+    * One slot per entry in _savedstate.frames, each _arena_slot_size bytes.
+    */
+   byte           *_arena;
+   int            _arena_slot_size;
+
+   /*
+    * Delta compressed saves.  Only the newest saved frame is kept whole, in
+    * _delta_current.  Each slot holds the XOR delta against the frame saved
+    * before it, so older frames are rebuilt by walking back from the newest.
+    */
+   bool           _delta_compression;
+   byte           *_delta_current;
+   int            _delta_current_len;
+   byte           *_delta_scratch;
+   int            _delta_buffer_size;
+   byte           *_delta_encode_buf;
+   int            _delta_encode_size;
+
+   /*
+    * State region mode.  The game's state lives in one block of memory that
+    * we save and restore in place.  _region_shadow holds the region as of the
+    * newest save.  Each slot holds the pages that changed since the frame
+    * saved before it, along with their old contents, so rolling back copies
+    * only pages that were actually touched.
+    */
+   byte           *_region;
+   int            _region_size;
+   int            _region_offset;
+   int            _region_pages;
+   int            _page_size;
+   byte           *_region_shadow;
+   uint8          *_region_dirty;
+   Platform::DirtyPageTracker *_region_tracker;
+   bool           _region_saved;
+
+   /*
+    * Speculative simulation of late inputs on worker threads.  NULL unless
+    * the game has turned it on.
+    */
+   Speculator     *_speculator;
+   char           *_speculation_inputs;
+   char           *_speculation_candidates;
+
+   /*
+    * The inputs handed to the game for each frame still in the save ring,
+    * so speculation can be restarted from any of them.
+    */
+   char           *_speculation_log;
+   int            *_speculation_log_frames;
+   int            *_speculation_log_flags;
+
    bool           _rollingback;
    int            _last_confirmed_frame;
    int            _framecount;
    int            _max_prediction_frames;
 
+   /*
+    * _resimulated counts the frames re-simulated since the game last
+    * advanced a frame itself.
+    */
+   FGGPORollbackInfo _rollback_stats;
+   int            _resimulated;
+
    InputQueue     *_input_queues;
 
    RingBuffer<Event, 32> _event_queue;
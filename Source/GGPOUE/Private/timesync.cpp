@@ -12,6 +12,9 @@ TimeSync::TimeSync()
    memset(_local, 0, sizeof(_local));
    memset(_remote, 0, sizeof(_remote));
    _next_prediction = FRAME_WINDOW_SIZE * 3;
+   _period_start_frame = -1;
+   _period_start_time = 0;
+   _frame_period = 1000.0f / 60;
 }
 
 TimeSync::~TimeSync()
@@ -25,6 +28,18 @@ TimeSync::advance_frame(GameInput &input, int advantage, int radvantage)
    _last_inputs[input.frame % ARRAY_SIZE(_last_inputs)] = input;
    _local[input.frame % ARRAY_SIZE(_local)] = advantage;
    _remote[input.frame % ARRAY_SIZE(_remote)] = radvantage;
+
+   // Time a window of frames to see how fast the game is running
+   unsigned int now = Platform::GetCurrentTimeMS();
+   int frames = input.frame - _period_start_frame;
+   if (_period_start_frame < 0 || frames < 0) {
+      _period_start_frame = input.frame;
+      _period_start_time = now;
+   } else if (frames >= FRAME_WINDOW_SIZE) {
+      _frame_period = (now - _period_start_time) / (float)frames;
+      _period_start_frame = input.frame;
+      _period_start_time = now;
+   }
 }
 
 int
@@ -25,11 +25,21 @@ public:
    void advance_frame(GameInput &input, int advantage, int radvantage);
    int recommend_frame_wait_duration(bool require_idle_input);
 
+   /*
+    * How long a local frame has been taking, in ms, measured over the last
+    * FRAME_WINDOW_SIZE frames.  1000/60 until there's a measurement.
+    */
+   float frame_period() { return _frame_period; }
+
 protected:
    int         _local[FRAME_WINDOW_SIZE];
    int         _remote[FRAME_WINDOW_SIZE];
    GameInput   _last_inputs[MIN_UNIQUE_FRAMES];
    int         _next_prediction;
+
+   int          _period_start_frame;
+   unsigned int _period_start_time;
+   float        _frame_period;
 };
 
 #endif
@@ -28,6 +28,7 @@
 typedef unsigned char uint8;
 typedef unsigned short uint16;
 typedef unsigned int uint32;
+typedef unsigned long long uint64;
 typedef unsigned char byte;
 typedef signed char int8;
 typedef short int16;
@@ -0,0 +1,83 @@
+/* -----------------------------------------------------------------------
+ * GGPO.net (http://ggpo.net)  -  Copyright 2009 GroundStorm Studios, LLC.
+ *
+ * Use of this software is governed by the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#ifndef _VARINT_H
+#define _VARINT_H
+
+#include "types.h"
+
+#define VARINT_MAX_SIZE    5
+
+/*
+ * LEB128-style unsigned varints: 7 bits per byte, low bits first, with the
+ * high bit set on every byte but the last.  WriteVarint returns the new
+ * offset, or -1 if the value doesn't fit in capacity.
+ */
+static inline int
+WriteVarint(uint8 *out, int offset, int capacity, uint32 value)
+{
+   do {
+      if (offset >= capacity) {
+         return -1;
+      }
+      uint8 b = (uint8)(value & 0x7f);
+      value >>= 7;
+      out[offset++] = b | (value ? 0x80 : 0);
+   } while (value);
+   return offset;
+}
+
+static inline int
+VarintSize(uint32 value)
+{
+   int size = 1;
+   while (value >>= 7) {
+      size++;
+   }
+   return size;
+}
+
+/*
+ * Reads the varint at in[*offset] without going past len or past
+ * VARINT_MAX_SIZE bytes.  Returns false if it is cut off or too long.
+ */
+static inline bool
+ReadVarint(const uint8 *in, int len, int *offset, uint32 *value)
+{
+   uint32 v = 0;
+   uint8 b;
+   for (int i = 0; ; i++) {
+      if (i == VARINT_MAX_SIZE || *offset >= len) {
+         return false;
+      }
+      b = in[(*offset)++];
+      v |= (uint32)(b & 0x7f) << (7 * i);
+      if (!(b & 0x80)) {
+         break;
+      }
+   }
+   *value = v;
+   return true;
+}
+
+/*
+ * Maps small signed values to small unsigned ones (0, -1, 1, -2, ...) so
+ * they make short varints.
+ */
+static inline uint32
+ZigZag(int value)
+{
+   return ((uint32)value << 1) ^ (uint32)(value >> 31);
+}
+
+static inline int
+UnZigZag(uint32 value)
+{
+   return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+#endif // _VARINT_H
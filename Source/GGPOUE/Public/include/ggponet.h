@@ -19,6 +19,43 @@ enum class EGGPOPlayerType : uint8
     REMOTE     UMETA(DisplayName = "Remote"),
     SPECTATOR  UMETA(DisplayName = "Spectator"),
 };
+
+/*
+ * How GGPO.net guesses a remote player's input for frames it hasn't
+ * received yet.  See ggpo_set_input_predictor.
+ *
+ * REPEAT_LAST - The player keeps doing what they did on their last frame.
+ *
+ * HOLD - Like REPEAT_LAST, but a button the player has released after the
+ * same number of frames the last couple of times is predicted to be
+ * released after that many frames again.
+ *
+ * PATTERN - Finds the last time the player entered the same few inputs and
+ * predicts they'll continue the same way.  Good at motion inputs and other
+ * fixed sequences.
+ */
+UENUM(BlueprintType)
+enum class EGGPOInputPredictor : uint8
+{
+    REPEAT_LAST  UMETA(DisplayName = "Repeat Last"),
+    HOLD         UMETA(DisplayName = "Hold"),
+    PATTERN      UMETA(DisplayName = "Pattern"),
+};
+
+/*
+ * The shape of the latency added by ggpo_set_network_conditions.
+ *
+ * NORMAL - Gaussian around the mean.
+ *
+ * PARETO - Mostly a little under the mean, with a long tail of late
+ * packets, which is closer to what a congested link does.
+ */
+UENUM(BlueprintType)
+enum class EGGPOLatencyDistribution : uint8
+{
+    NORMAL       UMETA(DisplayName = "Normal"),
+    PARETO       UMETA(DisplayName = "Pareto"),
+};
 /*
  * The GGPONetworkStats function contains some statistics about the current
  * session.
@@ -43,6 +80,31 @@ enum class EGGPOPlayerType : uint8
  * network.kbps_sent - The estimated bandwidth used between the two
  * clients, in kilobits per second.
  *
+ * network.kbps_received - The same, in the other direction.
+ *
+ * network.packets_sent_per_second, network.packets_received_per_second -
+ * How many UDP packets go each way.
+ *
+ * network.packet_loss - The percentage of the remote client's packets
+ * that never arrived.
+ *
+ * network.out_of_order - The percentage of the remote client's packets
+ * that arrived after a later one, and so were thrown away.
+ *
+ * network.jitter - How much the arrival of the remote client's input
+ * wanders against a steady frame rate, in milliseconds.  The rate is the
+ * one the local game has been running at.  A frame delay that doesn't
+ * cover it will show up as rollbacks.
+ *
+ * network.avg_input_packet_size - The average size of the input packets
+ * sent to the remote client, in bytes, not counting UDP overhead.
+ *
+ * network.redundant_frames - The average number of frames in each input
+ * packet that were already sent in an earlier one, waiting to be acked.
+ *
+ * All of the network figures above are moving averages, updated once a
+ * second.
+ *
  * timesync.local_frames_behind - The number of frames GGPO.net calculates
  * that the local client is behind the remote client at this instant in
  * time.  For example, if at this instant the current game client is running
@@ -52,6 +114,17 @@ enum class EGGPOPlayerType : uint8
  * timesync.remote_frames_behind - The same as local_frames_behind, but
  * calculated from the perspective of the remote player.
  *
+ * rollback.rollbacks - The number of times the session has rolled back.
+ *
+ * rollback.frames_resimulated - The total number of frames re-simulated
+ * by those rollbacks.
+ *
+ * rollback.last_frame_resimulated - The number of frames re-simulated
+ * between the last two calls to ggpo_advance_frame.
+ *
+ * rollback.max_frame_resimulated - The most frames re-simulated between
+ * any two calls to ggpo_advance_frame.
+ *
  */
 USTRUCT(BlueprintType)
 struct FGGPONetworkInfo {
@@ -65,6 +138,22 @@ struct FGGPONetworkInfo {
     int32   ping;
     UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
     int32   kbps_sent;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   kbps_received;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   packets_sent_per_second;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   packets_received_per_second;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    float   packet_loss;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    float   out_of_order;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   jitter;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   avg_input_packet_size;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    float   redundant_frames;
 };
 
 USTRUCT(BlueprintType)
@@ -77,6 +166,20 @@ struct FGGPOSyncInfo {
     int32   remote_frames_behind;
 };
 
+USTRUCT(BlueprintType)
+struct FGGPORollbackInfo {
+    GENERATED_USTRUCT_BODY()
+
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   rollbacks;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   frames_resimulated;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   last_frame_resimulated;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    int32   max_frame_resimulated;
+};
+
 USTRUCT(BlueprintType)
 struct FGGPONetworkStats {
     GENERATED_USTRUCT_BODY()
@@ -85,6 +188,8 @@ struct FGGPONetworkStats {
     FGGPONetworkInfo network;
     UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
     FGGPOSyncInfo timesync;
+    UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+    FGGPORollbackInfo rollback;
 };
 
 /**
@@ -223,6 +328,8 @@ extern "C" {
 
 #define GGPO_MAX_PLAYERS                  4
 #define GGPO_MAX_PREDICTION_FRAMES        8
+#define GGPO_PREDICTION_FRAMES_LIMIT     64
+#define GGPO_MAX_SPECULATION_BRANCHES     8
 #define GGPO_MAX_SPECTATORS              32
 
 #define GGPO_SPECTATOR_INPUT_INTERVAL     4
@@ -273,6 +380,51 @@ typedef struct GGPOLocalEndpoint {
    int      player_num;
 } GGPOLocalEndpoint;
 
+/*
+ * The GGPONetworkConditions structure describes the link
+ * ggpo_set_network_conditions makes outgoing packets behave as if they
+ * were sent over.  Zero everywhere is a perfect link.
+ *
+ * latency, jitter: The mean one way delay and its standard deviation, in
+ *       milliseconds, drawn from distribution.
+ *
+ * loss, burst_loss: The percentage of packets lost while the link is good
+ *       and while it's bad (a Gilbert-Elliott model).
+ *
+ * burst_start, burst_end: The percentage chance with each packet that the
+ *       link goes bad, and that it recovers.  With burst_start at 0 the
+ *       link stays good and loss is just random.
+ *
+ * duplicate: The percentage of packets sent twice.
+ *
+ * reorder, reorder_delay: The percentage of packets held back by an
+ *       extra reorder_delay milliseconds, so that later ones overtake them.
+ *
+ * bandwidth: The link speed, in kilobits per second, or 0 for no limit.
+ *       Packets queue up behind each other at this rate.
+ *
+ * queue_limit: How many bytes can wait for the link before more are
+ *       dropped.  0 means 64 KB.
+ *
+ * seed: Seeds the random numbers behind all of the above, so a run can be
+ *       played back exactly.
+ */
+typedef struct GGPONetworkConditions {
+   int                        latency;
+   int                        jitter;
+   EGGPOLatencyDistribution   distribution;
+   float                      loss;
+   float                      burst_loss;
+   float                      burst_start;
+   float                      burst_end;
+   float                      duplicate;
+   float                      reorder;
+   int                        reorder_delay;
+   int                        bandwidth;
+   int                        queue_limit;
+   unsigned int               seed;
+} GGPONetworkConditions;
+
 
 #define GGPO_ERRORLIST                                               \
    GGPO_ERRORLIST_ENTRY(GGPO_OK,                               0)    \
@@ -439,6 +591,28 @@ struct GGPOSessionCallbacks {
      * structure above for more information.
      */
     std::function<bool(GGPOEvent * info)> on_event;
+
+    /*
+     * save_game_state_into - Optional replacement for save_game_state and
+     * free_buffer.  If set, GGPO.net owns the save buffers and passes one
+     * of capacity bytes; copy the game state into it and store the number
+     * of bytes written in *len.  If the state does not fit, store the size
+     * you need in *len and return false.  GGPO.net will grow its buffers
+     * and call you again.  The checksum works as in save_game_state.
+     */
+    std::function<bool(unsigned char* buffer, int capacity, int* len, int* checksum, int frame)> save_game_state_into;
+
+    /*
+     * advance_state - Optional, only used with ggpo_set_speculation.  Advance
+     * the saved state in buffer by exactly one frame using inputs, laid out
+     * as ggpo_synchronize_input would return them.  len holds the size of
+     * the state and should be updated if it changes; buffer has room for
+     * capacity bytes.  This must not touch anything outside of buffer, must
+     * produce exactly what advance_frame would and will be called from
+     * several threads at once.  Return false if the frame can't be
+     * simulated.
+     */
+    std::function<bool(unsigned char* buffer, int* len, int capacity, const void* inputs, int disconnect_flags, int frame)> advance_state;
 };
 
 extern "C" {
@@ -502,6 +676,28 @@ extern "C" {
       * structure above for more information.
       */
      bool(__cdecl* on_event)(GGPOEvent* info);
+
+     /*
+      * save_game_state_into - Optional replacement for save_game_state and
+      * free_buffer.  If set, GGPO.net owns the save buffers and passes one
+      * of capacity bytes; copy the game state into it and store the number
+      * of bytes written in *len.  If the state does not fit, store the size
+      * you need in *len and return false.  GGPO.net will grow its buffers
+      * and call you again.  The checksum works as in save_game_state.
+      */
+     bool(__cdecl* save_game_state_into)(unsigned char* buffer, int capacity, int* len, int* checksum, int frame);
+
+     /*
+      * advance_state - Optional, only used with ggpo_set_speculation.  Advance
+      * the saved state in buffer by exactly one frame using inputs, laid out
+      * as ggpo_synchronize_input would return them.  len holds the size of
+      * the state and should be updated if it changes; buffer has room for
+      * capacity bytes.  This must not touch anything outside of buffer, must
+      * produce exactly what advance_frame would and will be called from
+      * several threads at once.  Return false if the frame can't be
+      * simulated.
+      */
+     bool(__cdecl* advance_state)(unsigned char* buffer, int* len, int capacity, const void* inputs, int disconnect_flags, int frame);
  } GGPOSessionCallbacks;
 
 #endif
@@ -540,6 +736,26 @@ public:
         int input_size,
         unsigned short localport);
 
+    /*
+     * Same as above, but with a custom prediction window instead of the
+     * default of GGPO_MAX_PREDICTION_FRAMES.
+     *
+     * max_prediction_frames - How many frames the game may run ahead of the
+     * last confirmed input before ggpo_add_local_input starts returning
+     * GGPO_ERRORCODE_PREDICTION_THRESHOLD.  Low latency sessions can use a
+     * smaller window to save memory; high latency or high tick rate sessions
+     * can use a larger one to avoid stalling.  GGPO.net keeps one saved state
+     * per frame of the window.  Must be between 1 and
+     * GGPO_PREDICTION_FRAMES_LIMIT.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_start_session(GGPOSession** session,
+        GGPOSessionCallbacks* cb,
+        const char* game,
+        int num_players,
+        int input_size,
+        unsigned short localport,
+        int max_prediction_frames);
+
 
     /*
      * ggpo_add_player --
@@ -763,6 +979,169 @@ public:
      */
     static GGPO_API GGPOErrorCode __cdecl ggpo_try_synchronize_local(GGPOSession* ggpo);
 
+    /*
+     * ggpo_set_state_compression --
+     *
+     * Keep saved states as XOR deltas against the previously saved frame
+     * rather than as full copies.  Only the most recent state is stored
+     * whole; older ones are rebuilt when GGPO.net rolls back to them.  This
+     * costs a little time during rollbacks but uses far less memory when
+     * consecutive states are mostly identical.
+     *
+     * Must be called before the first call to ggpo_add_local_input.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_set_state_compression(GGPOSession* ggpo,
+        bool enable);
+
+    /*
+     * ggpo_register_state_region --
+     *
+     * For games that keep their entire simulation state in one contiguous
+     * block of memory.  GGPO.net will save and restore that block in place
+     * instead of calling save_game_state, copying only the pages written
+     * since the previous save.  On Linux written pages are found with a
+     * userfaultfd write-protect on the region, or with the kernel's
+     * soft-dirty bits for one session at a time on kernels older than 6.7;
+     * elsewhere every page is compared against the last save.
+     *
+     * After a rollback the region already holds the restored frame, and
+     * load_game_state is called with the region itself so the game can
+     * rebuild anything derived from it.  save_game_state is not called, so
+     * checksums are not available in this mode.
+     *
+     * Cannot be combined with ggpo_set_state_compression and must be called
+     * before the first call to ggpo_add_local_input.
+     *
+     * base - The start of the state region.
+     *
+     * size - The size of the region in bytes.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_register_state_region(GGPOSession* ggpo,
+        void* base,
+        int size);
+
+    /*
+     * ggpo_set_speculation --
+     *
+     * When a remote player's input is late, simulate a few likely
+     * alternatives for it ahead of time on worker threads.  If the input
+     * that finally arrives matches one of them, GGPO.net loads the state
+     * that branch reached instead of rolling back, and advance_frame is not
+     * called for the frames in between.
+     *
+     * Only for deterministic simulations that implement advance_state.  Also
+     * requires save_game_state_into, and cannot be combined with
+     * ggpo_set_state_compression or ggpo_register_state_region.  Must be
+     * called before the first call to ggpo_add_local_input.
+     *
+     * num_branches - How many alternative inputs to try, at most
+     * GGPO_MAX_SPECULATION_BRANCHES.  The late player releasing everything
+     * is tried first, then the other inputs they've used recently.  Pass 0
+     * to turn speculation off.
+     *
+     * num_threads - The number of worker threads to simulate on.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_set_speculation(GGPOSession* ggpo,
+        int num_branches,
+        int num_threads);
+
+    /*
+     * ggpo_set_rollback_coalescing --
+     *
+     * By default GGPO.net rolls back as soon as it receives an input that
+     * doesn't match its prediction, which can happen several times a frame
+     * when inputs from different players arrive a few milliseconds apart.
+     * With coalescing on, mispredictions are only noted when packets arrive
+     * and a single rollback back to the earliest of them is done at the
+     * start of the next frame, in the first call to ggpo_add_local_input or
+     * ggpo_synchronize_input.
+     *
+     * enable - true to coalesce rollbacks.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_set_rollback_coalescing(GGPOSession* ggpo,
+        bool enable);
+
+    /*
+     * ggpo_set_input_predictor --
+     *
+     * Choose how inputs are predicted for a player whose inputs haven't
+     * arrived yet.  Every wrong guess costs a rollback, so pick whatever
+     * matches how the game is played.  The default is
+     * EGGPOInputPredictor::REPEAT_LAST.  May be changed at any time.
+     *
+     * player - The player handle returned from ggpo_add_player, or
+     * GGPO_INVALID_HANDLE to change every player.
+     *
+     * predictor - The prediction model to use.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_set_input_predictor(GGPOSession* ggpo,
+        GGPOPlayerHandle player,
+        EGGPOInputPredictor predictor);
+
+    /*
+     * ggpo_set_input_relevance_mask --
+     *
+     * Tell GGPO.net which input bits can affect the simulation.  When a
+     * remote input arrives that differs from the prediction only in bits
+     * that are clear in the mask, the prediction is treated as correct and
+     * no rollback happens.  The game must really ignore those bits: the
+     * frame won't be simulated again with the real input.
+     *
+     * The mask may be changed as often as every frame.  Each prediction is
+     * checked with the mask that was set when ggpo_synchronize_input
+     * returned it, so to vary the mask with the game state, set it before
+     * every call to ggpo_synchronize_input, including during rollbacks.
+     *
+     * mask - One bit per input bit, laid out like the values passed to
+     * ggpo_add_local_input, applied to every player.  NULL makes every bit
+     * relevant again.
+     *
+     * size - The size of the mask.  Must equal the input size passed to
+     * ggpo_start_session.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_set_input_relevance_mask(GGPOSession* ggpo,
+        void* mask,
+        int size);
+
+    /*
+     * ggpo_set_network_thread --
+     *
+     * Move all network traffic onto a thread of its own.  Normally packets
+     * are only sent and received inside ggpo_idle and
+     * ggpo_advance_frame, so a long frame delays inputs and acks from the
+     * other players and throws off the ping measurements.  With the thread
+     * running they are handled as soon as they arrive; the game thread
+     * picks up the results the next time it calls into GGPO.net.  Callbacks
+     * are still only ever made on the game thread.
+     *
+     * enable - true to start the network thread, false to stop it.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_set_network_thread(GGPOSession* ggpo,
+        bool enable);
+
+    /*
+     * ggpo_set_network_conditions --
+     *
+     * For testing.  Makes the packets sent to a player behave as if they
+     * went over a worse network than they do: delayed, lost in bursts,
+     * duplicated, reordered and throttled as described by conditions.
+     * Only outgoing packets are affected, so to degrade both directions
+     * between two sessions, call this on both.  May be changed at any time.
+     *
+     * The ggpo.network.delay and ggpo.oop.percent settings, and the
+     * ggpo.network.sim.* ones named after the fields of
+     * GGPONetworkConditions, set the conditions for every player when the
+     * session starts.
+     *
+     * player - The player handle returned from ggpo_add_player, or
+     * GGPO_INVALID_HANDLE to change every player.
+     *
+     * conditions - The conditions to simulate, or NULL to stop simulating.
+     */
+    static GGPO_API GGPOErrorCode __cdecl ggpo_set_network_conditions(GGPOSession* ggpo,
+        GGPOPlayerHandle player,
+        const GGPONetworkConditions* conditions);
+
 
     /*
      * ggpo_log --